@@ -0,0 +1,373 @@
+#include "tree_of_work.h"
+#include "tree_of_work_graph.h"
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <memory>
+#include <new>
+#include <random>
+#include <string>
+#include <vector>
+
+/**************************
+ * Scheduling overhead benchmark
+ *
+ * Builds canonical topologies out of empty nodes and reports
+ * for every executor and thread count:
+ *   - nodes/s        node throughput of repeated runs
+ *   - p50/p99        latency from "node became ready" (last parent finished)
+ *                    to "worker started", in microseconds
+ *   - build B/node   heap bytes allocated per node while building
+ *   - run B/node     heap bytes allocated per node and run
+ *
+ * usage: tree_work_benchmark [nodes] [runs]
+ *************************/
+
+static std::atomic<size_t> g_allocated_bytes( 0 );
+
+// gcc sees through the replaced operators and reports their free()
+// as freeing a non heap object or a pointer of a mismatched new
+#if defined(__GNUC__) && !defined(__clang__)
+#pragma GCC diagnostic ignored "-Wfree-nonheap-object"
+#if __GNUC__ >= 11
+#pragma GCC diagnostic ignored "-Wmismatched-new-delete"
+#endif
+#endif
+
+// every replaced overload counts and allocates with malloc/free
+static void* counted_malloc( size_t size )
+{
+    g_allocated_bytes.fetch_add( size, std::memory_order_relaxed );
+    if ( void* p = std::malloc( size ) )
+        return p;
+    throw std::bad_alloc();
+}
+void* operator new( size_t size )
+{
+    return counted_malloc( size );
+}
+void* operator new[]( size_t size )
+{
+    return counted_malloc( size );
+}
+void operator delete( void* p ) noexcept
+{
+    std::free( p );
+}
+void operator delete[]( void* p ) noexcept
+{
+    std::free( p );
+}
+void operator delete( void* p, size_t ) noexcept
+{
+    std::free( p );
+}
+void operator delete[]( void* p, size_t ) noexcept
+{
+    std::free( p );
+}
+
+using Clock = std::chrono::steady_clock;
+
+static int64_t now_ns()
+{
+    return std::chrono::duration_cast<std::chrono::nanoseconds>( Clock::now().time_since_epoch() ).count();
+}
+
+/**************************
+ * a topology: parents of each node, nodes are
+ * topologically ordered; all relations are AND
+ *************************/
+struct Topology
+{
+    std::string                        name;
+    std::vector<std::vector<uint32_t>> parents;
+
+    uint32_t add( std::vector<uint32_t> p = {} )
+    {
+        parents.push_back( std::move( p ) );
+        return static_cast<uint32_t>( parents.size() - 1 );
+    }
+    // joins all nodes without children, so waiting for the last node waits for all
+    void add_sink()
+    {
+        std::vector<bool> has_child( parents.size(), false );
+        for( const auto& p : parents )
+            for( uint32_t parent : p )
+                has_child[parent] = true;
+
+        std::vector<uint32_t> leaves;
+        for( uint32_t i = 0; i < parents.size(); ++i )
+            if ( !has_child[i] )
+                leaves.push_back( i );
+        if ( leaves.size() > 1 )
+            add( leaves );
+    }
+};
+
+static Topology make_chain( size_t n )
+{
+    Topology t{ "chain", {} };
+    uint32_t last = t.add();
+    for( size_t i = 1; i < n; ++i )
+        last = t.add( { last } );
+    return t;
+}
+
+static Topology make_fan( size_t n )
+{
+    Topology t{ "fan-out/in", {} };
+    const uint32_t root = t.add();
+    for( size_t i = 2; i < n; ++i )
+        t.add( { root } );
+    t.add_sink();
+    return t;
+}
+
+static Topology make_binary_tree( size_t n )
+{
+    Topology t{ "binary tree", {} };
+    t.add();
+    for( uint32_t i = 1; i + 1 < n; ++i )
+        t.add( { ( i - 1 ) / 2 } );
+    t.add_sink();
+    return t;
+}
+
+static Topology make_diamonds( size_t n )
+{
+    Topology t{ "diamonds(8)", {} };
+    const size_t width = 8;
+    uint32_t top = t.add();
+    while( t.parents.size() + width + 1 <= n )
+    {
+        std::vector<uint32_t> middle;
+        for( size_t i = 0; i < width; ++i )
+            middle.push_back( t.add( { top } ) );
+        top = t.add( middle );
+    }
+    return t;
+}
+
+static Topology make_random_dag( size_t n )
+{
+    Topology t{ "random dag", {} };
+    std::mt19937 random( 42 );
+    t.add();
+    for( uint32_t i = 1; i + 1 < n; ++i )
+    {
+        std::vector<uint32_t> p;
+        const uint32_t count = 1 + random() % 3;
+        for( uint32_t k = 0; k < count; ++k )
+        {
+            const uint32_t window = std::min<uint32_t>( i, 64 );
+            const uint32_t parent = i - 1 - random() % window;
+            if ( std::find( p.begin(), p.end(), parent ) == p.end() )
+                p.push_back( parent );
+        }
+        t.add( p );
+    }
+    t.add_sink();
+    return t;
+}
+
+/**************************
+ * start and finish timestamps of all nodes of one run
+ *************************/
+struct Stamps
+{
+    std::vector<int64_t> start;
+    std::vector<int64_t> finish;
+    int64_t              triggered;
+};
+
+struct Result
+{
+    double nodes_per_second;
+    double p50_us;
+    double p99_us;
+    double build_bytes_per_node;
+    double run_bytes_per_node;
+};
+
+static void collect_latencies( const Topology& t, const Stamps& s, std::vector<int64_t>& latencies )
+{
+    for( size_t i = 0; i < t.parents.size(); ++i )
+    {
+        int64_t ready = s.triggered;
+        for( uint32_t p : t.parents[i] )
+            ready = std::max( ready, s.finish[p] );
+        latencies.push_back( s.start[i] - ready );
+    }
+}
+
+static Result summarize( const Topology& t, std::vector<int64_t>& latencies,
+                         int64_t run_ns, size_t runs, size_t build_bytes, size_t run_bytes )
+{
+    std::sort( latencies.begin(), latencies.end() );
+    const size_t n = t.parents.size();
+
+    Result r;
+    r.nodes_per_second = double( n * runs ) / ( double( run_ns ) / 1e9 );
+    r.p50_us = double( latencies[latencies.size() / 2] ) / 1000.0;
+    r.p99_us = double( latencies[latencies.size() * 99 / 100] ) / 1000.0;
+    r.build_bytes_per_node = double( build_bytes ) / double( n );
+    r.run_bytes_per_node = double( run_bytes ) / double( n * runs );
+    return r;
+}
+
+/**************************
+ * tree built from Work nodes
+ *************************/
+static Result run_work( const Topology& t, const std::shared_ptr<TreeOfWork::Executor>& executor, size_t runs )
+{
+    using TreeOfWork::Work;
+
+    const size_t n = t.parents.size();
+    Stamps stamps{ std::vector<int64_t>( n ), std::vector<int64_t>( n ), 0 };
+
+    const size_t bytes_before_build = g_allocated_bytes.load();
+    std::vector<std::shared_ptr<Work>> nodes;
+    nodes.reserve( n );
+    for( size_t i = 0; i < n; ++i )
+    {
+        nodes.push_back( Work::make_work( [&stamps, i](const Work::Control& control)
+                                          {
+                                              stamps.start[i] = now_ns();
+                                              stamps.finish[i] = now_ns();
+                                              control.set_completed();
+                                          },
+                                          executor ) );
+    }
+    for( size_t i = 0; i < n; ++i )
+        for( uint32_t p : t.parents[i] )
+            Work::execute_if_all_finished( { nodes[p] }, { nodes[i] } );
+    const size_t build_bytes = g_allocated_bytes.load() - bytes_before_build;
+
+    std::vector<int64_t> latencies;
+    latencies.reserve( n * runs );
+    int64_t run_ns = 0;
+    size_t run_bytes = 0;
+    for( size_t r = 0; r < runs; ++r )
+    {
+        for( auto& node : nodes )
+            node->reset();
+
+        const size_t bytes_before_run = g_allocated_bytes.load();
+        stamps.triggered = now_ns();
+        nodes[0]->trigger();
+        nodes[n - 1]->wait_for_done();
+        run_ns += now_ns() - stamps.triggered;
+        run_bytes += g_allocated_bytes.load() - bytes_before_run;
+
+        collect_latencies( t, stamps, latencies );
+    }
+    // a thread per node executor may still be leaving the last worker
+    std::this_thread::sleep_for( std::chrono::milliseconds( 1 ) );
+
+    return summarize( t, latencies, run_ns, runs, build_bytes, run_bytes );
+}
+
+/**************************
+ * same topology as compiled Graph
+ *************************/
+static Result run_graph( const Topology& t, const std::shared_ptr<TreeOfWork::Executor>& executor, size_t runs )
+{
+    using TreeOfWork::Work;
+    using TreeOfWork::GraphBuilder;
+
+    const size_t n = t.parents.size();
+    Stamps stamps{ std::vector<int64_t>( n ), std::vector<int64_t>( n ), 0 };
+
+    const size_t bytes_before_build = g_allocated_bytes.load();
+    GraphBuilder builder;
+    for( size_t i = 0; i < n; ++i )
+    {
+        builder.add( [&stamps, i](const Work::Control& control)
+                     {
+                         stamps.start[i] = now_ns();
+                         stamps.finish[i] = now_ns();
+                         control.set_completed();
+                     } );
+    }
+    for( uint32_t i = 0; i < n; ++i )
+        for( uint32_t p : t.parents[i] )
+            builder.execute_if_all_finished( { p }, { i } );
+    std::shared_ptr<TreeOfWork::Graph> graph = builder.compile();
+    const size_t build_bytes = g_allocated_bytes.load() - bytes_before_build;
+
+    std::vector<int64_t> latencies;
+    latencies.reserve( n * runs );
+    int64_t run_ns = 0;
+    size_t run_bytes = 0;
+    for( size_t r = 0; r < runs; ++r )
+    {
+        const size_t bytes_before_run = g_allocated_bytes.load();
+        stamps.triggered = now_ns();
+        graph->run( executor );
+        graph->wait_for_done();
+        run_ns += now_ns() - stamps.triggered;
+        run_bytes += g_allocated_bytes.load() - bytes_before_run;
+
+        collect_latencies( t, stamps, latencies );
+    }
+    std::this_thread::sleep_for( std::chrono::milliseconds( 1 ) );
+
+    return summarize( t, latencies, run_ns, runs, build_bytes, run_bytes );
+}
+
+static void print( const char* shape, const char* model, const char* executor, size_t threads, const Result& r )
+{
+    std::printf( "%-12s %-6s %-14s %7s %12.0f %10.2f %10.2f %12.1f %10.1f\n",
+                 shape, model, executor,
+                 threads == 0 ? "-" : std::to_string( threads ).c_str(),
+                 r.nodes_per_second, r.p50_us, r.p99_us,
+                 r.build_bytes_per_node, r.run_bytes_per_node );
+}
+
+int main( int argc, char** argv )
+{
+    const size_t nodes = argc > 1 ? std::strtoul( argv[1], nullptr, 10 ) : 10000;
+    const size_t runs  = argc > 2 ? std::strtoul( argv[2], nullptr, 10 ) : 10;
+
+    std::vector<size_t> thread_counts;
+    const size_t hardware = std::max<size_t>( 1, std::thread::hardware_concurrency() );
+    for( size_t t = 1; t < hardware; t *= 2 )
+        thread_counts.push_back( t );
+    thread_counts.push_back( hardware );
+
+    const std::vector<Topology> shapes = { make_chain( nodes ),
+                                           make_fan( nodes ),
+                                           make_binary_tree( nodes ),
+                                           make_diamonds( nodes ),
+                                           make_random_dag( nodes ) };
+
+    std::printf( "%zu nodes, %zu runs\n", nodes, runs );
+    std::printf( "%-12s %-6s %-14s %7s %12s %10s %10s %12s %10s\n",
+                 "shape", "model", "executor", "threads", "nodes/s", "p50 us", "p99 us", "build B/node", "run B/node" );
+
+    for( const Topology& shape : shapes )
+    {
+        const char* name = shape.name.c_str();
+
+        // the classic model, limited to a single run to keep the thread churn bearable
+        std::shared_ptr<TreeOfWork::Executor> per_task = std::make_shared<TreeOfWork::ThreadPerTaskExecutor>();
+        print( name, "Work", "thread/node", 0, run_work( shape, per_task, 1 ) );
+
+        for( size_t threads : thread_counts )
+        {
+            std::shared_ptr<TreeOfWork::Executor> pool = std::make_shared<TreeOfWork::ThreadPoolExecutor>( threads );
+            std::shared_ptr<TreeOfWork::Executor> stealing = std::make_shared<TreeOfWork::WorkStealingExecutor>( threads );
+
+            print( name, "Work",  "pool",     threads, run_work( shape, pool, runs ) );
+            print( name, "Work",  "stealing", threads, run_work( shape, stealing, runs ) );
+            print( name, "Graph", "pool",     threads, run_graph( shape, pool, runs ) );
+            print( name, "Graph", "stealing", threads, run_graph( shape, stealing, runs ) );
+        }
+    }
+
+    return 0;
+}
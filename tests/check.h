@@ -0,0 +1,40 @@
+#ifndef TREE_OF_WORK_TEST_CHECK
+#define TREE_OF_WORK_TEST_CHECK
+
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <thread>
+
+/**************************
+ * minimal checks for the ctest programs: a failed CHECK
+ * prints the condition and ends the test with exit code 1
+ *************************/
+#define CHECK( condition )                                                        \
+    do                                                                            \
+    {                                                                             \
+        if ( !( condition ) )                                                     \
+        {                                                                         \
+            std::fprintf( stderr, "%s:%d: CHECK( %s ) failed\n",                  \
+                          __FILE__, __LINE__, #condition );                       \
+            std::exit( 1 );                                                       \
+        }                                                                         \
+    } while( false )
+
+/**************************
+ * polls condition until it holds or the timeout is over
+ *************************/
+template<typename F>
+static bool eventually( F&& condition, std::chrono::milliseconds timeout = std::chrono::milliseconds( 10000 ) )
+{
+    const auto end = std::chrono::steady_clock::now() + timeout;
+    while( !condition() )
+    {
+        if ( std::chrono::steady_clock::now() > end )
+            return false;
+        std::this_thread::sleep_for( std::chrono::milliseconds( 1 ) );
+    }
+    return true;
+}
+
+#endif /* TREE_OF_WORK_TEST_CHECK */
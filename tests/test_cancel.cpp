@@ -0,0 +1,70 @@
+#include "tree_of_work.h"
+#include "check.h"
+
+#include <memory>
+#include <vector>
+
+/**************************
+ * Work::cancel
+ *************************/
+using TreeOfWork::Work;
+
+static void completed( const Work::Control& control )
+{
+    control.set_completed();
+}
+
+// a chain of finished diamonds reaches the same nodes by 2^levels paths
+static void cancel_finished_diamonds()
+{
+    std::vector<std::shared_ptr<Work>> nodes( 1, Work::make_work( &completed ) );
+    std::shared_ptr<Work> top = nodes.front();
+    for( int level = 0; level < 64; ++level )
+    {
+        std::shared_ptr<Work> left = Work::make_work( &completed );
+        std::shared_ptr<Work> right = Work::make_work( &completed );
+        std::shared_ptr<Work> bottom = Work::make_work( &completed );
+        Work::execute_if_all_finished( { top }, { left, right } );
+        Work::execute_if_all_finished( { left, right }, { bottom } );
+        nodes.insert( nodes.end(), { left, right, bottom } );
+        top = bottom;
+    }
+    // waits on the last node before, so the cancelled leaf is the only one touched
+    std::shared_ptr<Work> leaf = Work::make_work( &completed );
+    std::shared_ptr<Work> gate = Work::make_work( &completed );
+    Work::execute_if_all_finished( { top, gate }, { leaf } );
+
+    nodes.front()->trigger();
+    top->wait_for_done();
+
+    nodes.front()->cancel();
+    CHECK( leaf->try_is_done() );
+    CHECK( leaf->get_state() == Work::State::Cancelled );
+    CHECK( top->get_state() == Work::State::Completed );
+    CHECK( gate->get_state() == Work::State::Created );
+}
+
+// nodes which have not started are cancelled, running ones keep running
+static void cancel_before_start()
+{
+    std::shared_ptr<Work> root = Work::make_work( &completed );
+    std::shared_ptr<Work> a = Work::make_work( &completed );
+    std::shared_ptr<Work> b = Work::make_work( &completed );
+    std::shared_ptr<Work> c = Work::make_work( &completed );
+    Work::execute_if_all_finished( { root }, { a, b } );
+    Work::execute_if_any_finished( { a, b }, { c } );
+
+    root->cancel();
+    for( const std::shared_ptr<Work>& node : { root, a, b, c } )
+    {
+        CHECK( node->try_is_done() );
+        CHECK( node->get_state() == Work::State::Cancelled );
+    }
+}
+
+int main()
+{
+    cancel_finished_diamonds();
+    cancel_before_start();
+    return 0;
+}
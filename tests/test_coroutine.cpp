@@ -0,0 +1,109 @@
+#include "tree_of_work_coroutine.h"
+#include "check.h"
+
+#include <atomic>
+#include <chrono>
+#include <memory>
+#include <stdexcept>
+#include <thread>
+#include <vector>
+
+/**************************
+ * coroutine workers (C++20)
+ *************************/
+#ifdef TREE_OF_WORK_HAS_COROUTINES
+using TreeOfWork::Work;
+using TreeOfWork::AsyncWork;
+using TreeOfWork::Executor;
+
+// sleeping workers do not hold the only thread of the executor
+static void sleep_without_thread( const std::shared_ptr<Executor>& executor )
+{
+    std::atomic<int> woken( 0 );
+    std::vector<std::shared_ptr<Work>> nodes;
+    for( int i = 0; i < 100; ++i )
+    {
+        nodes.push_back( TreeOfWork::make_async_work( [&woken]() -> AsyncWork
+                                                      {
+                                                          const auto start = std::chrono::steady_clock::now();
+                                                          co_await TreeOfWork::sleep_for( std::chrono::milliseconds( 20 ) );
+                                                          if ( std::chrono::steady_clock::now() >= start + std::chrono::milliseconds( 20 ) )
+                                                              woken++;
+                                                      }, executor ) );
+    }
+
+    const auto start = std::chrono::steady_clock::now();
+    for( std::shared_ptr<Work>& node : nodes )
+        node->trigger();
+    for( std::shared_ptr<Work>& node : nodes )
+        node->wait_for_done();
+
+    // 2 s if every sleep blocked the thread
+    CHECK( std::chrono::steady_clock::now() - start < std::chrono::milliseconds( 1000 ) );
+    CHECK( woken.load() == 100 );
+    for( std::shared_ptr<Work>& node : nodes )
+        CHECK( node->get_state() == Work::State::Completed );
+}
+
+// a throwing coroutine fails its node and cancels the children
+static void failure( const std::shared_ptr<Executor>& executor )
+{
+    std::shared_ptr<Work> node = TreeOfWork::make_async_work( []() -> AsyncWork
+                                                              {
+                                                                  co_await TreeOfWork::sleep_for( std::chrono::milliseconds( 1 ) );
+                                                                  throw std::runtime_error( "failed" );
+                                                              }, executor );
+    std::shared_ptr<Work> child = Work::make_work( [](const Work::Control& c){ c.set_completed(); }, executor );
+    Work::execute_if_all_finished( { node }, { child } );
+
+    node->trigger();
+    node->wait_for_done();
+    child->wait_for_done();
+    CHECK( node->get_state() == Work::State::Failed );
+    CHECK( child->get_state() == Work::State::Cancelled );
+}
+
+// resume_by hands the resumption to another thread, co_await waits for a node
+static void resume_from_other_thread( const std::shared_ptr<Executor>& executor )
+{
+    std::shared_ptr<Work> other = Work::make_work( [](const Work::Control& c){ c.set_completed(); }, executor );
+    int reply = 0;
+    Work::State other_state = Work::State::Created;
+    std::thread io;
+
+    std::shared_ptr<Work> node = TreeOfWork::make_async_work( [&]() -> AsyncWork
+    {
+        co_await TreeOfWork::resume_by( [&io, &reply](AsyncWork::Resume resume)
+                                        {
+                                            io = std::thread( [&reply, resume]
+                                                              {
+                                                                  reply = 42;
+                                                                  resume();
+                                                              } );
+                                        } );
+        other->trigger();
+        other_state = co_await *other;
+    }, executor );
+
+    node->trigger();
+    node->wait_for_done();
+    io.join();
+    CHECK( node->get_state() == Work::State::Completed );
+    CHECK( reply == 42 );
+    CHECK( other_state == Work::State::Completed );
+}
+
+int main()
+{
+    std::shared_ptr<Executor> executor = std::make_shared<TreeOfWork::ThreadPoolExecutor>( 1 );
+    sleep_without_thread( executor );
+    failure( executor );
+    resume_from_other_thread( executor );
+    return 0;
+}
+#else
+int main()
+{
+    return 0;
+}
+#endif
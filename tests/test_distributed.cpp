@@ -0,0 +1,158 @@
+#include "tree_of_work_distributed.h"
+#include "check.h"
+
+#include <atomic>
+#include <cstring>
+#include <memory>
+#include <vector>
+
+/**************************
+ * DistributedGraph over a LoopbackNetwork
+ *************************/
+using TreeOfWork::Work;
+using TreeOfWork::Graph;
+using TreeOfWork::GraphBuilder;
+using TreeOfWork::Partition;
+using TreeOfWork::DistributedGraph;
+using TreeOfWork::LoopbackNetwork;
+
+static const size_t ChainLength = 8;
+static std::atomic<int> g_results[ChainLength];
+static std::atomic<int> g_fail_at( -1 );
+
+static std::vector<char> encode( int value )
+{
+    std::vector<char> bytes( sizeof(value) );
+    std::memcpy( bytes.data(), &value, sizeof(value) );
+    return bytes;
+}
+
+static int decode( const std::vector<char>& bytes )
+{
+    int value = 0;
+    CHECK( bytes.size() == sizeof(value) );
+    std::memcpy( &value, bytes.data(), sizeof(value) );
+    return value;
+}
+
+// a chain node passes the value of its parent plus one to its child
+static void step( const Work::Control& control )
+{
+    DistributedGraph& graph = DistributedGraph::of( control );
+    const Graph::NodeId node = graph.global_id( control.index() );
+    if ( static_cast<int>( node ) == g_fail_at.load() )
+    {
+        control.set_failed();
+        return;
+    }
+
+    const int value = node == 0 ? 0 : decode( graph.payload( node - 1 ) ) + 1;
+    g_results[node] = value;
+    graph.set_payload( control, encode( value ) );
+    control.set_completed();
+}
+
+static std::shared_ptr<Graph> make_chain()
+{
+    GraphBuilder builder;
+    for( Graph::NodeId i = 0; i < ChainLength; ++i )
+    {
+        builder.set_name( builder.add( &step ), "step" );
+        if ( i > 0 )
+            builder.execute_if_all_finished( { i - 1 }, { i } );
+    }
+    return builder.compile();
+}
+
+static void clear_results()
+{
+    for( std::atomic<int>& result : g_results )
+        result = -1;
+}
+
+// every other node on the other host, so every edge is cut
+static void chain_across_hosts()
+{
+    std::shared_ptr<Graph> topology = make_chain();
+    std::vector<Partition::HostId> hosts;
+    for( Graph::NodeId i = 0; i < ChainLength; ++i )
+        hosts.push_back( i % 2 );
+    const Partition partition( *topology, hosts, 2 );
+    CHECK( partition.cut_edges() == ChainLength - 1 );
+
+    TreeOfWork::WorkerRegistry registry;
+    registry.add( "step", &step );
+
+    LoopbackNetwork network( 2 );
+    DistributedGraph host0( *topology, partition, 0, registry, network.endpoint( 0 ) );
+    DistributedGraph host1( *topology, partition, 1, registry, network.endpoint( 1 ) );
+
+    for( int run = 0; run < 5; ++run )
+    {
+        clear_results();
+        // the second host starts first on every other run
+        if ( run % 2 == 0 )
+        {
+            host0.run();
+            host1.run();
+        }
+        else
+        {
+            host1.run();
+            host0.run();
+        }
+        CHECK( host0.wait_for_done( std::chrono::seconds( 30 ) ) );
+        CHECK( host1.wait_for_done( std::chrono::seconds( 30 ) ) );
+
+        for( Graph::NodeId i = 0; i < ChainLength; ++i )
+        {
+            CHECK( g_results[i].load() == static_cast<int>( i ) );
+            DistributedGraph& owner = i % 2 == 0 ? host0 : host1;
+            CHECK( owner.get_state( i ) == Work::State::Completed );
+        }
+    }
+}
+
+// a failed node cancels its descendants on the other hosts
+static void failure_across_hosts()
+{
+    std::shared_ptr<Graph> topology = make_chain();
+    const Partition partition = Partition::make( *topology, 3 );
+    for( Partition::HostId host = 0; host < 3; ++host )
+        CHECK( partition.load( host ) > 0 );
+
+    TreeOfWork::WorkerRegistry registry;
+    registry.add( "step", &step );
+
+    LoopbackNetwork network( 3 );
+    std::vector<std::unique_ptr<DistributedGraph>> hosts;
+    for( Partition::HostId host = 0; host < 3; ++host )
+        hosts.emplace_back( new DistributedGraph( *topology, partition, host, registry, network.endpoint( host ) ) );
+
+    clear_results();
+    g_fail_at = 3;
+    for( std::unique_ptr<DistributedGraph>& host : hosts )
+        host->run();
+    for( std::unique_ptr<DistributedGraph>& host : hosts )
+        CHECK( host->wait_for_done( std::chrono::seconds( 30 ) ) );
+    g_fail_at = -1;
+
+    for( Graph::NodeId i = 0; i < ChainLength; ++i )
+    {
+        const Work::State state = hosts[partition.host_of( i )]->get_state( i );
+        if ( i < 3 )
+            CHECK( state == Work::State::Completed );
+        else if ( i == 3 )
+            CHECK( state == Work::State::Failed );
+        else
+            CHECK( state == Work::State::Cancelled );
+        CHECK( g_results[i].load() == ( i < 3 ? static_cast<int>( i ) : -1 ) );
+    }
+}
+
+int main()
+{
+    chain_across_hosts();
+    failure_across_hosts();
+    return 0;
+}
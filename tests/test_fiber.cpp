@@ -0,0 +1,142 @@
+#include "tree_of_work_fiber.h"
+#include "check.h"
+
+#include <atomic>
+#include <memory>
+#include <thread>
+#include <vector>
+
+/**************************
+ * FiberExecutor: suspended fibers resume on their own thread
+ *************************/
+#ifdef TREE_OF_WORK_HAS_FIBERS
+using TreeOfWork::Work;
+using TreeOfWork::FiberExecutor;
+namespace this_fiber = TreeOfWork::this_fiber;
+
+static thread_local int t_marker = 0;
+
+// each worker suspends several times and checks it is still on its thread
+static void resume_on_own_thread()
+{
+    std::shared_ptr<TreeOfWork::Executor> executor = std::make_shared<FiberExecutor>( 4 );
+    std::atomic<int> moved( 0 );
+    std::atomic<int> finished( 0 );
+
+    std::vector<std::shared_ptr<Work>> nodes;
+    for( int i = 0; i < 64; ++i )
+    {
+        nodes.push_back( Work::make_work( [&moved, &finished, i](const Work::Control& control)
+        {
+            const std::thread::id thread = std::this_thread::get_id();
+            t_marker = i;
+            for( int k = 0; k < 20; ++k )
+            {
+                if ( k % 2 == 0 )
+                    this_fiber::sleep_for( std::chrono::microseconds( 100 * ( i % 5 ) ) );
+                else
+                    this_fiber::yield();
+
+                if ( std::this_thread::get_id() != thread )
+                    moved++;
+                // another fiber of the thread may have run meanwhile
+                t_marker = i;
+            }
+            finished++;
+            control.set_completed();
+        }, executor ) );
+    }
+    for( std::shared_ptr<Work>& node : nodes )
+        node->trigger();
+    for( std::shared_ptr<Work>& node : nodes )
+        node->wait_for_done();
+
+    CHECK( finished.load() == 64 );
+    CHECK( moved.load() == 0 );
+    CHECK( static_cast<FiberExecutor&>( *executor ).fiber_count() <= 64 );
+}
+
+// a fiber waits for a node which runs on the same executor
+static void wait_for_node()
+{
+    std::shared_ptr<TreeOfWork::Executor> executor = std::make_shared<FiberExecutor>( 2 );
+    std::shared_ptr<Work> slow = Work::make_work( [](const Work::Control& control)
+    {
+        this_fiber::sleep_for( std::chrono::milliseconds( 5 ) );
+        control.set_completed();
+    }, executor );
+
+    Work::State seen = Work::State::Created;
+    std::shared_ptr<Work> waiter = Work::make_work( [&slow, &seen](const Work::Control& control)
+    {
+        const std::thread::id thread = std::this_thread::get_id();
+        seen = this_fiber::wait( *slow );
+        CHECK( std::this_thread::get_id() == thread );
+        control.set_completed();
+    }, executor );
+
+    waiter->trigger();
+    slow->trigger();
+    waiter->wait_for_done();
+    CHECK( seen == Work::State::Completed );
+}
+
+static std::atomic<bool> g_dropped( false );
+static std::atomic<int>  g_slept( 0 );
+
+// a child started by its parent owns itself and holds the last
+// reference to the executor once the test dropped its own: the
+// executor is destroyed on that fiber, which runs the fibers still
+// suspended to their end
+static void drop_executor_on_fiber()
+{
+    for( int run = 0; run < 50; ++run )
+    {
+        g_dropped = false;
+        std::shared_ptr<TreeOfWork::Executor> executor = std::make_shared<FiberExecutor>( 2 );
+        for( int i = 0; i < 4; ++i )
+        {
+            executor->submit( []
+                              {
+                                  while( !g_dropped.load() )
+                                      this_fiber::sleep_for( std::chrono::milliseconds( 1 ) );
+                                  this_fiber::sleep_for( std::chrono::milliseconds( 5 ) );
+                                  g_slept++;
+                              } );
+        }
+
+        std::shared_ptr<Work> root = Work::make_work( [](const Work::Control& control)
+        {
+            control.set_completed();
+        }, executor );
+        std::shared_ptr<Work> child = Work::make_work( [](const Work::Control& control)
+        {
+            while( !g_dropped.load() )
+                this_fiber::yield();
+            control.set_completed();
+        }, executor );
+        Work::execute_if_all_finished( { root }, { child } );
+
+        root->trigger();
+        root->wait_for_done();
+        child.reset();
+        root.reset();
+        executor.reset();
+        g_dropped = true;
+        CHECK( eventually( [run]{ return g_slept.load() == 4 * ( run + 1 ); } ) );
+    }
+}
+
+int main()
+{
+    resume_on_own_thread();
+    wait_for_node();
+    drop_executor_on_fiber();
+    return 0;
+}
+#else
+int main()
+{
+    return 0;
+}
+#endif
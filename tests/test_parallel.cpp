@@ -0,0 +1,131 @@
+#include "tree_of_work_parallel.h"
+#include "check.h"
+
+#include <atomic>
+#include <memory>
+#include <stdexcept>
+#include <vector>
+
+/**************************
+ * parallel_for / make_parallel_for_work
+ *************************/
+using TreeOfWork::Work;
+using TreeOfWork::Executor;
+
+// every index is run exactly once, the node completes
+static void each_index( const std::shared_ptr<Executor>& executor )
+{
+    const int count = 10000;
+    std::vector<std::atomic<int>> hits( count );
+    for( std::atomic<int>& hit : hits )
+        hit = 0;
+
+    std::shared_ptr<Work> node = TreeOfWork::make_parallel_for_work( 0, count, [&hits](int i){ hits[i]++; }, executor );
+    node->trigger();
+    node->wait_for_done();
+
+    CHECK( node->get_state() == Work::State::Completed );
+    for( std::atomic<int>& hit : hits )
+        CHECK( hit.load() == 1 );
+}
+
+// a range body gets chunks which cover the range without overlap
+static void range_body( const std::shared_ptr<Executor>& executor )
+{
+    const size_t count = 100000;
+    const size_t grain = 64;
+    std::vector<std::atomic<int>> hits( count );
+    for( std::atomic<int>& hit : hits )
+        hit = 0;
+    std::atomic<size_t> chunks( 0 );
+
+    std::shared_ptr<Work> node = TreeOfWork::make_parallel_for_work( size_t( 0 ), count,
+                                                                     [&hits, &chunks](size_t first, size_t last)
+                                                                     {
+                                                                         CHECK( first < last );
+                                                                         for( size_t i = first; i < last; ++i )
+                                                                             hits[i]++;
+                                                                         chunks++;
+                                                                     }, executor, grain );
+    node->trigger();
+    node->wait_for_done();
+
+    CHECK( node->get_state() == Work::State::Completed );
+    for( std::atomic<int>& hit : hits )
+        CHECK( hit.load() == 1 );
+    CHECK( chunks.load() >= 1 );
+    CHECK( chunks.load() <= count / grain * 2 );
+}
+
+// an empty (or reversed) range does not call the body and completes
+static void empty_range( const std::shared_ptr<Executor>& executor )
+{
+    std::atomic<int> calls( 0 );
+    std::shared_ptr<Work> empty = TreeOfWork::make_parallel_for_work( 5, 5, [&calls](int){ calls++; }, executor );
+    std::shared_ptr<Work> reversed = TreeOfWork::make_parallel_for_work( 5, 3, [&calls](int){ calls++; }, executor );
+    for( const std::shared_ptr<Work>& node : { empty, reversed } )
+    {
+        node->trigger();
+        node->wait_for_done();
+        CHECK( node->get_state() == Work::State::Completed );
+    }
+    CHECK( calls.load() == 0 );
+}
+
+// a throwing chunk fails the node and cancels its children
+static void failure( const std::shared_ptr<Executor>& executor )
+{
+    std::shared_ptr<Work> node = TreeOfWork::make_parallel_for_work( 0, 1000, [](int i)
+                                                                     {
+                                                                         if ( i == 700 )
+                                                                             throw std::runtime_error( "bad index" );
+                                                                     }, executor );
+    std::shared_ptr<Work> child = Work::make_work( [](const Work::Control& c){ c.set_completed(); }, executor );
+    Work::execute_if_all_finished( { node }, { child } );
+
+    node->trigger();
+    node->wait_for_done();
+    child->wait_for_done();
+    CHECK( node->get_state() == Work::State::Failed );
+    CHECK( child->get_state() == Work::State::Cancelled );
+}
+
+// an AND child starts only after the last index was run
+static void child_after_loop( const std::shared_ptr<Executor>& executor )
+{
+    const int count = 5000;
+    for( int run = 0; run < 20; ++run )
+    {
+        std::atomic<int> ran( 0 );
+        int seen = -1;
+
+        std::shared_ptr<Work> node = TreeOfWork::make_parallel_for_work( 0, count, [&ran](int){ ran++; }, executor );
+        std::shared_ptr<Work> child = Work::make_work( [&ran, &seen](const Work::Control& c)
+                                                       {
+                                                           seen = ran.load();
+                                                           c.set_completed();
+                                                       }, executor );
+        Work::execute_if_all_finished( { node }, { child } );
+
+        node->trigger();
+        child->wait_for_done();
+        node->wait_for_done();
+        CHECK( child->get_state() == Work::State::Completed );
+        CHECK( seen == count );
+    }
+}
+
+int main()
+{
+    std::shared_ptr<Executor> pool = std::make_shared<TreeOfWork::ThreadPoolExecutor>( 4 );
+    std::shared_ptr<Executor> stealing = std::make_shared<TreeOfWork::WorkStealingExecutor>( 4 );
+    for( const std::shared_ptr<Executor>& executor : { pool, stealing } )
+    {
+        each_index( executor );
+        range_body( executor );
+        empty_range( executor );
+        failure( executor );
+        child_after_loop( executor );
+    }
+    return 0;
+}
@@ -0,0 +1,37 @@
+#define TREE_OF_WORK_PROFILING
+#include "tree_of_work.h"
+#include "check.h"
+
+#include <sstream>
+#include <string>
+
+/**************************
+ * Profiler trace export
+ *************************/
+using TreeOfWork::Work;
+using TreeOfWork::Profiler;
+
+// names are written as valid JSON strings
+static void escaped_names()
+{
+    Profiler profiler;
+    Profiler::activate( &profiler );
+
+    std::shared_ptr<Work> node = Work::make_work( [](const Work::Control& c){ c.set_completed(); } );
+    profiler.set_name( node.get(), 0, "say \"hi\" \\ now\n" );
+    node->trigger();
+    node->wait_for_done();
+    Profiler::activate( nullptr );
+
+    std::ostringstream os;
+    profiler.write_chrome_trace( os );
+    const std::string trace = os.str();
+    CHECK( trace.find( "\"name\":\"say \\\"hi\\\" \\\\ now\\u000a\"" ) != std::string::npos );
+    CHECK( profiler.summarize().critical_path.size() == 1 );
+}
+
+int main()
+{
+    escaped_names();
+    return 0;
+}
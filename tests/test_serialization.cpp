@@ -0,0 +1,83 @@
+#include "tree_of_work_serialization.h"
+#include "check.h"
+
+#include <atomic>
+#include <sstream>
+#include <string>
+
+/**************************
+ * GraphFile save / load round trip
+ *************************/
+using TreeOfWork::Work;
+using TreeOfWork::GraphBuilder;
+using TreeOfWork::GraphFile;
+
+static std::atomic<int> g_count( 0 );
+
+static void count( const Work::Control& control )
+{
+    g_count++;
+    control.set_completed();
+}
+
+static GraphBuilder::NodeId add_named( GraphBuilder& builder, const char* name )
+{
+    const GraphBuilder::NodeId node = builder.add( &count );
+    builder.set_name( node, name );
+    return node;
+}
+
+// a named diamond survives the round trip and runs
+static void round_trip()
+{
+    GraphBuilder builder;
+    const GraphBuilder::NodeId a = add_named( builder, "count" );
+    const GraphBuilder::NodeId b = add_named( builder, "count" );
+    const GraphBuilder::NodeId c = add_named( builder, "count" );
+    const GraphBuilder::NodeId d = add_named( builder, "count" );
+    builder.execute_if_all_finished( { a }, { b, c } );
+    builder.execute_if_all_finished( { b, c }, { d } );
+
+    std::ostringstream os;
+    GraphFile::save( *builder.compile(), os );
+    const std::string image = os.str();
+
+    TreeOfWork::WorkerRegistry registry;
+    registry.add( "count", &count );
+    std::shared_ptr<TreeOfWork::Graph> graph = GraphFile::load( image.data(), image.size(), registry );
+
+    g_count = 0;
+    graph->run();
+    graph->wait_for_done();
+    CHECK( g_count.load() == 4 );
+    CHECK( std::string( graph->name( d ) ) == "count" );
+}
+
+// an unnamed node could not be bound on load, so save rejects it
+static void unnamed_node()
+{
+    GraphBuilder builder;
+    const GraphBuilder::NodeId a = add_named( builder, "count" );
+    const GraphBuilder::NodeId b = builder.add( &count );
+    builder.execute_if_all_finished( { a }, { b } );
+
+    std::ostringstream os;
+    bool rejected = false;
+    try
+    {
+        GraphFile::save( *builder.compile(), os );
+    }
+    catch( const TreeOfWork::GraphFormatError& )
+    {
+        rejected = true;
+    }
+    CHECK( rejected );
+    CHECK( os.str().empty() );
+}
+
+int main()
+{
+    round_trip();
+    unnamed_node();
+    return 0;
+}
@@ -0,0 +1,148 @@
+#include "tree_of_work.h"
+#include "check.h"
+
+#include <atomic>
+#include <memory>
+
+/**************************
+ * Control::spawn / Control::join
+ *
+ * spawned work is owned by the library only, the tests
+ * drop every reference to it before it runs
+ *************************/
+using TreeOfWork::Work;
+
+static void completed( const Work::Control& control )
+{
+    control.set_completed();
+}
+
+// a worker spawns the root of a subtree which has children
+static void spawn_subtree_with_children()
+{
+    for( int run = 0; run < 200; ++run )
+    {
+        std::atomic<int> finished( 0 );
+
+        std::shared_ptr<Work> parent = Work::make_work( [&finished](const Work::Control& c)
+        {
+            std::shared_ptr<Work> sub = Work::make_work( &completed );
+            std::shared_ptr<Work> child = Work::make_work( [&finished](const Work::Control& cc)
+                                                           {
+                                                               finished++;
+                                                               cc.set_completed();
+                                                           } );
+            std::shared_ptr<Work> grandchild = Work::make_work( [&finished](const Work::Control& cc)
+                                                                {
+                                                                    finished++;
+                                                                    cc.set_completed();
+                                                                } );
+            Work::execute_if_all_finished( { sub }, { child } );
+            Work::execute_if_all_finished( { child }, { grandchild } );
+            c.spawn( sub );
+            c.set_completed();
+        } );
+
+        parent->trigger();
+        parent->wait_for_done();
+        CHECK( parent->get_state() == Work::State::Completed );
+        CHECK( eventually( [&finished]{ return finished.load() == 2; } ) );
+    }
+}
+
+// spawned functions, the parent is done only after all of them
+static void spawn_functions()
+{
+    std::atomic<int> count( 0 );
+    std::shared_ptr<Work> parent = Work::make_work( [&count](const Work::Control& c)
+    {
+        for( int i = 0; i < 100; ++i )
+            c.spawn( [&count](const Work::Control& cc)
+                     {
+                         count++;
+                         cc.set_completed();
+                     } );
+        c.set_completed();
+    } );
+
+    parent->trigger();
+    parent->wait_for_done();
+    CHECK( parent->get_state() == Work::State::Completed );
+    CHECK( count.load() == 100 );
+}
+
+// a failed spawn fails the parent, its children are cancelled
+static void spawn_failure()
+{
+    std::shared_ptr<Work> parent = Work::make_work( [](const Work::Control& c)
+    {
+        c.spawn( [](const Work::Control& cc){ cc.set_failed(); } );
+        c.set_completed();
+    } );
+    std::shared_ptr<Work> child = Work::make_work( &completed );
+    Work::execute_if_all_finished( { parent }, { child } );
+
+    parent->trigger();
+    parent->wait_for_done();
+    child->wait_for_done();
+    CHECK( parent->get_state() == Work::State::Failed );
+    CHECK( child->get_state() == Work::State::Cancelled );
+}
+
+// join waits for the last node of a subtree the worker triggers itself
+static void join_subtree()
+{
+    std::atomic<bool> leaf_done( false );
+    std::shared_ptr<Work> parent = Work::make_work( [&leaf_done](const Work::Control& c)
+    {
+        std::shared_ptr<Work> root = Work::make_work( &completed );
+        std::shared_ptr<Work> leaf = Work::make_work( [&leaf_done](const Work::Control& cc)
+                                                      {
+                                                          leaf_done = true;
+                                                          cc.set_completed();
+                                                      } );
+        Work::execute_if_all_finished( { root }, { leaf } );
+        c.join( leaf );
+        c.spawn( root );
+        c.set_completed();
+    } );
+
+    parent->trigger();
+    parent->wait_for_done();
+    CHECK( parent->get_state() == Work::State::Completed );
+    CHECK( leaf_done.load() );
+}
+
+// a child started by its parent owns itself (and so its executor)
+// until done() returned: the last reference to the executor may
+// be dropped on one of its own threads
+template<typename E>
+static void drop_executor_after_wait()
+{
+    for( int run = 0; run < 2000; ++run )
+    {
+        std::shared_ptr<TreeOfWork::Executor> executor = std::make_shared<E>( 2 );
+        std::shared_ptr<Work> root = Work::make_work( &completed, executor );
+        std::shared_ptr<Work> child = Work::make_work( &completed, executor );
+        Work::execute_if_all_finished( { root }, { child } );
+
+        root->trigger();
+        child->wait_for_done();
+        CHECK( child->get_state() == Work::State::Completed );
+        child.reset();
+        root.reset();
+        executor.reset();
+    }
+}
+
+int main()
+{
+    spawn_subtree_with_children();
+    spawn_functions();
+    spawn_failure();
+    join_subtree();
+    drop_executor_after_wait<TreeOfWork::ThreadPoolExecutor>();
+    drop_executor_after_wait<TreeOfWork::WorkStealingExecutor>();
+    drop_executor_after_wait<TreeOfWork::PriorityExecutor>();
+    return 0;
+}
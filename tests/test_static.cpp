@@ -0,0 +1,147 @@
+#include "tree_of_work_static.h"
+#include "check.h"
+
+#include <atomic>
+#include <memory>
+#include <thread>
+
+/**************************
+ * StaticGraph / make_static_graph
+ *************************/
+using TreeOfWork::Work;
+using TreeOfWork::Executor;
+using TreeOfWork::StaticTopology;
+using TreeOfWork::Root;
+using TreeOfWork::AllOf;
+using TreeOfWork::AnyOf;
+
+// the checks behind the static_asserts of StaticGraph
+static_assert( TreeOfWork::detail::ParentsListedFirst<0, Root, AllOf<0>, AllOf<0>, AllOf<1, 2>>::value, "" );
+static_assert( !TreeOfWork::detail::ParentsListedFirst<0, Root, AllOf<2>, Root>::value, "" );
+static_assert( !TreeOfWork::detail::ParentsListedFirst<0, Root, AnyOf<1>>::value, "" );
+static_assert( TreeOfWork::detail::ParentsUnique<Root, AllOf<0>, AnyOf<0, 1>>::value, "" );
+static_assert( !TreeOfWork::detail::ParentsUnique<Root, AllOf<0, 0>>::value, "" );
+static_assert( !TreeOfWork::detail::ParentsUnique<Root, Root, AnyOf<0, 1, 0>>::value, "" );
+
+using Diamond = StaticTopology<Root, AllOf<0>, AllOf<0>, AllOf<1, 2>>;
+
+// the README diamond, run twice: the last node sees both branches
+static void diamond( const std::shared_ptr<Executor>& executor )
+{
+    std::atomic<int> branches( 0 );
+    int seen = -1;
+
+    auto completed = [](const Work::Control& c){ c.set_completed(); };
+    auto branch = [&branches](const Work::Control& c)
+                  {
+                      branches++;
+                      c.set_completed();
+                  };
+    auto join = [&branches, &seen](const Work::Control& c)
+                {
+                    seen = branches.load();
+                    c.set_completed();
+                };
+    auto graph = TreeOfWork::make_static_graph<Diamond>( completed, branch, branch, join );
+    CHECK( graph.size() == 4 );
+
+    for( int run = 1; run <= 2; ++run )
+    {
+        graph.run( executor );
+        graph.wait_for_done();
+        CHECK( graph.try_is_done() );
+        CHECK( seen == 2 * run );
+        for( std::size_t i = 0; i < graph.size(); ++i )
+            CHECK( graph.get_state( i ) == Work::State::Completed );
+    }
+}
+
+// an AnyOf node runs if one parent completed, it is cancelled
+// only if all of them failed
+static void any_of( const std::shared_ptr<Executor>& executor )
+{
+    using Topology = StaticTopology<Root, Root, AnyOf<0, 1>, Root, AnyOf<0, 3>>;
+
+    auto failed = [](const Work::Control& c){ c.set_failed(); };
+    auto completed = [](const Work::Control& c){ c.set_completed(); };
+    auto graph = TreeOfWork::make_static_graph<Topology>( failed, completed, completed, failed, completed );
+
+    graph.run( executor );
+    graph.wait_for_done();
+    CHECK( graph.get_state( 0 ) == Work::State::Failed );
+    CHECK( graph.get_state( 1 ) == Work::State::Completed );
+    CHECK( graph.get_state( 2 ) == Work::State::Completed );
+    CHECK( graph.get_state( 3 ) == Work::State::Failed );
+    CHECK( graph.get_state( 4 ) == Work::State::Cancelled );
+}
+
+// a failed node cancels its descendants, other branches go on
+static void failure( const std::shared_ptr<Executor>& executor )
+{
+    using Topology = StaticTopology<Root, AllOf<0>, AllOf<0>, AllOf<1>, AllOf<2>, AllOf<3, 4>>;
+
+    std::atomic<int> ran( 0 );
+    auto completed = [&ran](const Work::Control& c)
+                     {
+                         ran++;
+                         c.set_completed();
+                     };
+    auto failed = [](const Work::Control& c){ c.set_failed(); };
+    auto graph = TreeOfWork::make_static_graph<Topology>( completed, failed, completed, completed, completed, completed );
+
+    graph.run( executor );
+    graph.wait_for_done();
+    CHECK( graph.get_state( 0 ) == Work::State::Completed );
+    CHECK( graph.get_state( 1 ) == Work::State::Failed );
+    CHECK( graph.get_state( 2 ) == Work::State::Completed );
+    CHECK( graph.get_state( 3 ) == Work::State::Cancelled );
+    CHECK( graph.get_state( 4 ) == Work::State::Completed );
+    CHECK( graph.get_state( 5 ) == Work::State::Cancelled );
+    CHECK( ran.load() == 3 );
+}
+
+// cancel() during a run cancels the nodes which did not start,
+// the next run starts over
+static void cancel( const std::shared_ptr<Executor>& executor )
+{
+    std::atomic<bool> started( false );
+    std::atomic<bool> go( false );
+    auto wait = [&started, &go](const Work::Control& c)
+                {
+                    started = true;
+                    while( !go.load() )
+                        std::this_thread::yield();
+                    c.set_completed();
+                };
+    auto completed = [](const Work::Control& c){ c.set_completed(); };
+    auto graph = TreeOfWork::make_static_graph<Diamond>( wait, completed, completed, completed );
+
+    graph.run( executor );
+    CHECK( eventually( [&started]{ return started.load(); } ) );
+    graph.cancel();
+    go = true;
+    graph.wait_for_done();
+    CHECK( graph.get_state( 0 ) == Work::State::Completed );
+    for( std::size_t i = 1; i < graph.size(); ++i )
+        CHECK( graph.get_state( i ) == Work::State::Cancelled );
+
+    graph.run( executor );
+    graph.wait_for_done();
+    for( std::size_t i = 0; i < graph.size(); ++i )
+        CHECK( graph.get_state( i ) == Work::State::Completed );
+}
+
+int main()
+{
+    std::shared_ptr<Executor> pool = std::make_shared<TreeOfWork::ThreadPoolExecutor>( 2 );
+    std::shared_ptr<Executor> stealing = std::make_shared<TreeOfWork::WorkStealingExecutor>( 2 );
+    stealing->set_continuation_depth( 4 );
+    for( const std::shared_ptr<Executor>& executor : { pool, stealing } )
+    {
+        diamond( executor );
+        any_of( executor );
+        failure( executor );
+        cancel( executor );
+    }
+    return 0;
+}
@@ -0,0 +1,342 @@
+#include "tree_of_work_stream.h"
+#include "check.h"
+
+#include <algorithm>
+#include <atomic>
+#include <memory>
+#include <stdexcept>
+#include <string>
+#include <thread>
+#include <vector>
+
+/**************************
+ * StreamWork pipelines
+ *************************/
+using TreeOfWork::Work;
+using TreeOfWork::Executor;
+using TreeOfWork::StreamWork;
+
+// a serial pipeline keeps the order of the items, also after a reset
+static void ordered( const std::shared_ptr<Executor>& executor )
+{
+    const int count = 20000;
+    long expected = 0;
+    bool in_order = true;
+
+    auto parse = std::make_shared<StreamWork<long(int)>>( [](int x){ return long( x ) * 2; }, executor );
+    auto format = std::make_shared<StreamWork<std::string(long)>>( [](long x){ return std::to_string( x ); }, executor );
+    auto store = std::make_shared<StreamWork<void(const std::string&)>>( [&expected, &in_order](const std::string& s)
+                                                                         {
+                                                                             if ( std::stol( s ) != expected )
+                                                                                 in_order = false;
+                                                                             expected += 2;
+                                                                         }, executor );
+    parse->connect( format );
+    format->connect( store );
+    parse->set_capacity( 8 );
+    format->set_capacity( 3 );
+    parse->set_batch( 64 );
+    store->set_batch( 2 );
+
+    for( int run = 0; run < 2; ++run )
+    {
+        expected = 0;
+        for( int i = 0; i < count; ++i )
+            CHECK( parse->push( i ) );
+        parse->close();
+
+        CHECK( store->wait_for_done( std::chrono::seconds( 30 ) ) );
+        CHECK( in_order );
+        CHECK( expected == 2L * count );
+        CHECK( parse->get_state() == Work::State::Completed );
+        CHECK( format->get_state() == Work::State::Completed );
+        CHECK( store->get_state() == Work::State::Completed );
+        CHECK( !parse->push( 0 ) );
+
+        parse->reset( true );
+    }
+}
+
+/**************************
+ * items alive between the producer and the consumer
+ *************************/
+static std::atomic<int> g_alive( 0 );
+static std::atomic<int> g_most_alive( 0 );
+
+struct Tracked
+{
+    explicit Tracked( int v )
+        : value( new int( v ) )
+    {
+        const int alive = ++g_alive;
+        int most = g_most_alive.load();
+        while( alive > most && !g_most_alive.compare_exchange_weak( most, alive ) )
+        {}
+    }
+
+    Tracked( Tracked&& other ) = default;
+
+    ~Tracked()
+    {
+        if ( value != nullptr )
+            --g_alive;
+    }
+
+    std::unique_ptr<int> value;
+};
+
+// a slow consumer with capacity 1 makes push() wait, memory stays bounded
+static void bounded( const std::shared_ptr<Executor>& executor )
+{
+    g_alive = 0;
+    g_most_alive = 0;
+    std::atomic<long> sum( 0 );
+
+    auto produce = std::make_shared<StreamWork<Tracked(int)>>( [](int x){ return Tracked( x ); }, executor );
+    auto consume = std::make_shared<StreamWork<void(Tracked)>>( [&sum](Tracked t)
+                                                                {
+                                                                    std::this_thread::sleep_for( std::chrono::microseconds( 20 ) );
+                                                                    sum += *t.value;
+                                                                }, executor );
+    produce->connect( consume );
+    produce->set_capacity( 1 );
+    consume->set_capacity( 1 );
+    produce->set_batch( 1 );
+    consume->set_batch( 1 );
+
+    size_t most_queued = 0;
+    for( int i = 0; i < 2000; ++i )
+    {
+        CHECK( produce->push( i ) );
+        most_queued = std::max( most_queued, produce->size() + consume->size() );
+    }
+    produce->close();
+    CHECK( consume->wait_for_done( std::chrono::seconds( 30 ) ) );
+
+    CHECK( sum.load() == 1999L * 1000 );
+    CHECK( most_queued <= 2 );
+    // one result waiting in the queue of the consumer, one in each activation
+    CHECK( g_most_alive.load() <= 3 );
+    CHECK( g_alive.load() == 0 );
+}
+
+// push() waits for room over and over: a release() of the consumer
+// has to wake a pushing thread also if the other pusher took the
+// room it was woken for
+static void fast_consumer( const std::shared_ptr<Executor>& executor )
+{
+    const int per_pusher = 10000;
+    std::atomic<long> sum( 0 );
+    auto source = std::make_shared<StreamWork<int(int)>>( [](int x){ return x; }, executor );
+    auto sink = std::make_shared<StreamWork<void(int)>>( [&sum](int x){ sum += x; }, executor );
+    source->connect( sink );
+    source->set_capacity( 1 );
+    sink->set_capacity( 1 );
+    source->set_batch( 1 );
+
+    std::vector<std::thread> pushers;
+    for( int p = 0; p < 2; ++p )
+    {
+        pushers.emplace_back( [&source]
+                              {
+                                  for( int i = 0; i < per_pusher; ++i )
+                                      CHECK( source->push( i ) );
+                              } );
+    }
+    for( std::thread& pusher : pushers )
+        pusher.join();
+    source->close();
+
+    CHECK( sink->wait_for_done( std::chrono::seconds( 30 ) ) );
+    CHECK( sum.load() == 2L * ( per_pusher - 1 ) * per_pusher / 2 );
+}
+
+// fan-out copies, fan-in merges, parallel stages
+static void fan_out_in( const std::shared_ptr<Executor>& executor )
+{
+    const int per_feeder = 5000;
+    std::atomic<long> sum( 0 );
+    std::atomic<long> count( 0 );
+
+    auto source = std::make_shared<StreamWork<int(int)>>( [](int x){ return x; }, executor );
+    auto plus = std::make_shared<StreamWork<int(int)>>( [](int x){ return x + 1; }, executor );
+    auto minus = std::make_shared<StreamWork<int(int)>>( [](int x){ return -x; }, executor );
+    auto sink = std::make_shared<StreamWork<void(int)>>( [&sum, &count](int x)
+                                                         {
+                                                             sum += x;
+                                                             count++;
+                                                         }, executor );
+    source->connect( plus );
+    source->connect( minus );
+    plus->connect( sink );
+    minus->connect( sink );
+    plus->set_concurrency( 4 );
+    sink->set_concurrency( 3 );
+    source->set_capacity( 5 );
+    sink->set_capacity( 16 );
+
+    std::vector<std::thread> feeders;
+    for( int f = 0; f < 3; ++f )
+    {
+        feeders.emplace_back( [&source]
+                              {
+                                  for( int i = 0; i < per_feeder; ++i )
+                                  {
+                                      while( !source->try_push( i ) )
+                                          std::this_thread::yield();
+                                  }
+                              } );
+    }
+    for( std::thread& feeder : feeders )
+        feeder.join();
+    source->close();
+
+    CHECK( sink->wait_for_done( std::chrono::seconds( 30 ) ) );
+    CHECK( count.load() == 2L * 3 * per_feeder );
+    CHECK( sum.load() == 3L * per_feeder );
+}
+
+// a throwing stage fails, drains its input and cancels its descendants
+static void failure( const std::shared_ptr<Executor>& executor )
+{
+    std::atomic<int> stored( 0 );
+    auto source = std::make_shared<StreamWork<int(int)>>( [](int x){ return x; }, executor );
+    auto check = std::make_shared<StreamWork<int(int)>>( [](int x)
+                                                         {
+                                                             if ( x == 500 )
+                                                                 throw std::runtime_error( "bad item" );
+                                                             return x;
+                                                         }, executor );
+    auto store = std::make_shared<StreamWork<void(int)>>( [&stored](int){ stored++; }, executor );
+    source->connect( check );
+    check->connect( store );
+    source->set_capacity( 4 );
+    check->set_capacity( 4 );
+
+    // the source does not block on the failed stage
+    for( int i = 0; i < 5000; ++i )
+        CHECK( source->push( i ) );
+    source->close();
+
+    CHECK( store->wait_for_done( std::chrono::seconds( 30 ) ) );
+    CHECK( check->wait_for_done( std::chrono::seconds( 30 ) ) );
+    CHECK( source->wait_for_done( std::chrono::seconds( 30 ) ) );
+    CHECK( source->get_state() == Work::State::Completed );
+    CHECK( check->get_state() == Work::State::Failed );
+    CHECK( store->get_state() == Work::State::Cancelled );
+    CHECK( stored.load() <= 500 );
+}
+
+// cancel wakes a waiting push and cancels the whole pipeline
+static void cancel( const std::shared_ptr<Executor>& executor )
+{
+    auto slow = std::make_shared<StreamWork<int(int)>>( [](int x)
+                                                        {
+                                                            std::this_thread::sleep_for( std::chrono::microseconds( 50 ) );
+                                                            return x;
+                                                        }, executor );
+    auto sink = std::make_shared<StreamWork<void(int)>>( [](int){}, executor );
+    slow->connect( sink );
+    slow->set_capacity( 2 );
+    sink->set_capacity( 2 );
+
+    std::atomic<bool> rejected( false );
+    std::thread pusher( [&slow, &rejected]
+                        {
+                            for( int i = 0; i < 1000000; ++i )
+                            {
+                                if ( !slow->push( i ) )
+                                {
+                                    rejected = true;
+                                    return;
+                                }
+                            }
+                        } );
+    std::this_thread::sleep_for( std::chrono::milliseconds( 5 ) );
+    slow->cancel();
+    pusher.join();
+
+    CHECK( rejected.load() );
+    CHECK( sink->wait_for_done( std::chrono::seconds( 30 ) ) );
+    CHECK( slow->get_state() == Work::State::Cancelled );
+    CHECK( sink->get_state() == Work::State::Cancelled );
+
+    int called = 0;
+    sink->on_done( [&called](Work::State state)
+                   {
+                       CHECK( state == Work::State::Cancelled );
+                       ++called;
+                   } );
+    CHECK( called == 1 );
+}
+
+// results which can not be copied feed exactly one child
+static void move_only( const std::shared_ptr<Executor>& executor )
+{
+    long total = 0;
+    auto make = std::make_shared<StreamWork<std::unique_ptr<int>(int)>>( [](int x){ return std::unique_ptr<int>( new int( x ) ); },
+                                                                          executor );
+    auto add = std::make_shared<StreamWork<void(std::unique_ptr<int>)>>( [&total](std::unique_ptr<int> p){ total += *p; },
+                                                                          executor );
+    make->connect( add );
+    for( int i = 0; i < 1000; ++i )
+        CHECK( make->push( i ) );
+    make->close();
+    CHECK( add->wait_for_done( std::chrono::seconds( 30 ) ) );
+    CHECK( total == 999L * 500 );
+
+    bool rejected = false;
+    try
+    {
+        make->connect( add );
+    }
+    catch( const std::invalid_argument& )
+    {
+        rejected = true;
+    }
+    CHECK( rejected );
+}
+
+// the last activation may destroy the stages and the executor
+// once the test dropped its references right after the stream is done
+template<typename E>
+static void drop_after_done()
+{
+    for( int run = 0; run < 1000; ++run )
+    {
+        std::shared_ptr<Executor> executor = std::make_shared<E>( 2 );
+        auto source = std::make_shared<StreamWork<int(int)>>( [](int x){ return x; }, executor );
+        auto sink = std::make_shared<StreamWork<void(int)>>( [](int){}, executor );
+        source->connect( sink );
+        for( int i = 0; i < 10; ++i )
+            CHECK( source->push( i ) );
+        source->close();
+
+        CHECK( sink->wait_for_done( std::chrono::seconds( 30 ) ) );
+        sink.reset();
+        source.reset();
+        executor.reset();
+    }
+}
+
+int main()
+{
+    for( size_t threads : { 1, 2, 4 } )
+    {
+        std::shared_ptr<Executor> pool = std::make_shared<TreeOfWork::ThreadPoolExecutor>( threads );
+        std::shared_ptr<Executor> stealing = std::make_shared<TreeOfWork::WorkStealingExecutor>( threads );
+        for( const std::shared_ptr<Executor>& executor : { pool, stealing } )
+        {
+            ordered( executor );
+            bounded( executor );
+            fast_consumer( executor );
+            fan_out_in( executor );
+            failure( executor );
+            cancel( executor );
+            move_only( executor );
+        }
+    }
+    drop_after_done<TreeOfWork::ThreadPoolExecutor>();
+    drop_after_done<TreeOfWork::WorkStealingExecutor>();
+    return 0;
+}
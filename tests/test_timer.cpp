@@ -0,0 +1,107 @@
+#include "tree_of_work_timer.h"
+#include "check.h"
+
+#include <atomic>
+#include <chrono>
+#include <mutex>
+#include <vector>
+
+/**************************
+ * detail::TimerService, the shared timer wheel
+ *************************/
+using TreeOfWork::detail::TimerService;
+using Clock = TimerService::Clock;
+
+struct Fired
+{
+    int               id;
+    Clock::time_point at;
+    Clock::time_point fired;
+};
+
+// timers fire at or after their time point, earlier ticks first
+static void fire_in_order()
+{
+    TimerService timers;
+    std::mutex mutex;
+    std::vector<Fired> fired;
+
+    const Clock::time_point start = Clock::now();
+    const int count = 100;
+    for( int i = 0; i < count; ++i )
+    {
+        // scattered over 40 ms, scheduled out of order
+        const Clock::time_point at = start + std::chrono::microseconds( ( i * 7919 ) % 40000 );
+        timers.schedule( at, [&mutex, &fired, i, at]
+                             {
+                                 std::lock_guard<std::mutex> lock( mutex );
+                                 fired.push_back( { i, at, Clock::now() } );
+                             } );
+    }
+    CHECK( eventually( [&mutex, &fired]
+                       {
+                           std::lock_guard<std::mutex> lock( mutex );
+                           return fired.size() == count;
+                       } ) );
+
+    std::lock_guard<std::mutex> lock( mutex );
+    for( size_t i = 0; i < fired.size(); ++i )
+    {
+        CHECK( fired[i].fired >= fired[i].at );
+        // timers more than a tick apart keep their order
+        for( size_t j = i + 1; j < fired.size(); ++j )
+            CHECK( fired[j].at + std::chrono::milliseconds( 2 ) > fired[i].at );
+    }
+}
+
+// a timer further away than one turn of the wheel waits for its turn
+static void beyond_one_turn()
+{
+    TimerService timers;
+    std::atomic<bool> early( false );
+    std::atomic<bool> late( false );
+
+    const Clock::time_point start = Clock::now();
+    timers.schedule( start + std::chrono::milliseconds( 5 ), [&early]{ early = true; } );
+    timers.schedule( start + std::chrono::milliseconds( 600 ), [&late, start]
+                     {
+                         late = Clock::now() >= start + std::chrono::milliseconds( 600 );
+                     } );
+
+    CHECK( eventually( [&early]{ return early.load(); } ) );
+    CHECK( !late.load() );
+    CHECK( eventually( [&late]{ return late.load(); } ) );
+}
+
+// a cancelled timer is not called, cancel reports whether it was pending
+static void cancel()
+{
+    TimerService timers;
+    std::atomic<int> calls( 0 );
+
+    const TimerService::Handle pending = timers.schedule( Clock::now() + std::chrono::seconds( 10 ),
+                                                          [&calls]{ calls++; } );
+    const TimerService::Handle soon = timers.schedule( Clock::now(), [&calls]{ calls++; } );
+
+    CHECK( timers.cancel( pending ) );
+    CHECK( !timers.cancel( pending ) );
+    CHECK( eventually( [&calls]{ return calls.load() == 1; } ) );
+    CHECK( !timers.cancel( soon ) );
+    CHECK( !timers.cancel( TimerService::NoTimer ) );
+
+    // the freed entry is reused with a new generation
+    const TimerService::Handle reused = timers.schedule( Clock::now() + std::chrono::seconds( 10 ),
+                                                         [&calls]{ calls++; } );
+    CHECK( reused != pending );
+    CHECK( !timers.cancel( pending ) );
+    CHECK( timers.cancel( reused ) );
+    CHECK( calls.load() == 1 );
+}
+
+int main()
+{
+    fire_in_order();
+    beyond_one_turn();
+    cancel();
+    return 0;
+}
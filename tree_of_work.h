@@ -28,8 +28,20 @@
 #include <thread>
 #include <future>
 #include <memory>
+#include <mutex>
 #include <vector>
 #include <chrono>
+#include <atomic>
+#include <cstdint>
+#include <type_traits>
+#include <unordered_set>
+
+#include "tree_of_work_function.h"
+#include "tree_of_work_arena.h"
+#include "tree_of_work_profiler.h"
+#include "tree_of_work_executor.h"
+#include "tree_of_work_resource.h"
+#include "tree_of_work_timer.h"
 
 namespace TreeOfWork
 {
@@ -41,25 +53,182 @@ namespace TreeOfWork
  * 
  * A child is triggered either if all parents are successfully done,
  * or if one of the parents is successfully done.
+ * If this can not happen anymore (an AND parent failed or all
+ * OR parents failed), the child and its descendants are cancelled.
  *
  * The Work class represents the structure for one node.
+ * Triggered nodes are handed to an Executor, by default
+ * a shared thread pool (@see Executor::default_executor).
  *
  *************************/
 class Work
 {
     using WorkerSet = std::vector<std::shared_ptr<Work>>;
 public:
+    /**************************
+     * Cancelled nodes were never started, either because
+     * cancel() was called or because their parents failed
+     *************************/
+    enum class State
+    {
+        Created,
+        Running,
+        Completed,
+        Failed,
+        Cancelled
+    };
+    /**************************
+     * per run counter of the work a node waits for before it
+     * is done: its own worker (1) plus all work it spawned
+     * (@see Control::spawn), reset before the worker is called
+     *************************/
+    struct Join
+    {
+        std::atomic<std::uint32_t> pending;
+        std::atomic<bool>          failed;
+
+        void reset()
+        {
+            pending.store( 1, std::memory_order_relaxed );
+            failed.store( false, std::memory_order_relaxed );
+        }
+    };
     /**************************
      * Control structure accessible by the work function
      * to control internal work state and further processing steps
      * (if childs can start or not)
+     *
+     * Control is a trivially copyable handle to the node
+     * (owner, index within the owner, notification function,
+     * executor and join counter of the node), creating and
+     * copying it does not allocate.
+     *
+     * The worker may spawn further work before it calls
+     * set_completed() or set_failed(): the node is done (and
+     * triggers its children) only when all spawned work is done
+     * as well, it fails if any spawned work did not complete.
      *************************/
     struct Control
     {
-        using NotifyFunc = std::function<void(void)>;
+        using NotifyFunc = void(*)( void* owner, std::uint32_t index, Work::State result );
+
+        Control( void* owner, std::uint32_t index, NotifyFunc notify,
+                 const std::shared_ptr<Executor>* executor = nullptr, Work::Join* join = nullptr )
+            : m_owner( owner )
+            , m_index( index )
+            , m_notify( notify )
+            , m_executor( executor )
+            , m_join( join )
+        {}
+
+        void set_completed() const
+        {
+            release( Work::State::Completed );
+        }
 
-        NotifyFunc          set_completed;
-        NotifyFunc          set_failed;
+        void set_failed() const
+        {
+            release( Work::State::Failed );
+        }
+        /**************************
+         * the executor the node runs on
+         *************************/
+        const std::shared_ptr<Executor>& executor() const
+        {
+            return *m_executor;
+        }
+        /**************************
+         * creates a node running the worker function f on the
+         * executor of this node and starts it right away;
+         * this node is done only after the spawned node is done
+         *************************/
+        template<typename F,
+                 typename = typename std::enable_if<
+                     !std::is_convertible<typename std::decay<F>::type, std::shared_ptr<Work>>::value>::type>
+        std::shared_ptr<Work> spawn( F&& f ) const
+        {
+            std::shared_ptr<Work> node = Work::make_work( std::forward<F>( f ), executor() );
+            spawn( node );
+            return node;
+        }
+        /**************************
+         * triggers node (e.g. the root of a subtree built by the
+         * worker), this node is done only after node is done
+         *************************/
+        void spawn( const std::shared_ptr<Work>& node ) const
+        {
+            join( node );
+            if ( node->trigger_by( nullptr, Work::State::Completed ) )
+            {
+                node->m_self = node;
+                node->launch();
+            }
+        }
+        /**************************
+         * this node is done only after node is done, e.g. the
+         * last node of a spawned subtree (node is not triggered)
+         *************************/
+        void join( const std::shared_ptr<Work>& node ) const
+        {
+            retain();
+            const Work::Control control = *this;
+            std::shared_ptr<Work> keep_alive = node;
+            node->on_done( [control, keep_alive](Work::State state)
+                           {
+                               control.release( state );
+                           } );
+        }
+        /**************************
+         * low level join: the node is not done before every
+         * retain() is matched by a release( state ); retain()
+         * may only be called by the worker or by work it
+         * spawned (anything which holds a retain itself)
+         *************************/
+        void retain() const
+        {
+            m_join->pending.fetch_add( 1, std::memory_order_relaxed );
+        }
+
+        void release( Work::State state ) const
+        {
+            if ( m_join == nullptr )
+            {
+                m_notify( m_owner, m_index, state );
+                return;
+            }
+
+            if ( state != Work::State::Completed )
+                m_join->failed.store( true, std::memory_order_relaxed );
+
+            // a single holder can not race with a retain, which
+            // saves the atomic decrement for nodes without spawns
+            if ( m_join->pending.load( std::memory_order_acquire ) != 1 &&
+                 m_join->pending.fetch_sub( 1, std::memory_order_acq_rel ) != 1 )
+                return;
+
+            m_notify( m_owner, m_index, m_join->failed.load( std::memory_order_relaxed ) ?
+                                        Work::State::Failed : Work::State::Completed );
+        }
+        /**************************
+         * the object the node belongs to (the Work itself or the
+         * GraphRun, @see GraphRun::of) and the index within it
+         *************************/
+        void* owner() const
+        {
+            return m_owner;
+        }
+
+        std::uint32_t index() const
+        {
+            return m_index;
+        }
+
+    private:
+        void*                            m_owner;
+        std::uint32_t                    m_index;
+        NotifyFunc                       m_notify;
+        const std::shared_ptr<Executor>* m_executor;
+        Work::Join*                      m_join;
     };
     /**************************
      * the work function definition
@@ -67,15 +236,15 @@ public:
      *************************/
     using WorkerFunc = std::function<void(const Work::Control&)>;
     /**************************
-     *
+     * storage type of the work function
+     *  callables of up to 6 pointers are stored inline
      *************************/
-    enum class State
-    {
-        Created,
-        Running,
-        Completed,
-        Failed
-    };
+    using Worker = detail::InplaceFunction<void(const Work::Control&)>;
+    /**************************
+     * completion callback, receives the final state of the node
+     * @see Work::on_done
+     *************************/
+    using Callback = detail::InplaceFunction<void(Work::State)>;
     /**************************
      * Support type for the trigger condition
      *   Conditional::OR - execute if any of the parents is done
@@ -94,14 +263,7 @@ public:
     static void execute_if_all_finished( const WorkerSet& parents, 
                                          const WorkerSet& children )
     {
-        for( auto parent : parents )
-        {
-            for( auto child : children )
-            {
-                child->set_trigger_condition( Work::Conditional::AND );
-                parent->register_child( child );
-            }
-        }
+        Work::connect( parents, children, Work::Conditional::AND );
     }
     /**************************
      * construct an OR relationship between given sets of work nodes
@@ -109,15 +271,77 @@ public:
     static void execute_if_any_finished( const WorkerSet& parents, 
                                          const WorkerSet& children )
     {
-        for( auto parent : parents )
+        Work::connect( parents, children, Work::Conditional::OR );
+    }
+    /**************************
+     * bulk edge construction: every child becomes a child of
+     * every parent with the trigger condition c
+     *
+     * each parent appends all children in one range insert and
+     * each child updates its condition and parent count once,
+     * so the cost is one pass over parents and children plus
+     * the parents.size() * children.size() pointer copies
+     * (@see Work::make_barrier to avoid those)
+     *************************/
+    static void connect( const WorkerSet& parents,
+                         const WorkerSet& children,
+                         const Work::Conditional c )
+    {
+        for( const std::shared_ptr<Work>& child : children )
         {
-            for( auto child : children )
-            {
-                child->set_trigger_condition( Work::Conditional::OR );
-                parent->register_child( child );
-            }
+            child->set_trigger_condition( c );
+            child->m_parent_count += parents.size();
+            child->m_pending_parents = child->m_parent_count;
+        }
+
+        for( const std::shared_ptr<Work>& parent : parents )
+        {
+            parent->m_children.insert( parent->m_children.end(), children.begin(), children.end() );
         }
     }
+    /**************************
+     * connects parents and children through an empty barrier node:
+     * the barrier waits for all (AND) or any (OR) of the parents
+     * and triggers all children, which turns
+     * parents.size() * children.size() edges into
+     * parents.size() + children.size()
+     *************************/
+    static std::shared_ptr<Work> make_barrier( const WorkerSet& parents,
+                                               const WorkerSet& children,
+                                               const Work::Conditional c = Work::Conditional::AND,
+                                               std::shared_ptr<Executor> executor = Executor::default_executor() )
+    {
+        std::shared_ptr<Work> barrier = Work::make_work( [](const Work::Control& control)
+                                                         {
+                                                             control.set_completed();
+                                                         },
+                                                         std::move( executor ) );
+        Work::connect( parents, { barrier }, c );
+        Work::connect( { barrier }, children, Work::Conditional::AND );
+        return barrier;
+    }
+    /**************************
+     * creates a node which stores the callable f inline
+     *************************/
+    template<typename F>
+    static std::shared_ptr<Work> make_work( F&& f,
+                                            std::shared_ptr<Executor> executor = Executor::default_executor() )
+    {
+        return std::make_shared<Work>( std::forward<F>( f ), std::move( executor ) );
+    }
+    /**************************
+     * creates a node which stores the callable f inline;
+     * the node and its control block are allocated from
+     * the arena (which has to outlive the node)
+     *************************/
+    template<typename F>
+    static std::shared_ptr<Work> make_work( Arena& arena,
+                                            F&& f,
+                                            std::shared_ptr<Executor> executor = Executor::default_executor() )
+    {
+        return std::allocate_shared<Work>( ArenaAllocator<Work>( &arena ),
+                                           std::forward<F>( f ), std::move( executor ) );
+    }
     /**************************
      * creates an empty always true node
      *************************/
@@ -134,18 +358,41 @@ public:
 public:
     /**************************
      * Work is defined by the worker function
+     * (any callable void(const Work::Control&))
+     * and the executor it is started on
      *************************/
-    Work( const WorkerFunc& f )
+    template<typename F,
+             typename = typename std::enable_if<
+                 !std::is_base_of<Work, typename std::decay<F>::type>::value>::type>
+    Work( F&& f,
+          std::shared_ptr<Executor> executor = Executor::default_executor() )
         : m_state{ Work::State::Created }
-        , m_control{ std::bind( &Work::done, this, Work::State::Completed ), 
-                     std::bind( &Work::done, this, Work::State::Failed ) }
+        , m_control( this, 0, &Work::notify, &m_executor, &m_join )
         , m_children()
-        , m_worker( f )
+        , m_worker( std::forward<F>( f ) )
+        , m_executor( std::move( executor ) )
         , m_promise_done()
         , m_is_done( m_promise_done.get_future() )
         , m_parent_count(0)
-        , m_parent_done_count(0)
+        , m_pending_parents(0)
+        , m_failed_parents(0)
         , m_trigger_condition( Work::Conditional::OR )
+        , m_priority( 0 )
+        , m_affinity()
+        , m_claims()
+        , m_callback_mutex()
+        , m_callbacks()
+        , m_has_callbacks( false )
+        , m_join()
+        , m_self()
+        , m_timeout( detail::TimerService::Clock::duration::zero() )
+        , m_deadline( detail::TimerService::NoTimer )
+#ifdef TREE_OF_WORK_PROFILING
+        , m_profile()
+#endif
+#ifdef TREE_OF_WORK_COLLECT_METRICS
+        , m_metric_stamp()
+#endif
     {}
     /**************************
      *
@@ -158,38 +405,57 @@ public:
      *
      * starts the worker thread if all/any parents (if any) completed
      * their work successfully
+     *
+     * trigger is lock free and may be called concurrently by
+     * all parents:
+     *   AND - the parent which brings the pending parent counter
+     *         to zero starts the node
+     *   OR  - the first parent which moves the state from
+     *         Created to Running starts the node
+     *
+     * a parent which failed (or was cancelled) cancels the node
+     * if it is an AND node or if it was the last OR parent
      *************************/
     void trigger( const Work::State parent_state = Work::State::Completed )
     {
-        if ( m_state.load() == Work::State::Created )
+        if ( trigger_by( nullptr, parent_state ) )
+            launch();
+    }
+    /**************************
+     * cancels this node and all of its descendants which
+     * have not been started yet
+     * nodes which are already running are not interrupted
+     *
+     * every descendant is visited once, also those behind running,
+     * finished or already cancelled nodes, so nodes reached by
+     * several paths do not multiply the work
+     *************************/
+    void cancel()
+    {
+        std::vector<Work*> pending( 1, this );
+        std::unordered_set<Work*> visited( pending.begin(), pending.end() );
+        while( !pending.empty() )
         {
-            bool run_now = false;
-            if ( parent_state == Work::State::Completed )
-            {
-                if ( m_parent_count > 0 )
-                    m_parent_count--;
-
-                switch( m_trigger_condition )
-                {
-                    default: break;
-                    case Work::Conditional::OR:
-                        run_now = true;
-                        break;
-                    case Work::Conditional::AND:
-                        run_now = m_parent_count == 0;
-                        break;
-                }
-
-                if ( run_now )
-                {
-                    m_state = Work::State::Running;
+            Work* node = pending.back();
+            pending.pop_back();
 
-                    std::thread t = std::thread( m_worker, m_control );
-                    t.detach();
-                }
+            const bool cancelled = node->set_cancelled();
+            for( std::shared_ptr<Work>& child : node->m_children )
+            {
+                if ( child != nullptr && visited.insert( child.get() ).second )
+                    pending.push_back( child.get() );
             }
+            if ( cancelled )
+                node->signal_done( Work::State::Cancelled );
         }
     }
+    /**************************
+     * current state of the node
+     *************************/
+    Work::State get_state() const
+    {
+        return m_state.load();
+    }
     /**************************
      * append a new child which is called as soon as the current
      * node is finished
@@ -199,8 +465,8 @@ public:
         m_children.push_back( child );
 
         // parent added
-        m_parent_count++;
-        m_parent_done_count = m_parent_count;
+        child->m_parent_count++;
+        child->m_pending_parents = child->m_parent_count;
     }
     /**************************
      * change trigger condition
@@ -212,19 +478,89 @@ public:
     {
         m_trigger_condition = c;
     }
+    /**************************
+     * change the executor the worker function is started on
+     *  e.g. std::make_shared<ThreadPerTaskExecutor>() for
+     *  one thread per node
+     *************************/
+    void set_executor( std::shared_ptr<Executor> executor )
+    {
+        m_executor = std::move( executor );
+    }
+    /**************************
+     * scheduling priority of the node, higher runs first
+     * on executors which support it (@see PriorityExecutor)
+     * default is 0
+     *************************/
+    void set_priority( int priority )
+    {
+        m_priority = priority;
+    }
+    int get_priority() const
+    {
+        return m_priority;
+    }
+    /**************************
+     * placement hint of the node (@see Affinity)
+     *  set deep == true to apply it to all descendants
+     *************************/
+    void set_affinity( Affinity affinity, bool deep=false )
+    {
+        m_affinity = affinity;
+        if ( deep )
+        {
+            for( std::shared_ptr<Work>& child : m_children )
+            {
+                if ( child != nullptr )
+                    child->set_affinity( affinity, deep );
+            }
+        }
+    }
+    Affinity get_affinity() const
+    {
+        return m_affinity;
+    }
+    /**************************
+     * the node needs count tokens of pool to run: once it is
+     * ready it waits (without a thread) until it got the
+     * tokens of all its pools and returns them when it is done
+     * @see ResourcePool
+     *************************/
+    void require( std::shared_ptr<ResourcePool> pool, size_t count = 1 )
+    {
+        detail::add_claim( m_claims, std::move( pool ), count );
+    }
+    /**************************
+     * the worker has timeout from its start to finish, otherwise
+     * the node fails: its children are settled and its
+     * callbacks are called right away, wait_for_done() and
+     * reset() still wait until the worker returned (whatever
+     * it reports then is ignored); zero (the default) disables
+     * the deadline
+     *
+     * deadlines are kept by the shared timer thread with a
+     * resolution of a millisecond (@see detail::TimerService)
+     *************************/
+    template<typename Rep, typename Period>
+    void set_timeout( const std::chrono::duration<Rep, Period>& timeout )
+    {
+        m_timeout = std::chrono::duration_cast<detail::TimerService::Clock::duration>( timeout );
+    }
     /**************************
      * reset internal state for another run
      *  set deep == true for recursive reset
      *************************/
     void reset( bool deep=false )
     {
-        if ( m_state.load() == Work::State::Running )
+        // includes a node which failed by its deadline while its worker still runs
+        if ( m_state.load() != Work::State::Created )
             wait_for_done();
         
         m_state = Work::State::Created;
         m_promise_done = std::promise<bool>();
         m_is_done = m_promise_done.get_future();
-        m_parent_done_count = m_parent_count;
+        m_pending_parents = m_parent_count;
+        m_failed_parents = 0;
         if ( deep )
         {
             for( std::shared_ptr<Work>& child : m_children )
@@ -239,35 +575,362 @@ public:
      *************************/
     void wait_for_done()
     {
-        if ( m_is_done.valid() && m_is_done.wait_for(std::chrono::seconds(0)) != std::future_status::ready )
-            m_is_done.get();
+        // wait() (unlike get()) keeps the future valid and is const,
+        // so several threads may wait and poll at the same time
+        if ( m_is_done.valid() )
+            m_is_done.wait();
+    }
+    /**************************
+     * true if the current run of the node is done, never blocks
+     * (like wait_for_done, the node is not touched by the
+     * library anymore once this returned true)
+     *************************/
+    bool try_is_done() const
+    {
+        return m_is_done.valid() && m_is_done.wait_for( std::chrono::seconds( 0 ) ) == std::future_status::ready;
+    }
+    /**************************
+     * blocks until the work is done or timeout passed,
+     * returns true if the work is done
+     *************************/
+    template<typename Rep, typename Period>
+    bool wait_for_done( const std::chrono::duration<Rep, Period>& timeout ) const
+    {
+        return !m_is_done.valid() || m_is_done.wait_for( timeout ) == std::future_status::ready;
+    }
+    /**************************
+     * blocks until the work is done or deadline is reached,
+     * returns true if the work is done
+     *************************/
+    template<typename Clock, typename Duration>
+    bool wait_until( const std::chrono::time_point<Clock, Duration>& deadline ) const
+    {
+        return !m_is_done.valid() || m_is_done.wait_until( deadline ) == std::future_status::ready;
+    }
+    /**************************
+     * calls callback( state ) once the current run of the node
+     * is done, or right away if it is done already
+     *
+     * the callback runs on the thread which finishes the node
+     * (usually an executor thread) and is dropped after the call,
+     * callbacks for another run have to be registered after reset()
+     *************************/
+    template<typename F>
+    void on_done( F&& callback )
+    {
+        {
+            std::lock_guard<std::mutex> lock( m_callback_mutex );
+            m_callbacks.emplace_back( std::forward<F>( callback ) );
+            m_has_callbacks = true;
+        }
+        // the node may have finished before the callback was stored
+        if ( has_finished() )
+            run_callbacks();
     }
 
 private:
+    /**************************
+     * @see Work::trigger
+     *  parent is the node which calls trigger (nullptr for roots)
+     *  returns true if the node is Running now and has to
+     *  be launched by the caller
+     *************************/
+    bool trigger_by( const Work* parent, const Work::State parent_state )
+    {
+        static_cast<void>( parent );
+
+        if ( parent_state != Work::State::Completed )
+        {
+            if ( parent_failed() )
+                Work::propagate_cancel( this );
+            return false;
+        }
+
+        bool run_now = false;
+        switch( m_trigger_condition )
+        {
+            default: break;
+            case Work::Conditional::OR:
+                run_now = true;
+                break;
+            case Work::Conditional::AND:
+                run_now = m_parent_count == 0 ||
+                          m_pending_parents.fetch_sub( 1, std::memory_order_acq_rel ) == 1;
+                break;
+        }
+
+        if ( !run_now )
+            return false;
+
+        Work::State expected = Work::State::Created;
+        if ( !m_state.compare_exchange_strong( expected, Work::State::Running,
+                                               std::memory_order_acq_rel ) )
+            return false;
+
+        TREE_OF_WORK_PROFILE( m_profile.ready( parent, 0 ); )
+        TREE_OF_WORK_METRIC( m_metric_stamp.ready_ns = detail::metric_clock_ns(); )
+        return true;
+    }
+    /**************************
+     * hands a Running node to its executor
+     *************************/
+    void launch()
+    {
+        if ( m_claims.empty() )
+            m_executor->submit( [this]{ run(); }, m_priority, m_affinity );
+        else
+            admit( 0 );
+    }
+    /**************************
+     * takes the tokens of the claims from next on, one pool after
+     * the other; a pool without enough tokens resumes admission
+     * once they are released
+     *************************/
+    void admit( size_t next )
+    {
+        for( ; next < m_claims.size(); ++next )
+        {
+            if ( !m_claims[next].pool->acquire( m_claims[next].count, [this, next]{ admit( next + 1 ); } ) )
+                return;
+        }
+        m_executor->submit( [this]{ run(); }, m_priority, m_affinity );
+    }
+    /**************************
+     * executes the worker function on the calling thread
+     *************************/
+    void run()
+    {
+        TREE_OF_WORK_PROFILE( m_profile.start(); )
+        TREE_OF_WORK_METRIC( m_metric_stamp.start_ns = detail::metric_clock_ns();
+                             NodeMetrics::global().started( m_metric_stamp.start_ns - m_metric_stamp.ready_ns ); )
+        m_join.reset();
+        if ( m_timeout != detail::TimerService::Clock::duration::zero() )
+            m_deadline = detail::TimerService::instance().schedule( detail::TimerService::Clock::now() + m_timeout,
+                                                                    [this]{ expire(); } );
+        m_worker( m_control );
+    }
+    /**************************
+     * timer callback, the deadline passed while the worker runs:
+     * the node fails now, it is done once the worker returns
+     * (@see done)
+     *************************/
+    void expire()
+    {
+        Work::State expected = Work::State::Running;
+        if ( !m_state.compare_exchange_strong( expected, Work::State::Failed ) )
+            return;
+
+        for( std::shared_ptr<Work>& child : m_children )
+        {
+            if ( child != nullptr )
+                child->trigger_by( this, Work::State::Failed );
+        }
+        run_callbacks();
+    }
+    /**************************
+     * one of the parents failed
+     *  returns true if this node got cancelled
+     *************************/
+    bool parent_failed()
+    {
+        bool cancel_now = true;
+        if ( m_trigger_condition == Work::Conditional::OR && m_parent_count > 0 )
+            cancel_now = m_failed_parents.fetch_add( 1, std::memory_order_acq_rel ) + 1 == m_parent_count;
+
+        return cancel_now && set_cancelled();
+    }
+    /**************************
+     * moves a node which was not started yet to Cancelled,
+     * the caller signals it with signal_done() once it
+     * went through the children
+     *************************/
+    bool set_cancelled()
+    {
+        Work::State expected = Work::State::Created;
+        if ( !m_state.compare_exchange_strong( expected, Work::State::Cancelled ) )
+            return false;
+
+        TREE_OF_WORK_METRIC( NodeMetrics::global().cancelled(); )
+        return true;
+    }
+    /**************************
+     * cancels the descendants of a cancelled node in one pass
+     * (each node is cancelled and visited at most once)
+     *************************/
+    static void propagate_cancel( Work* cancelled )
+    {
+        std::vector<Work*> pending( 1, cancelled );
+        while( !pending.empty() )
+        {
+            Work* node = pending.back();
+            pending.pop_back();
+
+            for( std::shared_ptr<Work>& child : node->m_children )
+            {
+                if ( child != nullptr && child->parent_failed() )
+                    pending.push_back( child.get() );
+            }
+            node->signal_done( Work::State::Cancelled );
+        }
+    }
+    /**************************
+     * the state of the current run is final
+     *************************/
+    bool has_finished() const
+    {
+        const Work::State state = m_state.load();
+        return state == Work::State::Completed ||
+               state == Work::State::Failed ||
+               state == Work::State::Cancelled;
+    }
+    /**************************
+     * marks the node as done and calls the callbacks;
+     * the last access to the node, a waiter may destroy
+     * it as soon as the promise is set
+     *************************/
+    void signal_done( const Work::State result )
+    {
+        std::vector<Work::Callback> callbacks;
+        if ( m_has_callbacks.load() )
+        {
+            std::lock_guard<std::mutex> lock( m_callback_mutex );
+            callbacks.swap( m_callbacks );
+            m_has_callbacks = false;
+        }
+
+        m_promise_done.set_value( true );
+        for( Work::Callback& callback : callbacks )
+            callback( result );
+    }
+    /**************************
+     * calls and drops all registered callbacks
+     *
+     * called by on_done if the node finished meanwhile: the
+     * finishing thread stores the state before it checks
+     * m_has_callbacks (@see signal_done), on_done sets
+     * m_has_callbacks before it checks the state, so at least one
+     * of them sees the callback; it is taken out under the lock
+     * and runs exactly once
+     *************************/
+    void run_callbacks()
+    {
+        std::vector<Work::Callback> callbacks;
+        {
+            std::lock_guard<std::mutex> lock( m_callback_mutex );
+            callbacks.swap( m_callbacks );
+            m_has_callbacks = false;
+        }
+
+        const Work::State state = m_state.load();
+        for( Work::Callback& callback : callbacks )
+            callback( state );
+    }
+    /**************************
+     * Control::NotifyFunc of a node
+     *************************/
+    static void notify( void* owner, std::uint32_t, Work::State result )
+    {
+        static_cast<Work*>( owner )->done( result );
+    }
     /**************************
      *
      *************************/
     void done( const Work::State result )
     {
-        m_state = result;
-        m_promise_done.set_value( true );
+        // a node started by its parent owns itself until it is done,
+        // e.g. the children of a spawned subtree (@see Control::spawn);
+        // it may hold the last reference to its executor, which then
+        // is destroyed on its own thread (@see Executor::join_threads)
+        const std::shared_ptr<Work> self = std::move( m_self );
+
+        // waits for an expiry in progress
+        if ( m_deadline != detail::TimerService::NoTimer )
+        {
+            detail::TimerService::instance().cancel( m_deadline );
+            m_deadline = detail::TimerService::NoTimer;
+        }
+
+        Work::State expected = Work::State::Running;
+        const bool in_time = m_state.compare_exchange_strong( expected, result );
+
+        TREE_OF_WORK_PROFILE( m_profile.end( this, 0 ); )
+        TREE_OF_WORK_METRIC( NodeMetrics::global().finished( in_time && result == Work::State::Completed,
+                                                             detail::metric_clock_ns() - m_metric_stamp.start_ns ); )
+
+        for( ResourceClaim& claim : m_claims )
+            claim.pool->release( claim.count );
+
+        // the children of an expired node are settled already
+        if ( !in_time )
+        {
+            signal_done( expected );
+            return;
+        }
+
+        // the ready child with the highest priority (the last one
+        // among equals) may run as continuation on this thread
+        Work* continuation = nullptr;
         for( std::shared_ptr<Work>& child : m_children )
         {
-            if ( child != nullptr )
-                child->trigger( m_state.load() );
+            if ( child != nullptr && child->trigger_by( this, result ) )
+            {
+                child->m_self = child;
+                if ( continuation == nullptr )
+                {
+                    continuation = child.get();
+                }
+                else if ( child->m_priority < continuation->m_priority )
+                {
+                    child->launch();
+                }
+                else
+                {
+                    continuation->launch();
+                    continuation = child.get();
+                }
+            }
+        }
+        const bool same_executor = continuation != nullptr && continuation->m_executor == m_executor;
+
+        // this node must not be touched after signal_done
+        signal_done( result );
+
+        if ( continuation != nullptr )
+        {
+            if ( !same_executor || !continuation->m_claims.empty() ||
+                 !continuation->m_executor->run_as_continuation( [continuation]{ continuation->run(); } ) )
+                continuation->launch();
         }
     }
 
 private:
-    std::atomic<Work::State> m_state;
-    Work::Control            m_control;
-    Work::WorkerSet          m_children;
-    WorkerFunc               m_worker;
-    std::promise<bool>       m_promise_done;
-    std::future<bool>        m_is_done;
-    size_t                   m_parent_count;
-    size_t                   m_parent_done_count;
-    Work::Conditional        m_trigger_condition;
+    std::atomic<Work::State>              m_state;
+    Work::Control                         m_control;
+    Work::WorkerSet                       m_children;
+    Work::Worker                          m_worker;
+    std::shared_ptr<Executor>             m_executor;
+    std::promise<bool>                    m_promise_done;
+    std::future<bool>                     m_is_done;
+    size_t                                m_parent_count;
+    std::atomic<size_t>                   m_pending_parents;
+    std::atomic<size_t>                   m_failed_parents;
+    Work::Conditional                     m_trigger_condition;
+    int                                   m_priority;
+    Affinity                              m_affinity;
+    std::vector<ResourceClaim>            m_claims;
+    std::mutex                            m_callback_mutex;
+    std::vector<Work::Callback>           m_callbacks;
+    std::atomic<bool>                     m_has_callbacks;
+    Work::Join                            m_join;
+    std::shared_ptr<Work>                 m_self;
+    detail::TimerService::Clock::duration m_timeout;
+    detail::TimerService::Handle          m_deadline;
+#ifdef TREE_OF_WORK_PROFILING
+    detail::ProfileStamp                  m_profile;
+#endif
+#ifdef TREE_OF_WORK_COLLECT_METRICS
+    detail::MetricStamp                   m_metric_stamp;
+#endif
 };
 
 }
@@ -0,0 +1,238 @@
+/********************************************************************************
+ * MIT License
+ *
+ * Copyright (c) 2020 Christian Kranz
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ * 
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ * 
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ *******************************************************************************/
+#ifndef TREE_OF_WORK_AFFINITY
+#define TREE_OF_WORK_AFFINITY
+
+#include <cstdint>
+#include <fstream>
+#include <string>
+#include <thread>
+#include <vector>
+
+#if defined(__linux__)
+#include <pthread.h>
+#include <sched.h>
+#endif
+
+namespace TreeOfWork
+{
+/**************************
+ * Placement hint of a node, honoured by executors which know
+ * about their threads (@see WorkStealingExecutor), ignored by
+ * all others:
+ *   any()            - wherever the executor likes (default)
+ *   worker( i )      - only on worker thread i
+ *   numa_node( n )   - only on workers running on NUMA node n
+ *                      (any worker if the executor has none there)
+ *   same_as_parent() - on the worker which finished the parent,
+ *                      where its outputs are still in cache
+ *
+ *************************/
+class Affinity
+{
+public:
+    enum class Kind : std::uint8_t
+    {
+        Any,
+        Worker,
+        NumaNode,
+        Parent
+    };
+
+public:
+    Affinity()
+        : m_kind( Affinity::Kind::Any )
+        , m_value( 0 )
+    {}
+
+    static Affinity any()
+    {
+        return Affinity();
+    }
+
+    static Affinity worker( std::uint32_t index )
+    {
+        return Affinity( Affinity::Kind::Worker, index );
+    }
+
+    static Affinity numa_node( std::uint32_t node )
+    {
+        return Affinity( Affinity::Kind::NumaNode, node );
+    }
+
+    static Affinity same_as_parent()
+    {
+        return Affinity( Affinity::Kind::Parent, 0 );
+    }
+
+    Affinity::Kind kind() const
+    {
+        return m_kind;
+    }
+
+    std::uint32_t value() const
+    {
+        return m_value;
+    }
+
+private:
+    Affinity( Affinity::Kind kind, std::uint32_t value )
+        : m_kind( kind )
+        , m_value( value )
+    {}
+
+private:
+    Affinity::Kind m_kind;
+    std::uint32_t  m_value;
+};
+
+/**************************
+ * CPU and NUMA layout of the machine.
+ *
+ * On Linux the NUMA nodes and their CPUs are read once from
+ * /sys/devices/system/node; elsewhere (or if sysfs is not
+ * available) the machine is one node with all hardware threads.
+ *
+ *************************/
+class Topology
+{
+public:
+    /**************************
+     * CPUs of each NUMA node, indexed by node number
+     * (nodes which are not online have no CPUs)
+     *************************/
+    static const std::vector<std::vector<int>>& numa_nodes()
+    {
+        static const std::vector<std::vector<int>> nodes = Topology::read_numa_nodes();
+        return nodes;
+    }
+    /**************************
+     * NUMA node of a CPU, -1 if unknown
+     *************************/
+    static int numa_node_of( int cpu )
+    {
+        const std::vector<std::vector<int>>& nodes = Topology::numa_nodes();
+        for( size_t node = 0; node < nodes.size(); ++node )
+        {
+            for( const int c : nodes[node] )
+            {
+                if ( c == cpu )
+                    return static_cast<int>( node );
+            }
+        }
+        return -1;
+    }
+    /**************************
+     * all CPUs, node by node, e.g. to create a pinned
+     * WorkStealingExecutor with one worker per CPU
+     *************************/
+    static std::vector<int> cpus()
+    {
+        std::vector<int> all;
+        for( const std::vector<int>& node : Topology::numa_nodes() )
+            all.insert( all.end(), node.begin(), node.end() );
+        return all;
+    }
+    /**************************
+     * pins the calling thread to one CPU
+     * returns false if this is not supported or failed
+     *************************/
+    static bool pin_current_thread( int cpu )
+    {
+#if defined(__linux__)
+        if ( cpu < 0 || cpu >= CPU_SETSIZE )
+            return false;
+
+        cpu_set_t set;
+        CPU_ZERO( &set );
+        CPU_SET( cpu, &set );
+        return pthread_setaffinity_np( pthread_self(), sizeof(set), &set ) == 0;
+#else
+        static_cast<void>( cpu );
+        return false;
+#endif
+    }
+    /**************************
+     * parses a sysfs cpu list like "0-3,8,10-11"
+     *************************/
+    static std::vector<int> parse_cpu_list( const std::string& list )
+    {
+        std::vector<int> cpus;
+        size_t pos = 0;
+        while( pos < list.size() )
+        {
+            size_t end = list.find( ',', pos );
+            if ( end == std::string::npos )
+                end = list.size();
+
+            const std::string range = list.substr( pos, end - pos );
+            const size_t dash = range.find( '-' );
+            if ( !range.empty() && range.find_first_not_of( "0123456789-\n " ) == std::string::npos )
+            {
+                const int first = std::stoi( range.substr( 0, dash ) );
+                const int last = dash == std::string::npos ? first : std::stoi( range.substr( dash + 1 ) );
+                for( int cpu = first; cpu <= last; ++cpu )
+                    cpus.push_back( cpu );
+            }
+            pos = end + 1;
+        }
+        return cpus;
+    }
+
+private:
+    static std::vector<std::vector<int>> read_numa_nodes()
+    {
+        std::vector<std::vector<int>> nodes;
+#if defined(__linux__)
+        std::string online;
+        std::ifstream online_file( "/sys/devices/system/node/online" );
+        if ( std::getline( online_file, online ) )
+        {
+            for( const int node : Topology::parse_cpu_list( online ) )
+            {
+                std::string list;
+                std::ifstream cpulist( "/sys/devices/system/node/node" + std::to_string( node ) + "/cpulist" );
+                if ( !std::getline( cpulist, list ) )
+                    continue;
+
+                if ( nodes.size() <= static_cast<size_t>( node ) )
+                    nodes.resize( node + 1 );
+                nodes[node] = Topology::parse_cpu_list( list );
+            }
+        }
+#endif
+        if ( nodes.empty() )
+        {
+            const unsigned count = std::thread::hardware_concurrency();
+            nodes.resize( 1 );
+            for( unsigned cpu = 0; cpu < ( count == 0 ? 1 : count ); ++cpu )
+                nodes[0].push_back( static_cast<int>( cpu ) );
+        }
+        return nodes;
+    }
+};
+
+}
+
+#endif /* TREE_OF_WORK_AFFINITY */
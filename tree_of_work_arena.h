@@ -0,0 +1,225 @@
+/********************************************************************************
+ * MIT License
+ *
+ * Copyright (c) 2020 Christian Kranz
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ *******************************************************************************/
+#ifndef TREE_OF_WORK_ARENA
+#define TREE_OF_WORK_ARENA
+
+#include <cstddef>
+#include <cstdint>
+#include <new>
+#include <vector>
+
+#if defined(__has_include)
+#if __cplusplus >= 201703L && __has_include(<memory_resource>)
+#include <memory_resource>
+#define TREE_OF_WORK_HAS_PMR 1
+#endif
+#endif
+
+namespace TreeOfWork
+{
+/**************************
+ * Bump pointer allocator for nodes and graph metadata.
+ *
+ * Memory is taken from chunks which are only released
+ * all at once when the arena is destroyed, deallocate
+ * is a no-op. The arena has to outlive everything
+ * allocated from it.
+ *
+ * Like std::pmr::monotonic_buffer_resource the arena
+ * is not thread safe; it is meant to be used while
+ * a tree or graph is built.
+ *
+ *************************/
+class Arena
+{
+public:
+    static const size_t DefaultChunkSize = 64 * 1024;
+
+public:
+    /**************************
+     * chunks are allocated with ::operator new
+     *************************/
+    explicit Arena( size_t chunk_size = Arena::DefaultChunkSize )
+        : m_chunk_size( chunk_size )
+        , m_current( nullptr )
+        , m_end( nullptr )
+        , m_chunks( nullptr )
+#ifdef TREE_OF_WORK_HAS_PMR
+        , m_upstream( nullptr )
+#endif
+    {}
+#ifdef TREE_OF_WORK_HAS_PMR
+    /**************************
+     * chunks are allocated from the given memory resource
+     *************************/
+    explicit Arena( std::pmr::memory_resource* upstream,
+                    size_t chunk_size = Arena::DefaultChunkSize )
+        : m_chunk_size( chunk_size )
+        , m_current( nullptr )
+        , m_end( nullptr )
+        , m_chunks( nullptr )
+        , m_upstream( upstream )
+    {}
+#endif
+    /**************************
+     * releases all chunks at once
+     *************************/
+    ~Arena()
+    {
+        while( m_chunks != nullptr )
+        {
+            Arena::Chunk* next = m_chunks->next;
+            release_chunk( m_chunks );
+            m_chunks = next;
+        }
+    }
+    /**************************
+     *
+     *************************/
+    void* allocate( size_t size, size_t alignment = alignof(std::max_align_t) )
+    {
+        char* p = align( m_current, alignment );
+        if ( m_current == nullptr || p + size > m_end )
+        {
+            const size_t required = size + alignment + sizeof(Arena::Chunk);
+            add_chunk( required > m_chunk_size ? required : m_chunk_size );
+            p = align( m_current, alignment );
+        }
+
+        m_current = p + size;
+        return p;
+    }
+
+    Arena( const Arena& ) = delete;
+    Arena& operator=( const Arena& ) = delete;
+
+private:
+    struct Chunk
+    {
+        Arena::Chunk* next;
+        size_t        size;
+    };
+
+private:
+    static char* align( char* p, size_t alignment )
+    {
+        const std::uintptr_t address = reinterpret_cast<std::uintptr_t>( p );
+        return reinterpret_cast<char*>( ( address + alignment - 1 ) & ~std::uintptr_t( alignment - 1 ) );
+    }
+
+    void add_chunk( size_t size )
+    {
+        void* memory = nullptr;
+#ifdef TREE_OF_WORK_HAS_PMR
+        if ( m_upstream != nullptr )
+            memory = m_upstream->allocate( size, alignof(Arena::Chunk) );
+        else
+#endif
+            memory = ::operator new( size );
+
+        Arena::Chunk* chunk = static_cast<Arena::Chunk*>( memory );
+        chunk->next = m_chunks;
+        chunk->size = size;
+        m_chunks = chunk;
+
+        m_current = static_cast<char*>( memory ) + sizeof(Arena::Chunk);
+        m_end = static_cast<char*>( memory ) + size;
+    }
+
+    void release_chunk( Arena::Chunk* chunk )
+    {
+#ifdef TREE_OF_WORK_HAS_PMR
+        if ( m_upstream != nullptr )
+        {
+            m_upstream->deallocate( chunk, chunk->size, alignof(Arena::Chunk) );
+            return;
+        }
+#endif
+        ::operator delete( chunk );
+    }
+
+private:
+    size_t                     m_chunk_size;
+    char*                      m_current;
+    char*                      m_end;
+    Arena::Chunk*              m_chunks;
+#ifdef TREE_OF_WORK_HAS_PMR
+    std::pmr::memory_resource* m_upstream;
+#endif
+};
+
+/**************************
+ * STL allocator on top of an Arena
+ *************************/
+template<typename T>
+class ArenaAllocator
+{
+    template<typename U>
+    friend class ArenaAllocator;
+public:
+    using value_type = T;
+
+public:
+    explicit ArenaAllocator( Arena* arena )
+        : m_arena( arena )
+    {}
+
+    template<typename U>
+    ArenaAllocator( const ArenaAllocator<U>& other )
+        : m_arena( other.m_arena )
+    {}
+
+    T* allocate( size_t n )
+    {
+        return static_cast<T*>( m_arena->allocate( n * sizeof(T), alignof(T) ) );
+    }
+
+    void deallocate( T*, size_t )
+    {}
+
+    template<typename U>
+    bool operator==( const ArenaAllocator<U>& other ) const
+    {
+        return m_arena == other.m_arena;
+    }
+
+    template<typename U>
+    bool operator!=( const ArenaAllocator<U>& other ) const
+    {
+        return m_arena != other.m_arena;
+    }
+
+private:
+    Arena* m_arena;
+};
+
+namespace detail
+{
+template<typename T>
+using ArenaVector = std::vector<T, ArenaAllocator<T>>;
+}
+
+}
+
+#endif /* TREE_OF_WORK_ARENA */
@@ -0,0 +1,441 @@
+/********************************************************************************
+ * MIT License
+ *
+ * Copyright (c) 2020 Christian Kranz
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ * 
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ * 
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ *******************************************************************************/
+#ifndef TREE_OF_WORK_COROUTINE
+#define TREE_OF_WORK_COROUTINE
+
+#include <chrono>
+#include <exception>
+#include <optional>
+#include <utility>
+
+#include "tree_of_work.h"
+#include "tree_of_work_graph.h"
+#include "tree_of_work_timer.h"
+
+/**************************
+ * Awaitables for C++20 coroutines, only available if the
+ * compiler supports coroutines (e.g. -std=c++20)
+ *************************/
+#if defined(__cpp_impl_coroutine) && defined(__has_include)
+#if __has_include(<coroutine>)
+#include <coroutine>
+#define TREE_OF_WORK_HAS_COROUTINES 1
+#endif
+#endif
+
+#ifdef TREE_OF_WORK_HAS_COROUTINES
+namespace TreeOfWork
+{
+namespace detail
+{
+/**************************
+ * suspends the awaiting coroutine until the node is done,
+ * co_await yields the final state of the node
+ *************************/
+class WorkAwaiter
+{
+public:
+    explicit WorkAwaiter( Work& work )
+        : m_work( work )
+        , m_state( Work::State::Created )
+    {}
+
+    bool await_ready() const
+    {
+        return m_work.try_is_done();
+    }
+    /**************************
+     * the coroutine is resumed on the thread which finishes the node;
+     * it may be resumed before on_done returns, so the awaiter
+     * is not touched afterwards
+     *************************/
+    void await_suspend( std::coroutine_handle<> handle )
+    {
+        m_work.on_done( [this, handle](Work::State state)
+                        {
+                            m_state = state;
+                            handle.resume();
+                        } );
+    }
+
+    Work::State await_resume() const
+    {
+        return m_state == Work::State::Created ? m_work.get_state() : m_state;
+    }
+
+private:
+    Work&       m_work;
+    Work::State m_state;
+};
+/**************************
+ * suspends the awaiting coroutine until the current run
+ * of the graph (or of the GraphRun) is done
+ *************************/
+template<typename Run>
+class GraphAwaiter
+{
+public:
+    explicit GraphAwaiter( Run& graph )
+        : m_graph( graph )
+    {}
+
+    bool await_ready() const
+    {
+        return m_graph.try_is_done();
+    }
+    /**************************
+     * @see WorkAwaiter::await_suspend
+     *************************/
+    void await_suspend( std::coroutine_handle<> handle )
+    {
+        m_graph.on_done( [handle]{ handle.resume(); } );
+    }
+
+    void await_resume() const
+    {}
+
+private:
+    Run& m_graph;
+};
+}
+
+/**************************
+ * co_await *work;  waits for a triggered node without blocking
+ *                  a thread, yields its final Work::State
+ *
+ * (a template, so other awaitables are never converted to Work)
+ *************************/
+template<typename T,
+         typename = typename std::enable_if<std::is_same<T, Work>::value>::type>
+detail::WorkAwaiter operator co_await( T& work )
+{
+    return detail::WorkAwaiter( work );
+}
+/**************************
+ * co_await *graph; waits for the current run of a graph
+ * co_await run;    or of a GraphRun without blocking a thread
+ *************************/
+template<typename T,
+         typename = typename std::enable_if<std::is_same<T, Graph>::value ||
+                                            std::is_same<T, GraphRun>::value>::type,
+         typename = void>
+detail::GraphAwaiter<T> operator co_await( T& graph )
+{
+    return detail::GraphAwaiter<T>( graph );
+}
+
+/**************************
+ * Return type of coroutine workers.
+ *
+ * A coroutine worker is any callable returning AsyncWork,
+ * adapted to a node with async_worker() or make_async_work().
+ * It is started on the executor of its node and runs until
+ * its first co_await which does not complete right away; then
+ * the executor thread is released. It is resumed on the
+ * executor given to async_worker(), e.g. when a timer expires
+ * (@see sleep_for) or an I/O callback fires (@see resume_by).
+ *
+ *   co_return         - the node is completed
+ *   throwing          - the node is failed
+ *
+ * The coroutine should not keep references to the Control of
+ * the node, the completion is signalled when it returns.
+ *
+ *************************/
+class AsyncWork
+{
+public:
+    struct promise_type;
+    using Handle = std::coroutine_handle<AsyncWork::promise_type>;
+    /**************************
+     * resumes a suspended coroutine worker on its executor;
+     * has to be called exactly once
+     *************************/
+    class Resume
+    {
+    public:
+        explicit Resume( AsyncWork::Handle handle )
+            : m_handle( handle )
+        {}
+
+        void operator()() const
+        {
+            // the coroutine (and the last reference to its executor)
+            // may be gone before submit returns
+            AsyncWork::Handle handle = m_handle;
+            const std::shared_ptr<Executor> executor = handle.promise().executor;
+            executor->submit( [handle]{ handle.resume(); } );
+        }
+
+    private:
+        AsyncWork::Handle m_handle;
+    };
+    /**************************
+     * signals the result to the node once the frame is gone
+     *************************/
+    struct FinalAwaiter
+    {
+        bool await_ready() const noexcept
+        {
+            return false;
+        }
+
+        void await_suspend( AsyncWork::Handle handle ) noexcept
+        {
+            const Work::Control control = *handle.promise().control;
+            const bool failed = handle.promise().failed;
+            handle.destroy();
+
+            if ( failed )
+                control.set_failed();
+            else
+                control.set_completed();
+        }
+
+        void await_resume() const noexcept
+        {}
+    };
+
+    struct promise_type
+    {
+        AsyncWork get_return_object()
+        {
+            return AsyncWork( AsyncWork::Handle::from_promise( *this ) );
+        }
+
+        std::suspend_always initial_suspend() const noexcept
+        {
+            return {};
+        }
+
+        AsyncWork::FinalAwaiter final_suspend() const noexcept
+        {
+            return {};
+        }
+
+        void return_void()
+        {}
+
+        void unhandled_exception()
+        {
+            failed = true;
+        }
+
+        std::optional<Work::Control> control;
+        std::shared_ptr<Executor>    executor;
+        bool                         failed = false;
+    };
+
+public:
+    AsyncWork( AsyncWork&& other ) noexcept
+        : m_handle( std::exchange( other.m_handle, nullptr ) )
+    {}
+    /**************************
+     * destroys a coroutine which was never started
+     *************************/
+    ~AsyncWork()
+    {
+        if ( m_handle )
+            m_handle.destroy();
+    }
+    /**************************
+     * runs the coroutine up to its first suspension, from then
+     * on it owns itself and finishes the node given by control
+     *************************/
+    void start( const Work::Control& control, std::shared_ptr<Executor> executor )
+    {
+        AsyncWork::Handle handle = std::exchange( m_handle, nullptr );
+        handle.promise().control.emplace( control );
+        handle.promise().executor = std::move( executor );
+        handle.resume();
+    }
+
+    AsyncWork( const AsyncWork& ) = delete;
+    AsyncWork& operator=( const AsyncWork& ) = delete;
+    AsyncWork& operator=( AsyncWork&& ) = delete;
+
+private:
+    explicit AsyncWork( AsyncWork::Handle handle )
+        : m_handle( handle )
+    {}
+
+private:
+    AsyncWork::Handle m_handle;
+};
+
+namespace detail
+{
+/**************************
+ * worker function of a coroutine worker
+ *************************/
+template<typename F>
+class AsyncAdapter
+{
+public:
+    AsyncAdapter( F f, std::shared_ptr<Executor> executor )
+        : m_function( std::move( f ) )
+        , m_executor( std::move( executor ) )
+    {}
+
+    void operator()( const Work::Control& control )
+    {
+        // only the creation of the coroutine may throw here,
+        // exceptions of its body fail the node in the promise
+        std::optional<AsyncWork> work;
+        try
+        {
+            work.emplace( m_function() );
+        }
+        catch( ... )
+        {
+            control.set_failed();
+            return;
+        }
+        work->start( control, m_executor );
+    }
+
+private:
+    F                         m_function;
+    std::shared_ptr<Executor> m_executor;
+};
+/**************************
+ * @see sleep_until
+ *************************/
+class SleepAwaiter
+{
+public:
+    explicit SleepAwaiter( TimerService::Clock::time_point at )
+        : m_at( at )
+    {}
+
+    bool await_ready() const
+    {
+        return TimerService::Clock::now() >= m_at;
+    }
+
+    void await_suspend( AsyncWork::Handle handle ) const
+    {
+        TimerService::instance().schedule( m_at, AsyncWork::Resume( handle ) );
+    }
+
+    void await_resume() const
+    {}
+
+private:
+    TimerService::Clock::time_point m_at;
+};
+/**************************
+ * @see resume_by
+ *************************/
+template<typename F>
+class ResumeByAwaiter
+{
+public:
+    explicit ResumeByAwaiter( F f )
+        : m_function( std::move( f ) )
+    {}
+
+    bool await_ready() const
+    {
+        return false;
+    }
+    /**************************
+     * the coroutine may be resumed before m_function returns,
+     * so the awaiter is not touched afterwards
+     *************************/
+    void await_suspend( AsyncWork::Handle handle )
+    {
+        m_function( AsyncWork::Resume( handle ) );
+    }
+
+    void await_resume() const
+    {}
+
+private:
+    F m_function;
+};
+}
+
+/**************************
+ * adapts a coroutine worker f (any callable returning AsyncWork)
+ * to a worker function for Work or GraphBuilder::add;
+ * the coroutine is resumed on executor after a suspension
+ *************************/
+template<typename F>
+detail::AsyncAdapter<typename std::decay<F>::type>
+async_worker( F&& f, std::shared_ptr<Executor> executor = Executor::default_executor() )
+{
+    return detail::AsyncAdapter<typename std::decay<F>::type>( std::forward<F>( f ), std::move( executor ) );
+}
+/**************************
+ * creates a node which runs the coroutine worker f,
+ * it is started and resumed on executor
+ *************************/
+template<typename F>
+std::shared_ptr<Work> make_async_work( F&& f, std::shared_ptr<Executor> executor = Executor::default_executor() )
+{
+    return Work::make_work( async_worker( std::forward<F>( f ), executor ), executor );
+}
+/**************************
+ * co_await sleep_until( t ); suspends a coroutine worker until t
+ * without holding a thread
+ *************************/
+inline detail::SleepAwaiter sleep_until( detail::TimerService::Clock::time_point at )
+{
+    return detail::SleepAwaiter( at );
+}
+/**************************
+ * co_await sleep_for( d ); @see sleep_until
+ *************************/
+template<typename Rep, typename Period>
+detail::SleepAwaiter sleep_for( const std::chrono::duration<Rep, Period>& duration )
+{
+    return detail::SleepAwaiter( detail::TimerService::Clock::now() +
+                                 std::chrono::duration_cast<detail::TimerService::Clock::duration>( duration ) );
+}
+/**************************
+ * co_await resume_by( f ); suspends a coroutine worker and calls
+ * f( AsyncWork::Resume resume ), e.g. to start an asynchronous
+ * I/O operation whose completion handler calls resume()
+ *
+ *   std::string reply;
+ *   co_await resume_by( [&](AsyncWork::Resume resume)
+ *                       {
+ *                           client.async_call( request, [&reply, resume](std::string r)
+ *                                                       {
+ *                                                           reply = std::move( r );
+ *                                                           resume();
+ *                                                       } );
+ *                       } );
+ *************************/
+template<typename F>
+detail::ResumeByAwaiter<typename std::decay<F>::type> resume_by( F&& f )
+{
+    return detail::ResumeByAwaiter<typename std::decay<F>::type>( std::forward<F>( f ) );
+}
+
+}
+#endif /* TREE_OF_WORK_HAS_COROUTINES */
+
+#endif /* TREE_OF_WORK_COROUTINE */
@@ -0,0 +1,448 @@
+/********************************************************************************
+ * MIT License
+ *
+ * Copyright (c) 2020 Christian Kranz
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ *******************************************************************************/
+#ifndef TREE_OF_WORK_DATAFLOW
+#define TREE_OF_WORK_DATAFLOW
+
+#include <cstdint>
+#include <functional>
+#include <tuple>
+#include <type_traits>
+#include <utility>
+#include <new>
+
+#include "tree_of_work.h"
+
+namespace TreeOfWork
+{
+/**************************
+ * hash of a node input for the result cache of TypedWork
+ * (@see TypedWork::enable_cache), specialize it for input
+ * types without std::hash
+ *************************/
+template<typename T>
+struct InputHash : std::hash<T>
+{};
+
+namespace detail
+{
+/**************************
+ * C++11 replacement for std::index_sequence
+ *************************/
+template<size_t... I>
+struct IndexSequence
+{};
+
+template<size_t N, size_t... I>
+struct MakeIndexSequence : MakeIndexSequence<N - 1, N - 1, I...>
+{};
+
+template<size_t... I>
+struct MakeIndexSequence<0, I...>
+{
+    using type = IndexSequence<I...>;
+};
+
+/**************************
+ * inline storage for at most one value of type T
+ *************************/
+template<typename T>
+class Slot
+{
+public:
+    Slot()
+        : m_storage()
+        , m_engaged( false )
+    {}
+
+    ~Slot()
+    {
+        reset();
+    }
+
+    template<typename U>
+    void emplace( U&& value )
+    {
+        reset();
+        new ( &m_storage ) T( std::forward<U>( value ) );
+        m_engaged = true;
+    }
+
+    void reset()
+    {
+        if ( m_engaged )
+            get().~T();
+        m_engaged = false;
+    }
+
+    bool has_value() const { return m_engaged; }
+
+    T&       get()       { return *reinterpret_cast<T*>( &m_storage ); }
+    const T& get() const { return *reinterpret_cast<const T*>( &m_storage ); }
+
+    Slot( const Slot& ) = delete;
+    Slot& operator=( const Slot& ) = delete;
+
+private:
+    typename std::aligned_storage<sizeof(T), alignof(T)>::type m_storage;
+    bool                                                      m_engaged;
+};
+
+template<>
+class Slot<void>
+{
+public:
+    bool has_value() const { return true; }
+    void reset() {}
+};
+
+/**************************
+ * calls f and stores its result (if any) in the slot
+ *************************/
+template<typename Out>
+struct Invoker
+{
+    template<typename F, typename... Args>
+    static void invoke( Slot<Out>& out, F& f, Args&&... args )
+    {
+        out.emplace( f( std::forward<Args>( args )... ) );
+    }
+};
+
+template<>
+struct Invoker<void>
+{
+    template<typename F, typename... Args>
+    static void invoke( Slot<void>&, F& f, Args&&... args )
+    {
+        f( std::forward<Args>( args )... );
+    }
+};
+
+/**************************
+ * copies a result into or out of the result cache
+ *************************/
+template<typename Out>
+struct SlotCopy
+{
+    static void copy( const Slot<Out>& from, Slot<Out>& to )
+    {
+        to.emplace( from.get() );
+    }
+};
+
+template<>
+struct SlotCopy<void>
+{
+    static void copy( const Slot<void>&, Slot<void>& )
+    {}
+};
+
+inline void hash_combine( size_t& seed, size_t hash )
+{
+    seed ^= hash + size_t( 0x9e3779b97f4a7c15ull ) + ( seed << 6 ) + ( seed >> 2 );
+}
+}
+
+/**************************
+ * A typed node of the tree of work.
+ *
+ * TypedWork<Out(In...)> runs a function Out(In...). The inputs
+ * are stored inline in the node and filled by the parents
+ * (@see TypedWork::connect) or by the application
+ * (@see TypedWork::set_input) before the node is triggered.
+ * The result is stored inline as well and handed to all
+ * connected children before they are triggered:
+ * the last child receives it by move, all others by copy.
+ *
+ * Slots are written by the parent before it is done and
+ * read by the child after its trigger, so no extra locking
+ * is required.
+ *
+ * A function that throws sets the node state to failed.
+ *
+ * With the result cache enabled (@see TypedWork::enable_cache)
+ * a node whose inputs hash to the same key as in its last
+ * run (and whose version tag did not change) hands the cached
+ * result to its children instead of calling the function, so
+ * re-running a tree only executes the part with changed inputs.
+ *
+ *************************/
+template<typename Signature>
+class TypedWork;
+
+template<typename Out, typename... In>
+class TypedWork<Out(In...)>
+{
+    using Inputs   = std::tuple<detail::Slot<typename std::decay<In>::type>...>;
+    using Consumer = std::function<void(detail::Slot<Out>&, bool)>;
+public:
+    using Function = std::function<Out(In...)>;
+
+public:
+    /**************************
+     * typed work is defined by its function
+     * (any callable Out(In...), stored inline)
+     * and the executor it is started on
+     *************************/
+    template<typename F,
+             typename = typename std::enable_if<
+                 !std::is_same<typename std::decay<F>::type, TypedWork>::value>::type>
+    TypedWork( F&& f,
+               std::shared_ptr<Executor> executor = Executor::default_executor() )
+        : m_function( std::forward<F>( f ) )
+        , m_inputs()
+        , m_output()
+        , m_cache()
+        , m_consumers()
+        , m_work( std::make_shared<Work>( [this](const Work::Control& control)
+                                          {
+                                              execute( control );
+                                          },
+                                          std::move( executor ) ) )
+    {}
+    /**************************
+     * connects the output of this node to input I of child
+     * and makes child wait for this node (AND)
+     *************************/
+    template<size_t I, typename COut, typename... CIn>
+    void connect( const std::shared_ptr<TypedWork<COut(CIn...)>>& child )
+    {
+        static_assert( !std::is_void<Out>::value, "a node without result can not feed a child" );
+        static_assert( I < sizeof...(CIn), "input index out of range" );
+
+        std::shared_ptr<TypedWork<COut(CIn...)>> c = child;
+        m_consumers.push_back( [c](detail::Slot<Out>& out, bool last)
+                               {
+                                   if ( last )
+                                       c->template set_input<I>( std::move( out.get() ) );
+                                   else
+                                       c->template set_input<I>( out.get() );
+                               } );
+
+        Work::execute_if_all_finished( { m_work }, { child->work() } );
+    }
+    /**************************
+     * set input I directly (e.g. for root nodes)
+     *************************/
+    template<size_t I, typename U>
+    void set_input( U&& value )
+    {
+        std::get<I>( m_inputs ).emplace( std::forward<U>( value ) );
+    }
+    /**************************
+     * result of the last run
+     * only valid after wait_for_done() if the node completed
+     * and has no children (otherwise it has been moved on)
+     *************************/
+    typename std::add_lvalue_reference<const Out>::type result() const
+    {
+        return m_output.get();
+    }
+    /**************************
+     * result cache: the node skips the function if the inputs
+     * of a run hash (@see InputHash) to the key of the cached
+     * run and version is unchanged; a changed version (e.g. of
+     * the function or of data it reads besides its inputs)
+     * invalidates the cache. Requires hashable inputs and a
+     * copyable result. Equal hashes are taken as equal inputs.
+     *************************/
+    void enable_cache( std::uint64_t version = 0 )
+    {
+        m_cache.hash = &TypedWork::hash_inputs;
+        m_cache.copy = &detail::SlotCopy<Out>::copy;
+        set_cache_version( version );
+    }
+    void set_cache_version( std::uint64_t version )
+    {
+        if ( version != m_cache.version )
+            invalidate_cache();
+        m_cache.version = version;
+    }
+    void invalidate_cache()
+    {
+        m_cache.valid = false;
+        m_cache.output.reset();
+    }
+    void disable_cache()
+    {
+        invalidate_cache();
+        m_cache.hash = nullptr;
+    }
+    /**************************
+     * true if the last run took its result from the cache
+     *************************/
+    bool cache_hit() const
+    {
+        return m_cache.hit;
+    }
+    /**************************
+     * the untyped node, e.g. to build relationships
+     * with Work::execute_if_*_finished
+     *************************/
+    const std::shared_ptr<Work>& work() const
+    {
+        return m_work;
+    }
+    /**************************
+     * @see Work::trigger
+     *************************/
+    void trigger()
+    {
+        m_work->trigger();
+    }
+    /**************************
+     * @see Work::wait_for_done
+     *************************/
+    void wait_for_done()
+    {
+        m_work->wait_for_done();
+    }
+    /**************************
+     * @see Work::reset
+     *************************/
+    void reset( bool deep=false )
+    {
+        m_work->reset( deep );
+    }
+
+    TypedWork( const TypedWork& ) = delete;
+    TypedWork& operator=( const TypedWork& ) = delete;
+
+private:
+    /**************************
+     * cached result of the last run and the hash of its inputs
+     *************************/
+    struct Cache
+    {
+        size_t            (*hash)( const Inputs& );
+        void              (*copy)( const detail::Slot<Out>&, detail::Slot<Out>& );
+        detail::Slot<Out> output;
+        size_t            key;
+        std::uint64_t     version;
+        bool              valid;
+        bool              hit;
+
+        Cache()
+            : hash( nullptr )
+            , copy( nullptr )
+            , output()
+            , key( 0 )
+            , version( 0 )
+            , valid( false )
+            , hit( false )
+        {}
+    };
+
+private:
+    static size_t hash_inputs( const Inputs& inputs )
+    {
+        return TypedWork::hash_inputs( inputs, typename detail::MakeIndexSequence<sizeof...(In)>::type() );
+    }
+
+    template<size_t... I>
+    static size_t hash_inputs( const Inputs& inputs, detail::IndexSequence<I...> )
+    {
+        size_t seed = 0;
+        const int combine[] = { 0, ( detail::hash_combine( seed,
+                                         InputHash<typename std::decay<In>::type>()( std::get<I>( inputs ).get() ) ), 0 )... };
+        static_cast<void>( combine );
+        return seed;
+    }
+    /**************************
+     *
+     *************************/
+    void execute( const Work::Control& control )
+    {
+        execute( control, typename detail::MakeIndexSequence<sizeof...(In)>::type() );
+    }
+
+    template<size_t... I>
+    void execute( const Work::Control& control, detail::IndexSequence<I...> )
+    {
+        const bool inputs_ready[] = { true, std::get<I>( m_inputs ).has_value()... };
+        for( const bool ready : inputs_ready )
+        {
+            if ( !ready )
+            {
+                control.set_failed();
+                return;
+            }
+        }
+
+        size_t key = 0;
+        m_cache.hit = false;
+        if ( m_cache.hash != nullptr )
+        {
+            key = m_cache.hash( m_inputs );
+            m_cache.hit = m_cache.valid && m_cache.key == key;
+        }
+
+        bool completed = true;
+        try
+        {
+            if ( m_cache.hit )
+                m_cache.copy( m_cache.output, m_output );
+            else
+                detail::Invoker<Out>::invoke( m_output, m_function,
+                                              std::move( std::get<I>( m_inputs ).get() )... );
+
+            if ( m_cache.hash != nullptr && !m_cache.hit )
+            {
+                m_cache.copy( m_output, m_cache.output );
+                m_cache.key = key;
+                m_cache.valid = true;
+            }
+        }
+        catch( ... )
+        {
+            completed = false;
+        }
+
+        const int clear[] = { 0, ( std::get<I>( m_inputs ).reset(), 0 )... };
+        static_cast<void>( clear );
+
+        if ( !completed )
+        {
+            control.set_failed();
+            return;
+        }
+
+        for( size_t i = 0; i < m_consumers.size(); ++i )
+            m_consumers[i]( m_output, i + 1 == m_consumers.size() );
+
+        control.set_completed();
+    }
+
+private:
+    detail::InplaceFunction<Out(In...)> m_function;
+    Inputs                              m_inputs;
+    detail::Slot<Out>                   m_output;
+    Cache                               m_cache;
+    std::vector<Consumer>               m_consumers;
+    std::shared_ptr<Work>               m_work;
+};
+
+}
+
+#endif /* TREE_OF_WORK_DATAFLOW */
@@ -0,0 +1,876 @@
+/********************************************************************************
+ * MIT License
+ *
+ * Copyright (c) 2020 Christian Kranz
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ * 
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ * 
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ *******************************************************************************/
+#ifndef TREE_OF_WORK_DISTRIBUTED
+#define TREE_OF_WORK_DISTRIBUTED
+
+#include <algorithm>
+#include <cmath>
+#include <condition_variable>
+#include <cstdint>
+#include <cstring>
+#include <deque>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <stdexcept>
+#include <thread>
+#include <vector>
+
+#include "tree_of_work_graph.h"
+#include "tree_of_work_serialization.h"
+
+namespace TreeOfWork
+{
+/**************************
+ * Assignment of the nodes of a graph to hosts.
+ *
+ * Partition::make balances the number of nodes per host and
+ * keeps the number of cut edges (edges between hosts) small:
+ * the nodes are ordered depth first, so every subtree of a
+ * wide tree is one contiguous range, the order is split into
+ * equal ranges and each node is then moved to the host most
+ * of its parents and children are on, as long as the loads
+ * stay within the allowed imbalance.
+ *
+ *************************/
+class Partition
+{
+public:
+    using NodeId = Graph::NodeId;
+    using HostId = std::uint32_t;
+
+public:
+    /**************************
+     * an explicit assignment, hosts[i] is the host of node i
+     *************************/
+    Partition( const Graph& graph, std::vector<HostId> hosts, const HostId host_count )
+        : m_hosts( std::move( hosts ) )
+        , m_loads( std::max<HostId>( host_count, 1 ), 0 )
+        , m_cut_edges( 0 )
+    {
+        if ( m_hosts.size() != graph.size() )
+            throw std::invalid_argument( "TreeOfWork::Partition: one host per node required" );
+
+        for( NodeId node = 0; node < m_hosts.size(); ++node )
+        {
+            if ( m_hosts[node] >= m_loads.size() )
+                throw std::invalid_argument( "TreeOfWork::Partition: invalid host" );
+            m_loads[m_hosts[node]]++;
+
+            for( const NodeId* c = graph.children_begin( node ); c != graph.children_end( node ); ++c )
+            {
+                if ( m_hosts[*c] != m_hosts[node] )
+                    m_cut_edges++;
+            }
+        }
+    }
+    /**************************
+     * partitions graph into host_count parts whose sizes differ
+     * from the average by at most the factor imbalance
+     *************************/
+    static Partition make( const Graph& graph, const HostId host_count, const double imbalance = 0.05 )
+    {
+        const NodeId node_count = static_cast<NodeId>( graph.size() );
+        const HostId hosts = std::max<HostId>( host_count, 1 );
+
+        // depth first topological order, children in their given order
+        std::vector<NodeId> pending( node_count );
+        std::vector<NodeId> stack;
+        for( NodeId i = node_count; i-- > 0; )
+        {
+            pending[i] = graph.parent_count( i );
+            if ( pending[i] == 0 )
+                stack.push_back( i );
+        }
+        std::vector<NodeId> order;
+        order.reserve( node_count );
+        while( !stack.empty() )
+        {
+            const NodeId node = stack.back();
+            stack.pop_back();
+            order.push_back( node );
+            for( const NodeId* c = graph.children_end( node ); c-- != graph.children_begin( node ); )
+            {
+                if ( --pending[*c] == 0 )
+                    stack.push_back( *c );
+            }
+        }
+
+        std::vector<HostId> assignment( node_count );
+        std::vector<size_t> loads( hosts, 0 );
+        for( size_t k = 0; k < order.size(); ++k )
+        {
+            const HostId host = static_cast<HostId>( std::uint64_t( k ) * hosts / node_count );
+            assignment[order[k]] = host;
+            loads[host]++;
+        }
+
+        // refinement: parents in CSR layout as well
+        std::vector<NodeId> parent_offsets( size_t( node_count ) + 1, 0 );
+        for( NodeId node = 0; node < node_count; ++node )
+            parent_offsets[node + 1] = parent_offsets[node] + graph.parent_count( node );
+        std::vector<NodeId> parents( parent_offsets.back() );
+        std::vector<NodeId> fill( parent_offsets.begin(), parent_offsets.end() - 1 );
+        for( NodeId node = 0; node < node_count; ++node )
+        {
+            for( const NodeId* c = graph.children_begin( node ); c != graph.children_end( node ); ++c )
+                parents[fill[*c]++] = node;
+        }
+
+        const double average = double( node_count ) / hosts;
+        const size_t upper = static_cast<size_t>( std::ceil( average * ( 1.0 + imbalance ) ) );
+        const size_t lower = static_cast<size_t>( std::floor( average * ( 1.0 - imbalance ) ) );
+        std::vector<size_t> votes( hosts, 0 );
+        std::vector<HostId> voted;
+        for( int pass = 0; pass < 2; ++pass )
+        {
+            for( const NodeId node : order )
+            {
+                voted.clear();
+                for( NodeId i = parent_offsets[node]; i < parent_offsets[node + 1]; ++i )
+                {
+                    if ( votes[assignment[parents[i]]]++ == 0 )
+                        voted.push_back( assignment[parents[i]] );
+                }
+                for( const NodeId* c = graph.children_begin( node ); c != graph.children_end( node ); ++c )
+                {
+                    if ( votes[assignment[*c]]++ == 0 )
+                        voted.push_back( assignment[*c] );
+                }
+
+                const HostId current = assignment[node];
+                HostId best = current;
+                for( const HostId host : voted )
+                {
+                    if ( votes[host] > votes[best] && loads[host] < upper )
+                        best = host;
+                }
+                for( const HostId host : voted )
+                    votes[host] = 0;
+
+                if ( best != current && loads[current] > lower )
+                {
+                    loads[current]--;
+                    loads[best]++;
+                    assignment[node] = best;
+                }
+            }
+        }
+
+        return Partition( graph, std::move( assignment ), hosts );
+    }
+    /**************************
+     *
+     *************************/
+    HostId host_count() const
+    {
+        return static_cast<HostId>( m_loads.size() );
+    }
+
+    HostId host_of( const NodeId node ) const
+    {
+        return m_hosts[node];
+    }
+    /**************************
+     * number of nodes on host
+     *************************/
+    size_t load( const HostId host ) const
+    {
+        return m_loads[host];
+    }
+    /**************************
+     * number of edges whose parent and child are on different hosts
+     *************************/
+    size_t cut_edges() const
+    {
+        return m_cut_edges;
+    }
+
+private:
+    std::vector<HostId> m_hosts;
+    std::vector<size_t> m_loads;
+    size_t              m_cut_edges;
+};
+
+/**************************
+ * Delivers messages between the hosts of a distributed graph.
+ *
+ * A transport is one endpoint: send() hands a message to the
+ * endpoint of another host, messages between two endpoints
+ * have to arrive in the order they were sent. The receiver
+ * is called for every incoming message, it only copies the
+ * message and never blocks.
+ *
+ *************************/
+class Transport
+{
+public:
+    using HostId   = Partition::HostId;
+    using Receiver = std::function<void(const char* data, size_t size)>;
+
+public:
+    virtual ~Transport()
+    {}
+    /**************************
+     * may be called concurrently
+     *************************/
+    virtual void send( HostId host, const char* data, size_t size ) = 0;
+    /**************************
+     * receiver gets all messages sent to this endpoint; an
+     * empty receiver stops the delivery, no call of the old
+     * receiver is in progress once listen returns
+     *************************/
+    virtual void listen( Receiver receiver ) = 0;
+};
+
+/**************************
+ * In process transport between any number of hosts, e.g. for
+ * tests or for partitions on NUMA nodes of one machine.
+ * Messages are copied and delivered by one thread; messages
+ * to an endpoint which does not listen yet are kept for it.
+ * The network has to outlive its endpoints.
+ *
+ *************************/
+class LoopbackNetwork
+{
+public:
+    using HostId = Partition::HostId;
+
+public:
+    explicit LoopbackNetwork( const HostId host_count )
+        : m_mutex()
+        , m_wakeup()
+        , m_idle()
+        , m_queue()
+        , m_parked( host_count )
+        , m_receivers( host_count )
+        , m_delivering( LoopbackNetwork::NoHost )
+        , m_messages( 0 )
+        , m_bytes( 0 )
+        , m_stop( false )
+        , m_thread()
+    {
+        m_thread = std::thread( &LoopbackNetwork::run, this );
+    }
+    /**************************
+     * messages not delivered yet are dropped
+     *************************/
+    ~LoopbackNetwork()
+    {
+        {
+            std::lock_guard<std::mutex> lock( m_mutex );
+            m_stop = true;
+        }
+        m_wakeup.notify_all();
+        m_thread.join();
+    }
+    /**************************
+     * the transport of host
+     *************************/
+    std::shared_ptr<Transport> endpoint( const HostId host )
+    {
+        return std::make_shared<LoopbackNetwork::Endpoint>( this, host );
+    }
+    /**************************
+     * number and total size of the messages sent so far
+     *************************/
+    size_t messages() const
+    {
+        std::lock_guard<std::mutex> lock( m_mutex );
+        return m_messages;
+    }
+
+    size_t bytes() const
+    {
+        std::lock_guard<std::mutex> lock( m_mutex );
+        return m_bytes;
+    }
+
+    LoopbackNetwork( const LoopbackNetwork& ) = delete;
+    LoopbackNetwork& operator=( const LoopbackNetwork& ) = delete;
+
+private:
+    static const HostId NoHost = ~HostId( 0 );
+
+    class Endpoint : public Transport
+    {
+    public:
+        Endpoint( LoopbackNetwork* network, const HostId host )
+            : m_network( network )
+            , m_host( host )
+        {}
+
+        void send( HostId host, const char* data, size_t size ) override
+        {
+            m_network->post( host, data, size );
+        }
+
+        void listen( Transport::Receiver receiver ) override
+        {
+            m_network->listen( m_host, std::move( receiver ) );
+        }
+
+    private:
+        LoopbackNetwork* m_network;
+        HostId           m_host;
+    };
+
+    struct Message
+    {
+        HostId            host;
+        std::vector<char> data;
+    };
+
+private:
+    void post( const HostId host, const char* data, const size_t size )
+    {
+        {
+            std::lock_guard<std::mutex> lock( m_mutex );
+            m_messages++;
+            m_bytes += size;
+
+            LoopbackNetwork::Message message = { host, std::vector<char>( data, data + size ) };
+            if ( !m_receivers[host] )
+            {
+                m_parked[host].push_back( std::move( message ) );
+                return;
+            }
+            m_queue.push_back( std::move( message ) );
+        }
+        m_wakeup.notify_one();
+    }
+
+    void listen( const HostId host, Transport::Receiver receiver )
+    {
+        {
+            std::unique_lock<std::mutex> lock( m_mutex );
+            if ( std::this_thread::get_id() != m_thread.get_id() )
+                m_idle.wait( lock, [this, host]{ return m_delivering != host; } );
+
+            m_receivers[host] = std::move( receiver );
+            if ( !m_receivers[host] )
+                return;
+
+            for( LoopbackNetwork::Message& message : m_parked[host] )
+                m_queue.push_back( std::move( message ) );
+            m_parked[host].clear();
+        }
+        m_wakeup.notify_one();
+    }
+    /**************************
+     * the receiver of a host is not replaced while it is called
+     *************************/
+    void run()
+    {
+        std::unique_lock<std::mutex> lock( m_mutex );
+        for( ;; )
+        {
+            m_wakeup.wait( lock, [this]{ return m_stop || !m_queue.empty(); } );
+            if ( m_stop )
+                return;
+
+            LoopbackNetwork::Message message = std::move( m_queue.front() );
+            m_queue.pop_front();
+            if ( !m_receivers[message.host] )
+            {
+                m_parked[message.host].push_back( std::move( message ) );
+                continue;
+            }
+
+            m_delivering = message.host;
+            const Transport::Receiver& receiver = m_receivers[message.host];
+            lock.unlock();
+            receiver( message.data.data(), message.data.size() );
+            lock.lock();
+            m_delivering = LoopbackNetwork::NoHost;
+            m_idle.notify_all();
+        }
+    }
+
+private:
+    mutable std::mutex                                m_mutex;
+    std::condition_variable                           m_wakeup;
+    std::condition_variable                           m_idle;
+    std::deque<LoopbackNetwork::Message>              m_queue;
+    std::vector<std::deque<LoopbackNetwork::Message>> m_parked;
+    std::vector<Transport::Receiver>                  m_receivers;
+    HostId                                            m_delivering;
+    size_t                                            m_messages;
+    size_t                                            m_bytes;
+    bool                                              m_stop;
+    std::thread                                       m_thread;
+};
+
+/**************************
+ * The part of a graph which runs on one host.
+ *
+ * Every host builds its DistributedGraph from the same
+ * topology (e.g. loaded with GraphFile) and Partition, and
+ * binds the workers of its nodes by name from a registry.
+ * Remote parents of local nodes are represented by stand in
+ * nodes which do not run a worker; they complete when the
+ * completion message of the remote node arrives. A local node
+ * with children on other hosts (a boundary node) sends one
+ * message per such host when it is done:
+ *   run number, node, final state and an optional payload
+ *   (e.g. its serialized output, @see set_payload)
+ * Nodes without remote children run exactly as in a Graph.
+ *
+ * Every host calls run() once per run of the whole graph; a
+ * host is done with a run once its local nodes are done.
+ * Messages of a run the host has not started yet are kept.
+ *
+ * Workers reach the DistributedGraph with
+ * DistributedGraph::of( control ); control.index() is the
+ * local id of the node (@see global_id).
+ *
+ *************************/
+class DistributedGraph
+{
+public:
+    using NodeId = Graph::NodeId;
+    using HostId = Partition::HostId;
+
+public:
+    DistributedGraph( const Graph& topology, const Partition& partition, const HostId host,
+                      const WorkerRegistry& registry, std::shared_ptr<Transport> transport )
+        : m_host( host )
+        , m_local_of( topology.size(), NodeId( Graph::NoNode ) )
+        , m_global()
+        , m_boundary_of()
+        , m_remote_hosts()
+        , m_payloads()
+        , m_ghost_of( topology.size(), NodeId( Graph::NoNode ) )
+        , m_ghosts()
+        , m_local()
+        , m_run()
+        , m_transport( std::move( transport ) )
+        , m_mutex()
+        , m_executor( nullptr )
+        , m_run_id( 0 )
+    {
+        build( topology, partition, registry );
+        m_transport->listen( [this](const char* data, size_t size){ receive( data, size ); } );
+    }
+    /**************************
+     * waits for a run in progress
+     *************************/
+    ~DistributedGraph()
+    {
+        m_run->wait_for_done();
+        m_transport->listen( Transport::Receiver() );
+    }
+    /**************************
+     * @see Graph::run
+     *************************/
+    void run( std::shared_ptr<Executor> executor = Executor::default_executor() )
+    {
+        prepare( executor );
+        m_run->start( std::move( executor ) );
+    }
+    /**************************
+     * @see Graph::run_until, stand ins of remote nodes fail at
+     * the deadline as well
+     *************************/
+    void run_until( detail::TimerService::Clock::time_point deadline,
+                    std::shared_ptr<Executor> executor = Executor::default_executor() )
+    {
+        prepare( executor );
+        m_run->start_until( deadline, std::move( executor ) );
+    }
+    /**************************
+     * cancels the local nodes, stand ins still waiting for a
+     * remote node are cancelled as well; remote children of
+     * cancelled boundary nodes are cancelled by their message
+     *************************/
+    void cancel()
+    {
+        m_run->cancel();
+
+        std::vector<Work::Control> waiting;
+        {
+            std::lock_guard<std::mutex> lock( m_mutex );
+            for( DistributedGraph::Ghost& ghost : m_ghosts )
+            {
+                if ( !ghost.armed )
+                    continue;
+                ghost.armed = false;
+                waiting.push_back( ghost.control );
+            }
+        }
+        for( const Work::Control& control : waiting )
+            control.release( Work::State::Cancelled );
+    }
+
+    void wait_for_done()
+    {
+        m_run->wait_for_done();
+    }
+
+    template<typename Rep, typename Period>
+    bool wait_for_done( const std::chrono::duration<Rep, Period>& timeout )
+    {
+        return m_run->wait_for_done( timeout );
+    }
+
+    template<typename Clock, typename Duration>
+    bool wait_until( const std::chrono::time_point<Clock, Duration>& deadline )
+    {
+        return m_run->wait_until( deadline );
+    }
+
+    bool try_is_done()
+    {
+        return m_run->try_is_done();
+    }
+    /**************************
+     * state of a node in the current run, nodes which are
+     * neither local nor a parent of a local node are Created
+     *************************/
+    Work::State get_state( const NodeId node ) const
+    {
+        const NodeId local = m_local_of[node] != Graph::NoNode ? m_local_of[node] : m_ghost_of[node];
+        return local != Graph::NoNode ? m_run->get_state( local ) : Work::State::Created;
+    }
+    /**************************
+     * the DistributedGraph a worker runs in
+     *************************/
+    static DistributedGraph& of( const Work::Control& control )
+    {
+        return *static_cast<DistributedGraph*>( GraphRun::of( control ).data() );
+    }
+    /**************************
+     * global id of a local node
+     *************************/
+    NodeId global_id( const NodeId local ) const
+    {
+        return m_global[local];
+    }
+    /**************************
+     * true if node runs on this host
+     *************************/
+    bool is_local( const NodeId node ) const
+    {
+        return m_local_of[node] != Graph::NoNode;
+    }
+    /**************************
+     * output of the node of control for its children, sent
+     * with the completion message to remote children
+     *************************/
+    void set_payload( const Work::Control& control, std::vector<char> payload )
+    {
+        m_payloads[control.index()] = std::move( payload );
+    }
+    /**************************
+     * payload of parent in the current run, parent is local or
+     * a remote parent of a local node; valid once it is done
+     *************************/
+    const std::vector<char>& payload( const NodeId parent ) const
+    {
+        if ( m_local_of.at( parent ) != Graph::NoNode )
+            return m_payloads[m_local_of[parent]];
+        return m_ghosts.at( m_ghost_of.at( parent ) - m_global.size() ).payload;
+    }
+    /**************************
+     * the compiled local part: local nodes first (in global
+     * order), then the stand ins of remote parents
+     *************************/
+    const Graph& local_graph() const
+    {
+        return *m_local;
+    }
+
+    DistributedGraph( const DistributedGraph& ) = delete;
+    DistributedGraph& operator=( const DistributedGraph& ) = delete;
+
+private:
+    /**************************
+     * message layout: run, node, state, payload size, payload
+     *************************/
+    static const size_t HeaderSize = 3 * sizeof(std::uint32_t) + 1;
+
+    struct Arrival
+    {
+        std::uint32_t     run;
+        Work::State       state;
+        std::vector<char> payload;
+    };
+    struct Ghost
+    {
+        Work::Control                         control;
+        bool                                  armed;
+        Work::State                           state;
+        std::deque<DistributedGraph::Arrival> arrivals;
+        std::vector<char>                     payload;
+    };
+
+private:
+    /**************************
+     * a new run number, stand ins and payloads of the last run
+     * are dropped
+     *************************/
+    void prepare( const std::shared_ptr<Executor>& executor )
+    {
+        m_run->wait_for_done();
+        {
+            std::lock_guard<std::mutex> lock( m_mutex );
+            m_run_id++;
+            m_executor = executor.get();
+            for( DistributedGraph::Ghost& ghost : m_ghosts )
+            {
+                ghost.armed = false;
+                ghost.payload.clear();
+            }
+        }
+        for( std::vector<char>& payload : m_payloads )
+            payload.clear();
+    }
+
+    void build( const Graph& topology, const Partition& partition, const WorkerRegistry& registry )
+    {
+        const NodeId node_count = static_cast<NodeId>( topology.size() );
+        for( NodeId node = 0; node < node_count; ++node )
+        {
+            if ( partition.host_of( node ) != m_host )
+                continue;
+            m_local_of[node] = static_cast<NodeId>( m_global.size() );
+            m_global.push_back( node );
+        }
+
+        // remote parents of local nodes get stand ins after the local nodes
+        std::vector<NodeId> ghosts;
+        for( NodeId node = 0; node < node_count; ++node )
+        {
+            if ( partition.host_of( node ) == m_host )
+                continue;
+            for( const NodeId* c = topology.children_begin( node ); c != topology.children_end( node ); ++c )
+            {
+                if ( m_local_of[*c] != Graph::NoNode && m_ghost_of[node] == Graph::NoNode )
+                {
+                    m_ghost_of[node] = static_cast<NodeId>( m_global.size() + ghosts.size() );
+                    ghosts.push_back( node );
+                }
+            }
+        }
+
+        GraphBuilder builder;
+        m_payloads.resize( m_global.size() );
+        m_boundary_of.assign( m_global.size(), NodeId( Graph::NoNode ) );
+        for( NodeId local = 0; local < m_global.size(); ++local )
+        {
+            const NodeId node = m_global[local];
+            const std::string name = topology.name( node );
+            if ( !registry.contains( name ) )
+                throw std::invalid_argument( "TreeOfWork::DistributedGraph: no worker registered for node " +
+                                             std::to_string( node ) + " '" + name + "'" );
+
+            std::vector<HostId> hosts;
+            for( const NodeId* c = topology.children_begin( node ); c != topology.children_end( node ); ++c )
+            {
+                const HostId host = partition.host_of( *c );
+                if ( host != m_host && std::find( hosts.begin(), hosts.end(), host ) == hosts.end() )
+                    hosts.push_back( host );
+            }
+
+            if ( !hosts.empty() )
+            {
+                m_boundary_of[local] = static_cast<NodeId>( m_remote_hosts.size() );
+                m_remote_hosts.push_back( std::move( hosts ) );
+            }
+
+            builder.add( registry.make( name ) );
+            builder.set_priority( local, topology.priority( node ) );
+            builder.set_affinity( local, topology.affinity( node ) );
+            builder.set_timeout( local, topology.timeout( node ) );
+            for( const ResourceClaim* claim = topology.claims_begin( node ); claim != topology.claims_end( node ); ++claim )
+                builder.require( local, claim->pool, claim->count );
+        }
+
+        m_ghosts.resize( ghosts.size(), DistributedGraph::Ghost{ Work::Control( nullptr, 0, nullptr ), false,
+                                                                  Work::State::Created, {}, {} } );
+        for( NodeId g = 0; g < ghosts.size(); ++g )
+        {
+            builder.add( [g](const Work::Control& control)
+                         {
+                             DistributedGraph::of( control ).arm_ghost( g, control );
+                         } );
+        }
+
+        // edges into local nodes
+        for( NodeId node = 0; node < node_count; ++node )
+        {
+            const NodeId parent = m_local_of[node] != Graph::NoNode ? m_local_of[node] : m_ghost_of[node];
+            if ( parent == Graph::NoNode )
+                continue;
+            for( const NodeId* c = topology.children_begin( node ); c != topology.children_end( node ); ++c )
+            {
+                if ( m_local_of[*c] != Graph::NoNode )
+                    builder.connect( { parent }, { m_local_of[*c] }, topology.trigger_condition( *c ) );
+            }
+        }
+
+        m_local = builder.compile();
+        m_run.reset( new GraphRun( m_local, this ) );
+        m_run->on_settled( &DistributedGraph::settled );
+    }
+    /**************************
+     * GraphRun::SettledFunc: boundary nodes tell their remote
+     * children about their final state, also if they did not
+     * run or missed their deadline
+     *************************/
+    static void settled( void* data, const NodeId local, const Work::State state )
+    {
+        DistributedGraph& graph = *static_cast<DistributedGraph*>( data );
+        if ( local < graph.m_boundary_of.size() )
+        {
+            if ( graph.m_boundary_of[local] != Graph::NoNode )
+                graph.send( local, state );
+            return;
+        }
+
+        // a stand in failed by the deadline of the run does not wait for its message
+        DistributedGraph::Ghost& ghost = graph.m_ghosts[local - graph.m_boundary_of.size()];
+        {
+            std::lock_guard<std::mutex> lock( graph.m_mutex );
+            if ( !ghost.armed )
+                return;
+            ghost.armed = false;
+        }
+        ghost.control.release( state );
+    }
+    /**************************
+     * completion message of a boundary node to its remote hosts,
+     * only a completed node has a payload (the worker of an
+     * expired node may still write it)
+     *************************/
+    void send( const NodeId local, const Work::State result )
+    {
+        static const std::vector<char> none;
+        const std::vector<char>& payload = result == Work::State::Completed ? m_payloads[local] : none;
+
+        std::vector<char> message( DistributedGraph::HeaderSize + payload.size() );
+        const std::uint32_t header[3] = { m_run_id, m_global[local], static_cast<std::uint32_t>( payload.size() ) };
+        std::memcpy( message.data(), header, 2 * sizeof(std::uint32_t) );
+        message[2 * sizeof(std::uint32_t)] = static_cast<char>( result );
+        std::memcpy( message.data() + 2 * sizeof(std::uint32_t) + 1, &header[2], sizeof(std::uint32_t) );
+        if ( !payload.empty() )
+            std::memcpy( message.data() + DistributedGraph::HeaderSize, payload.data(), payload.size() );
+
+        for( const HostId host : m_remote_hosts[m_boundary_of[local]] )
+            m_transport->send( host, message.data(), message.size() );
+    }
+    /**************************
+     * worker of a stand in: completes with the message of the
+     * remote node, right away if it arrived already
+     *************************/
+    void arm_ghost( const NodeId g, const Work::Control& control )
+    {
+        DistributedGraph::Ghost& ghost = m_ghosts[g];
+        Work::State state = Work::State::Created;
+        {
+            std::lock_guard<std::mutex> lock( m_mutex );
+            while( !ghost.arrivals.empty() && ghost.arrivals.front().run < m_run_id )
+                ghost.arrivals.pop_front();
+
+            if ( ghost.arrivals.empty() || ghost.arrivals.front().run != m_run_id )
+            {
+                ghost.control = control;
+                ghost.armed = true;
+                return;
+            }
+            state = ghost.arrivals.front().state;
+            ghost.payload = std::move( ghost.arrivals.front().payload );
+            ghost.arrivals.pop_front();
+        }
+        control.release( state );
+    }
+    /**************************
+     * transport receiver: stores the message, an armed stand in
+     * is completed on the executor, not on the transport thread
+     *************************/
+    void receive( const char* data, const size_t size )
+    {
+        if ( size < DistributedGraph::HeaderSize )
+            return;
+
+        std::uint32_t header[3];
+        std::memcpy( header, data, 2 * sizeof(std::uint32_t) );
+        std::memcpy( &header[2], data + 2 * sizeof(std::uint32_t) + 1, sizeof(std::uint32_t) );
+        const std::uint32_t run = header[0];
+        const NodeId node = header[1];
+        const std::uint8_t state = static_cast<std::uint8_t>( data[2 * sizeof(std::uint32_t)] );
+        if ( node >= m_ghost_of.size() || m_ghost_of[node] == Graph::NoNode ||
+             state > static_cast<std::uint8_t>( Work::State::Cancelled ) ||
+             size - DistributedGraph::HeaderSize != header[2] )
+            return;
+
+        const NodeId g = m_ghost_of[node] - static_cast<NodeId>( m_global.size() );
+        DistributedGraph::Ghost& ghost = m_ghosts[g];
+        const char* payload = data + DistributedGraph::HeaderSize;
+
+        // taken under the lock, the task does not touch the stand in
+        Executor* executor = nullptr;
+        Work::Control control( nullptr, 0, nullptr );
+        Work::State result = Work::State::Completed;
+        {
+            std::lock_guard<std::mutex> lock( m_mutex );
+            if ( !ghost.armed || run != m_run_id )
+            {
+                ghost.arrivals.push_back( { run, static_cast<Work::State>( state ),
+                                            std::vector<char>( payload, payload + header[2] ) } );
+                return;
+            }
+            ghost.armed = false;
+            ghost.state = static_cast<Work::State>( state );
+            ghost.payload.assign( payload, payload + header[2] );
+            executor = m_executor;
+            control = ghost.control;
+            result = ghost.state;
+        }
+        executor->submit( [control, result]
+                          {
+                              control.release( result );
+                          } );
+    }
+
+private:
+    const HostId                             m_host;
+    std::vector<NodeId>                      m_local_of;
+    std::vector<NodeId>                      m_global;
+    std::vector<NodeId>                      m_boundary_of;
+    std::vector<std::vector<HostId>>         m_remote_hosts;
+    std::vector<std::vector<char>>           m_payloads;
+    std::vector<NodeId>                      m_ghost_of;
+    std::vector<DistributedGraph::Ghost>     m_ghosts;
+    std::shared_ptr<Graph>                   m_local;
+    std::unique_ptr<GraphRun>                m_run;
+    std::shared_ptr<Transport>               m_transport;
+    std::mutex                               m_mutex;
+    Executor*                                m_executor;
+    std::uint32_t                            m_run_id;
+};
+
+}
+
+#endif /* TREE_OF_WORK_DISTRIBUTED */
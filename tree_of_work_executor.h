@@ -0,0 +1,906 @@
+/********************************************************************************
+ * MIT License
+ *
+ * Copyright (c) 2020 Christian Kranz
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ *******************************************************************************/
+#ifndef TREE_OF_WORK_EXECUTOR
+#define TREE_OF_WORK_EXECUTOR
+
+#include <functional>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <memory>
+#include <vector>
+#include <deque>
+#include <atomic>
+#include <algorithm>
+#include <cstdint>
+
+#include "tree_of_work_function.h"
+#include "tree_of_work_affinity.h"
+#include "tree_of_work_metrics.h"
+
+namespace TreeOfWork
+{
+/**************************
+ * An Executor decides where and when the worker function
+ * of a node is run, once the node has been triggered.
+ *
+ * Work only hands a task to submit(); the executor owns
+ * the threads. Tasks are move only and store small callables
+ * inline, so submitting a node does not allocate.
+ *
+ *************************/
+class Executor
+{
+public:
+    using Task = detail::InplaceFunction<void(void)>;
+
+public:
+    Executor()
+        : m_continuation_depth( 0 )
+#ifdef TREE_OF_WORK_COLLECT_METRICS
+        , m_metrics()
+#endif
+    {}
+    virtual ~Executor()
+    {}
+    /**************************
+     * schedule the task for execution
+     *************************/
+    virtual void submit( Task task ) = 0;
+    /**************************
+     * schedule the task with a priority, higher priorities
+     * are meant to run first (@see PriorityExecutor)
+     * executors without a notion of priority ignore it
+     *************************/
+    virtual void submit( Task task, int priority )
+    {
+        static_cast<void>( priority );
+        submit( std::move( task ) );
+    }
+    /**************************
+     * schedule the task with a priority and a placement hint
+     * (@see Affinity, WorkStealingExecutor)
+     * executors without a notion of placement ignore the hint
+     *************************/
+    virtual void submit( Task task, int priority, Affinity affinity )
+    {
+        static_cast<void>( affinity );
+        submit( std::move( task ), priority );
+    }
+    /**************************
+     * capacity hint: this many tasks may be queued at the
+     * same time (e.g. the width of a Graph); executors with
+     * growable queues preallocate them, others ignore it
+     *************************/
+    virtual void reserve( size_t tasks )
+    {
+        static_cast<void>( tasks );
+    }
+    /**************************
+     * continuation mode:
+     *   a node which finishes and readies a child on the same
+     *   executor runs that child directly on its own thread
+     *   instead of submitting it (all further ready children
+     *   are submitted as usual).
+     *   depth bounds the number of nested continuations per
+     *   thread to keep the stack small, 0 disables the mode
+     *   (default)
+     *************************/
+    void set_continuation_depth( size_t depth )
+    {
+        m_continuation_depth.store( depth, std::memory_order_relaxed );
+    }
+    size_t continuation_depth() const
+    {
+        return m_continuation_depth.load( std::memory_order_relaxed );
+    }
+    /**************************
+     * runs task as continuation if the depth bound allows it,
+     * returns false (and does nothing) otherwise
+     *************************/
+    template<typename F>
+    bool run_as_continuation( F&& task )
+    {
+        struct Nesting
+        {
+            explicit Nesting( size_t& d ) : depth( d ) { ++depth; }
+            ~Nesting() { --depth; }
+            size_t& depth;
+        };
+
+        size_t& depth = Executor::nesting();
+        if ( depth >= continuation_depth() )
+            return false;
+
+        Nesting nesting( depth );
+        task();
+        return true;
+    }
+
+#ifdef TREE_OF_WORK_COLLECT_METRICS
+    /**************************
+     * task counts, steals, queue depth and utilization
+     * (ThreadPerTaskExecutor is not instrumented)
+     *************************/
+    ExecutorMetrics& metrics()
+    {
+        return m_metrics;
+    }
+#endif
+
+public:
+    /**************************
+     * the executor used by all nodes which were not
+     * assigned another one (a fixed size, work stealing pool)
+     *************************/
+    static std::shared_ptr<Executor> default_executor();
+
+protected:
+    /**************************
+     * runs a task on a thread of the executor and destroys it:
+     * its captures may hold the last reference to the executor
+     * (@see join_threads)
+     *************************/
+    void run_task( Task& task )
+    {
+#ifdef TREE_OF_WORK_COLLECT_METRICS
+        m_metrics.started();
+        const std::int64_t start = detail::metric_clock_ns();
+        task();
+        task = Task();
+        if ( !Executor::orphaned() )
+            m_metrics.executed( detail::metric_clock_ns() - start );
+#else
+        task();
+        task = Task();
+#endif
+    }
+    /**************************
+     * true if the calling thread is one of threads
+     *************************/
+    static bool is_own_thread( const std::vector<std::thread>& threads )
+    {
+        for( const std::thread& t : threads )
+        {
+            if ( t.get_id() == std::this_thread::get_id() )
+                return true;
+        }
+        return false;
+    }
+    /**************************
+     * joins the threads of a stopped executor
+     *
+     * the last reference to an executor may be dropped by a task
+     * it runs (e.g. a node which owns itself until it is done),
+     * so the destructor may run on a thread of its own: that
+     * thread works off the remaining tasks first, is detached
+     * here instead of joined and leaves its loop without touching
+     * the executor once the task returned (@see orphaned)
+     *************************/
+    static void join_threads( std::vector<std::thread>& threads )
+    {
+        for( std::thread& t : threads )
+        {
+            if ( !t.joinable() )
+                continue;
+            if ( t.get_id() != std::this_thread::get_id() )
+            {
+                t.join();
+                continue;
+            }
+            t.detach();
+            Executor::orphaned() = true;
+        }
+    }
+    /**************************
+     * true on a thread whose executor was destroyed by the
+     * task the thread runs (@see join_threads)
+     *************************/
+    static bool& orphaned()
+    {
+        static thread_local bool orphan = false;
+        return orphan;
+    }
+
+private:
+    /**************************
+     * continuations currently nested on this thread
+     *************************/
+    static size_t& nesting()
+    {
+        static thread_local size_t depth = 0;
+        return depth;
+    }
+
+private:
+    std::atomic<size_t> m_continuation_depth;
+#ifdef TREE_OF_WORK_COLLECT_METRICS
+    ExecutorMetrics     m_metrics;
+#endif
+};
+
+/**************************
+ * Executes each task on a new, detached thread.
+ * This is the classic Tree of Work behavior and is
+ * useful for long running, blocking workers.
+ *
+ *************************/
+class ThreadPerTaskExecutor : public Executor
+{
+public:
+    using Executor::submit;
+
+    void submit( Task task ) override
+    {
+        std::thread t = std::thread( std::move( task ) );
+        t.detach();
+    }
+};
+
+/**************************
+ * Executes tasks on a fixed number of threads which are
+ * started once and fed through a shared queue.
+ * Launching a node is a queue push.
+ *
+ * Pending tasks are finished before the pool is destroyed.
+ *
+ *************************/
+class ThreadPoolExecutor : public Executor
+{
+public:
+    using Executor::submit;
+
+public:
+    /**************************
+     * thread_count == 0 selects the number of hardware threads
+     *************************/
+    explicit ThreadPoolExecutor( size_t thread_count = 0 )
+        : m_mutex()
+        , m_wakeup()
+        , m_tasks()
+        , m_threads()
+        , m_stop( false )
+    {
+        if ( thread_count == 0 )
+            thread_count = std::thread::hardware_concurrency();
+        if ( thread_count == 0 )
+            thread_count = 1;
+
+        TREE_OF_WORK_METRIC( metrics().set_threads( thread_count ); )
+        m_threads.reserve( thread_count );
+        for( size_t i = 0; i < thread_count; ++i )
+            m_threads.emplace_back( &ThreadPoolExecutor::run, this );
+    }
+    /**************************
+     *
+     *************************/
+    ~ThreadPoolExecutor() override
+    {
+        {
+            std::lock_guard<std::mutex> lock( m_mutex );
+            m_stop = true;
+        }
+        m_wakeup.notify_all();
+
+        // destroyed by a task of its own (@see Executor::join_threads)
+        if ( Executor::is_own_thread( m_threads ) )
+            run();
+        Executor::join_threads( m_threads );
+    }
+    /**************************
+     *
+     *************************/
+    void submit( Task task ) override
+    {
+        TREE_OF_WORK_METRIC( metrics().submitted(); )
+        {
+            std::lock_guard<std::mutex> lock( m_mutex );
+            m_tasks.push_back( std::move( task ) );
+        }
+        m_wakeup.notify_one();
+    }
+    /**************************
+     * number of worker threads
+     *************************/
+    size_t size() const
+    {
+        return m_threads.size();
+    }
+
+    ThreadPoolExecutor( const ThreadPoolExecutor& ) = delete;
+    ThreadPoolExecutor& operator=( const ThreadPoolExecutor& ) = delete;
+
+private:
+    /**************************
+     * worker thread loop
+     *************************/
+    void run()
+    {
+        for( ;; )
+        {
+            Task task;
+            {
+                std::unique_lock<std::mutex> lock( m_mutex );
+                m_wakeup.wait( lock, [this]{ return m_stop || !m_tasks.empty(); } );
+
+                if ( m_tasks.empty() )
+                    return;
+
+                task = std::move( m_tasks.front() );
+                m_tasks.pop_front();
+            }
+            run_task( task );
+            if ( Executor::orphaned() )
+                return;
+        }
+    }
+
+private:
+    std::mutex               m_mutex;
+    std::condition_variable  m_wakeup;
+    std::deque<Task>         m_tasks;
+    std::vector<std::thread> m_threads;
+    bool                     m_stop;
+};
+
+/**************************
+ * Executes tasks on a fixed number of threads where each
+ * thread owns a local deque of tasks.
+ *
+ * Tasks submitted from one of the worker threads (e.g. the
+ * children triggered in Work::done) are pushed onto the local
+ * deque of that thread and popped LIFO, so the most recently
+ * readied child runs next on the same thread while its parent's
+ * data is still hot in cache.
+ * Idle threads steal the oldest tasks from the other deques.
+ *
+ * Tasks submitted from outside the pool are distributed
+ * round robin over the worker deques.
+ *
+ * Workers can be pinned to CPUs; tasks with an Affinity hint
+ * are kept apart from the stealable deque:
+ *   worker / same_as_parent - a per worker deque nobody steals from
+ *   numa_node               - a per worker deque only workers on
+ *                             the same NUMA node steal from
+ *
+ *************************/
+class WorkStealingExecutor : public Executor
+{
+public:
+    using Executor::submit;
+
+public:
+    /**************************
+     * thread_count == 0 selects the number of hardware threads,
+     * the threads are not pinned
+     *************************/
+    explicit WorkStealingExecutor( size_t thread_count = 0 )
+        : WorkStealingExecutor( std::vector<int>( WorkStealingExecutor::thread_count( thread_count ), -1 ) )
+    {}
+    /**************************
+     * one worker per entry of cpus, pinned to that CPU
+     * (-1 leaves a worker unpinned),
+     * e.g. WorkStealingExecutor( Topology::cpus() )
+     *************************/
+    explicit WorkStealingExecutor( const std::vector<int>& cpus )
+        : m_workers()
+        , m_threads()
+        , m_node_workers()
+        , m_sleep_mutex()
+        , m_wakeup()
+        , m_pending( 0 )
+        , m_sleeping( 0 )
+        , m_next( 0 )
+        , m_stop( false )
+    {
+        const size_t count = cpus.empty() ? 1 : cpus.size();
+
+        m_workers.reserve( count );
+        for( size_t i = 0; i < count; ++i )
+        {
+            const int cpu = cpus.empty() ? -1 : cpus[i];
+            m_workers.emplace_back( new WorkStealingExecutor::Worker( cpu, cpu < 0 ? -1 : Topology::numa_node_of( cpu ) ) );
+
+            const int node = m_workers.back()->node;
+            if ( node < 0 )
+                continue;
+            if ( m_node_workers.size() <= static_cast<size_t>( node ) )
+                m_node_workers.resize( node + 1 );
+            m_node_workers[node].push_back( i );
+        }
+
+        TREE_OF_WORK_METRIC( metrics().set_threads( count ); )
+        m_threads.reserve( count );
+        for( size_t i = 0; i < count; ++i )
+            m_threads.emplace_back( &WorkStealingExecutor::run, this, i );
+    }
+    /**************************
+     *
+     *************************/
+    ~WorkStealingExecutor() override
+    {
+        {
+            std::lock_guard<std::mutex> lock( m_sleep_mutex );
+            m_stop = true;
+        }
+        m_wakeup.notify_all();
+
+        // destroyed by a task of its own (@see Executor::join_threads)
+        if ( WorkStealingExecutor::current().owner == this )
+            work( WorkStealingExecutor::current().index );
+        Executor::join_threads( m_threads );
+    }
+    /**************************
+     *
+     *************************/
+    void submit( Task task ) override
+    {
+        TREE_OF_WORK_METRIC( metrics().submitted(); )
+        const WorkStealingExecutor::Current& current = WorkStealingExecutor::current();
+
+        size_t index = 0;
+        if ( current.owner == this )
+            index = current.index;
+        else
+            index = m_next.fetch_add( 1, std::memory_order_relaxed ) % m_workers.size();
+
+        {
+            WorkStealingExecutor::Worker& worker = *m_workers[index];
+            std::lock_guard<std::mutex> lock( worker.mutex );
+            worker.tasks.push_back( std::move( task ) );
+        }
+        m_pending++;
+
+        // only pay for the wakeup if somebody is actually sleeping
+        if ( m_sleeping.load() > 0 )
+        {
+            std::lock_guard<std::mutex> lock( m_sleep_mutex );
+            m_wakeup.notify_one();
+        }
+    }
+    /**************************
+     * honours the affinity hint, @see Affinity
+     *************************/
+    void submit( Task task, int priority, Affinity affinity ) override
+    {
+        static_cast<void>( priority );
+
+        const WorkStealingExecutor::Current& current = WorkStealingExecutor::current();
+        switch( affinity.kind() )
+        {
+            default: break;
+            case Affinity::Kind::Worker:
+                push_pinned( affinity.value() % m_workers.size(), std::move( task ) );
+                return;
+            case Affinity::Kind::Parent:
+                if ( current.owner != this )
+                    break;
+                push_pinned( current.index, std::move( task ) );
+                return;
+            case Affinity::Kind::NumaNode:
+                if ( affinity.value() >= m_node_workers.size() || m_node_workers[affinity.value()].empty() )
+                    break;
+                push_numa( affinity.value(), std::move( task ) );
+                return;
+        }
+        submit( std::move( task ) );
+    }
+    /**************************
+     * number of worker threads
+     *************************/
+    size_t size() const
+    {
+        return m_threads.size();
+    }
+
+    WorkStealingExecutor( const WorkStealingExecutor& ) = delete;
+    WorkStealingExecutor& operator=( const WorkStealingExecutor& ) = delete;
+
+private:
+    /**************************
+     * per thread task deques
+     *  tasks  - the owner works at the back, thieves at the front
+     *  pinned - only the owner
+     *  numa   - the owner and thieves on the same NUMA node
+     *************************/
+    struct Worker
+    {
+        Worker( int c, int n )
+            : mutex()
+            , tasks()
+            , pinned()
+            , numa()
+            , pinned_count( 0 )
+            , numa_count( 0 )
+            , cpu( c )
+            , node( n )
+        {}
+
+        std::mutex          mutex;
+        std::deque<Task>    tasks;
+        std::deque<Task>    pinned;
+        std::deque<Task>    numa;
+        std::atomic<size_t> pinned_count;
+        std::atomic<size_t> numa_count;
+        const int           cpu;
+        const int           node;
+    };
+    /**************************
+     * identifies the pool (and deque) of the calling thread
+     *************************/
+    struct Current
+    {
+        const WorkStealingExecutor* owner;
+        size_t                      index;
+    };
+
+    static WorkStealingExecutor::Current& current()
+    {
+        static thread_local WorkStealingExecutor::Current c = { nullptr, 0 };
+        return c;
+    }
+
+    static size_t thread_count( size_t requested )
+    {
+        if ( requested == 0 )
+            requested = std::thread::hardware_concurrency();
+        return requested == 0 ? 1 : requested;
+    }
+
+private:
+    /**************************
+     * task for one worker only
+     *************************/
+    void push_pinned( size_t index, Task task )
+    {
+        TREE_OF_WORK_METRIC( metrics().submitted(); )
+        WorkStealingExecutor::Worker& worker = *m_workers[index];
+        {
+            std::lock_guard<std::mutex> lock( worker.mutex );
+            worker.pinned.push_back( std::move( task ) );
+        }
+        worker.pinned_count++;
+        wake_all();
+    }
+    /**************************
+     * task for the workers of a NUMA node, queued at the
+     * calling worker if it is on that node
+     *************************/
+    void push_numa( size_t node, Task task )
+    {
+        TREE_OF_WORK_METRIC( metrics().submitted(); )
+        const WorkStealingExecutor::Current& current = WorkStealingExecutor::current();
+        const std::vector<size_t>& candidates = m_node_workers[node];
+
+        size_t index = candidates[m_next.fetch_add( 1, std::memory_order_relaxed ) % candidates.size()];
+        if ( current.owner == this && m_workers[current.index]->node == static_cast<int>( node ) )
+            index = current.index;
+
+        WorkStealingExecutor::Worker& worker = *m_workers[index];
+        {
+            std::lock_guard<std::mutex> lock( worker.mutex );
+            worker.numa.push_back( std::move( task ) );
+        }
+        worker.numa_count++;
+        wake_all();
+    }
+    /**************************
+     * a pinned task can only be run by some of the workers,
+     * so all sleepers are woken to find it
+     *************************/
+    void wake_all()
+    {
+        if ( m_sleeping.load() > 0 )
+        {
+            std::lock_guard<std::mutex> lock( m_sleep_mutex );
+            m_wakeup.notify_all();
+        }
+    }
+    /**************************
+     *
+     *************************/
+    bool pop_local( size_t index, Task& task )
+    {
+        WorkStealingExecutor::Worker& worker = *m_workers[index];
+        std::lock_guard<std::mutex> lock( worker.mutex );
+        if ( !worker.pinned.empty() )
+        {
+            task = std::move( worker.pinned.back() );
+            worker.pinned.pop_back();
+            worker.pinned_count--;
+            return true;
+        }
+        if ( !worker.numa.empty() )
+        {
+            task = std::move( worker.numa.back() );
+            worker.numa.pop_back();
+            worker.numa_count--;
+            return true;
+        }
+        if ( worker.tasks.empty() )
+            return false;
+
+        task = std::move( worker.tasks.back() );
+        worker.tasks.pop_back();
+        m_pending--;
+        return true;
+    }
+    /**************************
+     *
+     *************************/
+    bool steal( size_t index, Task& task )
+    {
+        const int node = m_workers[index]->node;
+        for( size_t i = 1; i < m_workers.size(); ++i )
+        {
+            WorkStealingExecutor::Worker& victim = *m_workers[(index + i) % m_workers.size()];
+            std::lock_guard<std::mutex> lock( victim.mutex );
+            if ( !victim.tasks.empty() )
+            {
+                task = std::move( victim.tasks.front() );
+                victim.tasks.pop_front();
+                m_pending--;
+                TREE_OF_WORK_METRIC( metrics().stolen(); )
+                return true;
+            }
+            if ( node >= 0 && victim.node == node && !victim.numa.empty() )
+            {
+                task = std::move( victim.numa.front() );
+                victim.numa.pop_front();
+                victim.numa_count--;
+                TREE_OF_WORK_METRIC( metrics().stolen(); )
+                return true;
+            }
+        }
+        return false;
+    }
+    /**************************
+     * true if worker index may find a task
+     *************************/
+    bool runnable( size_t index ) const
+    {
+        const WorkStealingExecutor::Worker& worker = *m_workers[index];
+        if ( m_pending.load() > 0 || worker.pinned_count.load() > 0 )
+            return true;
+        if ( worker.node < 0 )
+            return worker.numa_count.load() > 0;
+
+        for( const size_t i : m_node_workers[worker.node] )
+        {
+            if ( m_workers[i]->numa_count.load() > 0 )
+                return true;
+        }
+        return false;
+    }
+    /**************************
+     * worker thread loop
+     *************************/
+    void run( size_t index )
+    {
+        WorkStealingExecutor::current() = { this, index };
+        if ( m_workers[index]->cpu >= 0 )
+            Topology::pin_current_thread( m_workers[index]->cpu );
+
+        work( index );
+    }
+    /**************************
+     * runs tasks until the executor is stopped and
+     * worker index can not find any more
+     *************************/
+    void work( size_t index )
+    {
+        for( ;; )
+        {
+            Task task;
+            if ( pop_local( index, task ) || steal( index, task ) )
+            {
+                run_task( task );
+                if ( Executor::orphaned() )
+                    return;
+                continue;
+            }
+
+            std::unique_lock<std::mutex> lock( m_sleep_mutex );
+            m_sleeping++;
+            m_wakeup.wait( lock, [this, index]{ return m_stop || runnable( index ); } );
+            m_sleeping--;
+
+            if ( m_stop && !runnable( index ) )
+                return;
+        }
+    }
+
+private:
+    std::vector<std::unique_ptr<Worker>> m_workers;
+    std::vector<std::thread>             m_threads;
+    std::vector<std::vector<size_t>>     m_node_workers;
+    std::mutex                           m_sleep_mutex;
+    std::condition_variable              m_wakeup;
+    std::atomic<size_t>                  m_pending;
+    std::atomic<size_t>                  m_sleeping;
+    std::atomic<size_t>                  m_next;
+    bool                                 m_stop;
+};
+
+/**************************
+ * Executes tasks on a fixed number of threads which are fed
+ * through one shared priority queue: the ready task with the
+ * highest priority runs first, tasks of equal priority run
+ * in submission order.
+ *
+ * Nodes pass their priority on submit (@see Work::set_priority,
+ * GraphBuilder::set_priority), so work on the critical path
+ * overtakes cheap leaf work when the pool is oversubscribed.
+ *
+ * Pending tasks are finished before the pool is destroyed.
+ *
+ *************************/
+class PriorityExecutor : public Executor
+{
+public:
+    using Executor::submit;
+
+public:
+    /**************************
+     * thread_count == 0 selects the number of hardware threads
+     *************************/
+    explicit PriorityExecutor( size_t thread_count = 0 )
+        : m_mutex()
+        , m_wakeup()
+        , m_tasks()
+        , m_threads()
+        , m_sequence( 0 )
+        , m_stop( false )
+    {
+        if ( thread_count == 0 )
+            thread_count = std::thread::hardware_concurrency();
+        if ( thread_count == 0 )
+            thread_count = 1;
+
+        TREE_OF_WORK_METRIC( metrics().set_threads( thread_count ); )
+        m_threads.reserve( thread_count );
+        for( size_t i = 0; i < thread_count; ++i )
+            m_threads.emplace_back( &PriorityExecutor::run, this );
+    }
+    /**************************
+     *
+     *************************/
+    ~PriorityExecutor() override
+    {
+        {
+            std::lock_guard<std::mutex> lock( m_mutex );
+            m_stop = true;
+        }
+        m_wakeup.notify_all();
+
+        // destroyed by a task of its own (@see Executor::join_threads)
+        if ( Executor::is_own_thread( m_threads ) )
+            run();
+        Executor::join_threads( m_threads );
+    }
+    /**************************
+     * tasks without priority get priority 0
+     *************************/
+    void submit( Task task ) override
+    {
+        submit( std::move( task ), 0 );
+    }
+    /**************************
+     *
+     *************************/
+    void submit( Task task, int priority ) override
+    {
+        TREE_OF_WORK_METRIC( metrics().submitted(); )
+        {
+            std::lock_guard<std::mutex> lock( m_mutex );
+            m_tasks.push_back( PriorityExecutor::Entry{ priority, m_sequence++, std::move( task ) } );
+            std::push_heap( m_tasks.begin(), m_tasks.end(), PriorityExecutor::Lower() );
+        }
+        m_wakeup.notify_one();
+    }
+    /**************************
+     * the queue grows to tasks entries up front
+     *************************/
+    void reserve( size_t tasks ) override
+    {
+        std::lock_guard<std::mutex> lock( m_mutex );
+        m_tasks.reserve( tasks );
+    }
+    /**************************
+     * number of worker threads
+     *************************/
+    size_t size() const
+    {
+        return m_threads.size();
+    }
+
+    PriorityExecutor( const PriorityExecutor& ) = delete;
+    PriorityExecutor& operator=( const PriorityExecutor& ) = delete;
+
+private:
+    struct Entry
+    {
+        int           priority;
+        std::uint64_t sequence;
+        Task          task;
+    };
+    /**************************
+     * heap order, the highest priority (and the oldest
+     * task among equal priorities) is on top
+     *************************/
+    struct Lower
+    {
+        bool operator()( const PriorityExecutor::Entry& a, const PriorityExecutor::Entry& b ) const
+        {
+            return a.priority != b.priority ? a.priority < b.priority : a.sequence > b.sequence;
+        }
+    };
+
+private:
+    /**************************
+     * worker thread loop
+     *************************/
+    void run()
+    {
+        for( ;; )
+        {
+            Task task;
+            {
+                std::unique_lock<std::mutex> lock( m_mutex );
+                m_wakeup.wait( lock, [this]{ return m_stop || !m_tasks.empty(); } );
+
+                if ( m_tasks.empty() )
+                    return;
+
+                std::pop_heap( m_tasks.begin(), m_tasks.end(), PriorityExecutor::Lower() );
+                task = std::move( m_tasks.back().task );
+                m_tasks.pop_back();
+            }
+            run_task( task );
+            if ( Executor::orphaned() )
+                return;
+        }
+    }
+
+private:
+    std::mutex                           m_mutex;
+    std::condition_variable              m_wakeup;
+    std::vector<PriorityExecutor::Entry> m_tasks;
+    std::vector<std::thread>             m_threads;
+    std::uint64_t                        m_sequence;
+    bool                                 m_stop;
+};
+
+/**************************
+ *
+ *************************/
+inline std::shared_ptr<Executor> Executor::default_executor()
+{
+    static std::shared_ptr<Executor> executor = std::make_shared<WorkStealingExecutor>();
+    return executor;
+}
+
+}
+
+#endif /* TREE_OF_WORK_EXECUTOR */
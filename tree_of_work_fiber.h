@@ -0,0 +1,617 @@
+/********************************************************************************
+ * MIT License
+ *
+ * Copyright (c) 2020 Christian Kranz
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ * 
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ * 
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ *******************************************************************************/
+#ifndef TREE_OF_WORK_FIBER
+#define TREE_OF_WORK_FIBER
+
+#include <chrono>
+#include <condition_variable>
+#include <cstddef>
+#include <deque>
+#include <future>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <type_traits>
+#include <vector>
+
+#include "tree_of_work.h"
+#include "tree_of_work_graph.h"
+#include "tree_of_work_timer.h"
+
+/**************************
+ * Fibers are built on POSIX ucontext, TREE_OF_WORK_HAS_FIBERS
+ * is defined where it is available
+ *************************/
+#if defined(__has_include) && !defined(_WIN32)
+#if __has_include(<ucontext.h>) && __has_include(<sys/mman.h>)
+#include <ucontext.h>
+#include <sys/mman.h>
+#include <unistd.h>
+#define TREE_OF_WORK_HAS_FIBERS 1
+#endif
+#endif
+
+/**************************
+ * ThreadSanitizer has to be told about context switches
+ *************************/
+#if defined(__SANITIZE_THREAD__)
+#define TREE_OF_WORK_TSAN_FIBERS 1
+#elif defined(__has_feature)
+#if __has_feature(thread_sanitizer)
+#define TREE_OF_WORK_TSAN_FIBERS 1
+#endif
+#endif
+
+#if defined(TREE_OF_WORK_HAS_FIBERS) && defined(TREE_OF_WORK_TSAN_FIBERS)
+extern "C" void* __tsan_get_current_fiber();
+extern "C" void* __tsan_create_fiber( unsigned flags );
+extern "C" void  __tsan_destroy_fiber( void* fiber );
+extern "C" void  __tsan_switch_to_fiber( void* fiber, unsigned flags );
+#endif
+
+#ifdef TREE_OF_WORK_HAS_FIBERS
+
+namespace TreeOfWork
+{
+/**************************
+ * Executes every task on a user space fiber, so workers which
+ * block in the helpers of this_fiber (sleep_for, wait for a
+ * node or graph, wait for a future) release their thread to
+ * other fibers instead of stalling it. Large, partly blocking
+ * graphs can run with as many threads as there are cores.
+ *
+ * Fibers run on small stacks (64 KiB by default, with a guard
+ * page) which are pooled and reused. Workers must not block in
+ * other ways for long, and must not build deep call chains
+ * (e.g. a large continuation depth) on the small stacks.
+ *
+ * A suspended fiber is resumed on the thread it started on,
+ * so thread_locals (of the worker, or e.g. the continuation
+ * depth of the executor) stay valid across a suspension;
+ * finished fibers are pooled and reused by any thread.
+ * The executor waits for all fibers, including suspended ones,
+ * before it is destroyed; a fiber which drops the last reference
+ * to its executor runs the others to their end itself.
+ *
+ *************************/
+class FiberExecutor : public Executor
+{
+public:
+    using Executor::submit;
+
+    static const size_t DefaultStackSize = 64 * 1024;
+
+private:
+    struct Fiber;
+
+    static const size_t NoHome = ~size_t( 0 );
+
+public:
+    /**************************
+     * resumes a suspended fiber, has to be called exactly once
+     * (@see FiberExecutor::suspend)
+     *************************/
+    class Resume
+    {
+    public:
+        explicit Resume( FiberExecutor::Fiber* fiber )
+            : m_fiber( fiber )
+        {}
+
+        void operator()() const
+        {
+            m_fiber->owner->make_ready( m_fiber );
+        }
+
+    private:
+        FiberExecutor::Fiber* m_fiber;
+    };
+
+public:
+    /**************************
+     * thread_count == 0 selects the number of hardware threads
+     *************************/
+    explicit FiberExecutor( size_t thread_count = 0, size_t stack_size = FiberExecutor::DefaultStackSize )
+        : m_stack_size( FiberExecutor::round_to_pages( stack_size ) )
+        , m_mutex()
+        , m_ready()
+        , m_free()
+        , m_fibers()
+        , m_live( 0 )
+        , m_workers()
+        , m_threads()
+        , m_stop( false )
+    {
+        if ( thread_count == 0 )
+            thread_count = std::thread::hardware_concurrency();
+        if ( thread_count == 0 )
+            thread_count = 1;
+
+        TREE_OF_WORK_METRIC( metrics().set_threads( thread_count ); )
+        m_workers.reserve( thread_count );
+        for( size_t i = 0; i < thread_count; ++i )
+            m_workers.emplace_back( new FiberExecutor::Worker() );
+
+        m_threads.reserve( thread_count );
+        for( size_t i = 0; i < thread_count; ++i )
+            m_threads.emplace_back( &FiberExecutor::run, this, i );
+    }
+    /**************************
+     * runs all pending and suspended fibers to their end
+     *
+     * destroyed on one of its own fibers (the task dropped the
+     * last reference, @see Executor::join_threads), that fiber
+     * does not wait for itself: it runs the fibers of its thread,
+     * and its stack is unmapped by the thread once it left it
+     *************************/
+    ~FiberExecutor() override
+    {
+        FiberExecutor::Fiber* const self = FiberExecutor::current();
+        const bool own = self != nullptr && self->owner == this;
+        {
+            std::lock_guard<std::mutex> lock( m_mutex );
+            m_stop = true;
+            if ( own )
+                m_live--;
+            wake_all();
+        }
+
+        if ( own )
+            run( self->home );
+        Executor::join_threads( m_threads );
+        for( FiberExecutor::Fiber* fiber : m_fibers )
+        {
+            if ( fiber != self )
+                FiberExecutor::destroy( fiber );
+        }
+    }
+    /**************************
+     * the task runs on a pooled fiber
+     *************************/
+    void submit( Task task ) override
+    {
+        TREE_OF_WORK_METRIC( metrics().submitted(); )
+        std::lock_guard<std::mutex> lock( m_mutex );
+        FiberExecutor::Fiber* fiber = take_fiber();
+        fiber->task = std::move( task );
+        m_ready.push_back( fiber );
+        m_live++;
+        wake_idle();
+    }
+    /**************************
+     * number of worker threads
+     *************************/
+    size_t size() const
+    {
+        return m_threads.size();
+    }
+    /**************************
+     * number of fibers (and stacks) allocated so far
+     *************************/
+    size_t fiber_count()
+    {
+        std::lock_guard<std::mutex> lock( m_mutex );
+        return m_fibers.size();
+    }
+    /**************************
+     * true if the calling code runs on a fiber
+     *************************/
+    static bool on_fiber()
+    {
+        return FiberExecutor::current() != nullptr;
+    }
+    /**************************
+     * suspends the calling fiber and calls arm( resume ) once
+     * the fiber has left its thread; resume() makes the fiber
+     * ready again, e.g. from a completion callback
+     * may only be called on a fiber (@see on_fiber)
+     *************************/
+    template<typename F>
+    static void suspend( F&& arm )
+    {
+        FiberExecutor::Fiber* fiber = FiberExecutor::current();
+        fiber->arm = std::forward<F>( arm );
+        FiberExecutor::leave( fiber );
+    }
+
+    FiberExecutor( const FiberExecutor& ) = delete;
+    FiberExecutor& operator=( const FiberExecutor& ) = delete;
+
+private:
+    using Arm = detail::InplaceFunction<void(FiberExecutor::Resume)>;
+
+    struct Fiber
+    {
+        ucontext_t         context;
+        ucontext_t*        scheduler;
+        void*              stack;
+        size_t             mapped;
+        FiberExecutor*     owner;
+        size_t             home;
+        Task               task;
+        FiberExecutor::Arm arm;
+        bool               finished;
+#ifdef TREE_OF_WORK_TSAN_FIBERS
+        void*              tsan_fiber;
+        void*              tsan_scheduler;
+#endif
+    };
+    /**************************
+     * per thread state: the suspended fibers of the thread
+     * which are ready again (all guarded by m_mutex)
+     *************************/
+    struct Worker
+    {
+        Worker()
+            : resumed()
+            , wakeup()
+            , idle( false )
+        {}
+
+        std::deque<FiberExecutor::Fiber*> resumed;
+        std::condition_variable           wakeup;
+        bool                              idle;
+    };
+
+private:
+    static FiberExecutor::Fiber*& current()
+    {
+        static thread_local FiberExecutor::Fiber* fiber = nullptr;
+        return fiber;
+    }
+
+    /**************************
+     * switches from the worker thread into fiber and back
+     * (from a fiber which destroys the executor, @see ~FiberExecutor)
+     *************************/
+    static void enter( FiberExecutor::Fiber* fiber, ucontext_t* scheduler )
+    {
+        FiberExecutor::Fiber* const previous = FiberExecutor::current();
+        fiber->scheduler = scheduler;
+        FiberExecutor::current() = fiber;
+#ifdef TREE_OF_WORK_TSAN_FIBERS
+        fiber->tsan_scheduler = __tsan_get_current_fiber();
+        __tsan_switch_to_fiber( fiber->tsan_fiber, 0 );
+#endif
+        ::swapcontext( scheduler, &fiber->context );
+        FiberExecutor::current() = previous;
+    }
+    /**************************
+     * switches from fiber back to its worker thread
+     *************************/
+    static void leave( FiberExecutor::Fiber* fiber )
+    {
+#ifdef TREE_OF_WORK_TSAN_FIBERS
+        __tsan_switch_to_fiber( fiber->tsan_scheduler, 0 );
+#endif
+        ::swapcontext( &fiber->context, fiber->scheduler );
+    }
+
+    static size_t page_size()
+    {
+        static const size_t size = static_cast<size_t>( ::sysconf( _SC_PAGESIZE ) );
+        return size;
+    }
+
+    static size_t round_to_pages( size_t size )
+    {
+        const size_t page = FiberExecutor::page_size();
+        return ( std::max<size_t>( size, 4 * page ) + page - 1 ) / page * page;
+    }
+    /**************************
+     * a pooled fiber or a new one, the stack is mapped with
+     * a guard page below it; called with m_mutex held
+     *************************/
+    FiberExecutor::Fiber* take_fiber()
+    {
+        if ( !m_free.empty() )
+        {
+            FiberExecutor::Fiber* fiber = m_free.back();
+            m_free.pop_back();
+            return fiber;
+        }
+
+        const size_t guard = FiberExecutor::page_size();
+        void* memory = ::mmap( nullptr, m_stack_size + guard, PROT_READ | PROT_WRITE,
+                               MAP_PRIVATE | MAP_ANONYMOUS, -1, 0 );
+        if ( memory == MAP_FAILED )
+            throw std::bad_alloc();
+        ::mprotect( memory, guard, PROT_NONE );
+
+        FiberExecutor::Fiber* fiber = new FiberExecutor::Fiber();
+        fiber->scheduler = nullptr;
+        fiber->stack = memory;
+        fiber->mapped = m_stack_size + guard;
+        fiber->owner = this;
+        fiber->home = FiberExecutor::NoHome;
+        fiber->finished = false;
+#ifdef TREE_OF_WORK_TSAN_FIBERS
+        fiber->tsan_fiber = __tsan_create_fiber( 0 );
+        fiber->tsan_scheduler = nullptr;
+#endif
+
+        ::getcontext( &fiber->context );
+        fiber->context.uc_stack.ss_sp = static_cast<char*>( memory ) + guard;
+        fiber->context.uc_stack.ss_size = m_stack_size;
+        fiber->context.uc_link = nullptr;
+        ::makecontext( &fiber->context, &FiberExecutor::entry, 0 );
+
+        m_fibers.push_back( fiber );
+        return fiber;
+    }
+    /**************************
+     * unmaps the stack of a fiber which is not entered
+     *************************/
+    static void destroy( FiberExecutor::Fiber* fiber )
+    {
+#ifdef TREE_OF_WORK_TSAN_FIBERS
+        __tsan_destroy_fiber( fiber->tsan_fiber );
+#endif
+        ::munmap( fiber->stack, fiber->mapped );
+        delete fiber;
+    }
+    /**************************
+     * the fiber loop: runs a task, returns to the scheduler and
+     * continues with the next task once the fiber is reused
+     *************************/
+    static void entry()
+    {
+        // read once, a reused fiber continues on another thread
+        // and the address of the thread_local may be cached
+        FiberExecutor::Fiber* const fiber = FiberExecutor::current();
+        for( ;; )
+        {
+            fiber->owner->run_task( fiber->task );
+            fiber->task = Task();
+            fiber->finished = true;
+            FiberExecutor::leave( fiber );
+        }
+    }
+    /**************************
+     * queues the fiber on its own thread and notifies under the
+     * lock: once the fiber is queued it may finish and the
+     * executor may be destroyed
+     *************************/
+    void make_ready( FiberExecutor::Fiber* fiber )
+    {
+        std::lock_guard<std::mutex> lock( m_mutex );
+        FiberExecutor::Worker& worker = *m_workers[fiber->home];
+        worker.resumed.push_back( fiber );
+        worker.idle = false;
+        worker.wakeup.notify_one();
+    }
+    /**************************
+     * wakes one idle thread for a new task; called with m_mutex held
+     *************************/
+    void wake_idle()
+    {
+        for( std::unique_ptr<FiberExecutor::Worker>& worker : m_workers )
+        {
+            if ( worker->idle )
+            {
+                worker->idle = false;
+                worker->wakeup.notify_one();
+                return;
+            }
+        }
+    }
+
+    void wake_all()
+    {
+        for( std::unique_ptr<FiberExecutor::Worker>& worker : m_workers )
+            worker->wakeup.notify_one();
+    }
+    /**************************
+     * worker thread loop: switches into ready fibers (resumed
+     * ones of this thread first), arms the wakeup of fibers which
+     * suspended and pools finished ones
+     *************************/
+    void run( const size_t index )
+    {
+        FiberExecutor::Worker& worker = *m_workers[index];
+        ucontext_t scheduler;
+        for( ;; )
+        {
+            FiberExecutor::Fiber* fiber = nullptr;
+            {
+                std::unique_lock<std::mutex> lock( m_mutex );
+                while( worker.resumed.empty() && m_ready.empty() && !( m_stop && m_live == 0 ) )
+                {
+                    worker.idle = true;
+                    worker.wakeup.wait( lock );
+                }
+                worker.idle = false;
+
+                if ( !worker.resumed.empty() )
+                {
+                    fiber = worker.resumed.front();
+                    worker.resumed.pop_front();
+                }
+                else if ( !m_ready.empty() )
+                {
+                    fiber = m_ready.front();
+                    m_ready.pop_front();
+                    fiber->home = index;
+                }
+                else
+                {
+                    // the other threads may be waiting for the last fiber
+                    wake_all();
+                    return;
+                }
+            }
+
+            FiberExecutor::enter( fiber, &scheduler );
+
+            // the fiber destroyed the executor, only its stack is left
+            if ( Executor::orphaned() )
+            {
+                FiberExecutor::destroy( fiber );
+                return;
+            }
+
+            if ( fiber->finished )
+            {
+                fiber->finished = false;
+                fiber->home = FiberExecutor::NoHome;
+                std::lock_guard<std::mutex> lock( m_mutex );
+                m_free.push_back( fiber );
+                if ( --m_live == 0 && m_stop )
+                    wake_all();
+                continue;
+            }
+
+            // the fiber is off its stack now, it may be resumed anywhere
+            FiberExecutor::Arm arm = std::move( fiber->arm );
+            arm( FiberExecutor::Resume( fiber ) );
+        }
+    }
+
+private:
+    const size_t                                        m_stack_size;
+    std::mutex                                          m_mutex;
+    std::deque<FiberExecutor::Fiber*>                   m_ready;
+    std::vector<FiberExecutor::Fiber*>                  m_free;
+    std::vector<FiberExecutor::Fiber*>                  m_fibers;
+    size_t                                              m_live;
+    std::vector<std::unique_ptr<FiberExecutor::Worker>> m_workers;
+    std::vector<std::thread>                            m_threads;
+    bool                                                m_stop;
+};
+
+/**************************
+ * Blocking helpers for workers: on a fiber of a FiberExecutor
+ * they suspend the fiber and free the thread, elsewhere they
+ * block the calling thread.
+ *************************/
+namespace this_fiber
+{
+/**************************
+ * lets the other ready fibers run
+ *************************/
+inline void yield()
+{
+    if ( !FiberExecutor::on_fiber() )
+    {
+        std::this_thread::yield();
+        return;
+    }
+    FiberExecutor::suspend( [](FiberExecutor::Resume resume){ resume(); } );
+}
+/**************************
+ *
+ *************************/
+inline void sleep_until( detail::TimerService::Clock::time_point at )
+{
+    if ( !FiberExecutor::on_fiber() )
+    {
+        std::this_thread::sleep_until( at );
+        return;
+    }
+    if ( detail::TimerService::Clock::now() >= at )
+        return;
+
+    FiberExecutor::suspend( [at](FiberExecutor::Resume resume)
+                            {
+                                detail::TimerService::instance().schedule( at, resume );
+                            } );
+}
+
+template<typename Rep, typename Period>
+void sleep_for( const std::chrono::duration<Rep, Period>& duration )
+{
+    this_fiber::sleep_until( detail::TimerService::Clock::now() +
+                             std::chrono::duration_cast<detail::TimerService::Clock::duration>( duration ) );
+}
+/**************************
+ * waits until node is done, @see Work::wait_for_done
+ *************************/
+inline Work::State wait( Work& node )
+{
+    if ( !FiberExecutor::on_fiber() || node.try_is_done() )
+    {
+        node.wait_for_done();
+        return node.get_state();
+    }
+
+    Work::State state = Work::State::Created;
+    Work* target = &node;
+    Work::State* result = &state;
+    FiberExecutor::suspend( [target, result](FiberExecutor::Resume resume)
+                            {
+                                target->on_done( [result, resume](Work::State s)
+                                                 {
+                                                     *result = s;
+                                                     resume();
+                                                 } );
+                            } );
+    return state;
+}
+/**************************
+ * waits until the current run of a Graph or GraphRun is done
+ *************************/
+template<typename T,
+         typename = typename std::enable_if<std::is_same<T, Graph>::value ||
+                                            std::is_same<T, GraphRun>::value>::type>
+void wait( T& graph )
+{
+    if ( !FiberExecutor::on_fiber() || graph.try_is_done() )
+    {
+        graph.wait_for_done();
+        return;
+    }
+
+    T* target = &graph;
+    FiberExecutor::suspend( [target](FiberExecutor::Resume resume)
+                            {
+                                target->on_done( [resume]{ resume(); } );
+                            } );
+}
+/**************************
+ * waits until future is ready; futures can not notify, so the
+ * fiber polls with a backoff from 50 us to 1 ms
+ *************************/
+template<typename T>
+void wait( const std::future<T>& future )
+{
+    if ( !FiberExecutor::on_fiber() )
+    {
+        future.wait();
+        return;
+    }
+
+    std::chrono::microseconds backoff( 50 );
+    while( future.wait_for( std::chrono::seconds( 0 ) ) != std::future_status::ready )
+    {
+        this_fiber::sleep_for( backoff );
+        backoff = std::min( backoff * 2, std::chrono::microseconds( 1000 ) );
+    }
+}
+}
+
+}
+
+#endif /* TREE_OF_WORK_HAS_FIBERS */
+
+#endif /* TREE_OF_WORK_FIBER */
@@ -0,0 +1,212 @@
+/********************************************************************************
+ * MIT License
+ *
+ * Copyright (c) 2020 Christian Kranz
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ *******************************************************************************/
+#ifndef TREE_OF_WORK_FUNCTION
+#define TREE_OF_WORK_FUNCTION
+
+#include <cstddef>
+#include <functional>
+#include <new>
+#include <type_traits>
+#include <utility>
+
+namespace TreeOfWork
+{
+namespace detail
+{
+/**************************
+ * Move only replacement for std::function which stores
+ * callables of up to Capacity bytes inline, so wrapping
+ * a lambda or a bound member function does not allocate.
+ *
+ * Larger callables (or callables which may throw on move)
+ * are stored on the heap.
+ *
+ *************************/
+template<typename Signature, size_t Capacity = 6 * sizeof(void*)>
+class InplaceFunction;
+
+template<typename R, typename... Args, size_t Capacity>
+class InplaceFunction<R(Args...), Capacity>
+{
+    using Storage = typename std::aligned_storage<Capacity, alignof(std::max_align_t)>::type;
+
+    struct Ops
+    {
+        R    (*invoke)( void*, Args&&... );
+        void (*move)( void*, void* );
+        void (*destroy)( void* );
+    };
+
+    template<typename F>
+    struct Inline
+    {
+        static R invoke( void* f, Args&&... args )
+        {
+            return (*static_cast<F*>( f ))( std::forward<Args>( args )... );
+        }
+        static void move( void* to, void* from )
+        {
+            new ( to ) F( std::move( *static_cast<F*>( from ) ) );
+            static_cast<F*>( from )->~F();
+        }
+        static void destroy( void* f )
+        {
+            static_cast<F*>( f )->~F();
+        }
+        static const Ops ops;
+    };
+
+    template<typename F>
+    struct Heap
+    {
+        static R invoke( void* f, Args&&... args )
+        {
+            return (**static_cast<F**>( f ))( std::forward<Args>( args )... );
+        }
+        static void move( void* to, void* from )
+        {
+            new ( to ) F*( *static_cast<F**>( from ) );
+        }
+        static void destroy( void* f )
+        {
+            delete *static_cast<F**>( f );
+        }
+        static const Ops ops;
+    };
+
+    template<typename F>
+    struct FitsInline
+        : std::integral_constant<bool, sizeof(F) <= Capacity &&
+                                       alignof(std::max_align_t) % alignof(F) == 0 &&
+                                       std::is_nothrow_move_constructible<F>::value>
+    {};
+
+public:
+    InplaceFunction()
+        : m_storage()
+        , m_ops( nullptr )
+    {}
+
+    InplaceFunction( std::nullptr_t )
+        : m_storage()
+        , m_ops( nullptr )
+    {}
+
+    template<typename F,
+             typename = typename std::enable_if<
+                 !std::is_same<typename std::decay<F>::type, InplaceFunction>::value>::type>
+    InplaceFunction( F&& f )
+        : m_storage()
+        , m_ops( nullptr )
+    {
+        store<typename std::decay<F>::type>( std::forward<F>( f ),
+                                              FitsInline<typename std::decay<F>::type>() );
+    }
+
+    InplaceFunction( InplaceFunction&& other ) noexcept
+        : m_storage()
+        , m_ops( other.m_ops )
+    {
+        if ( m_ops != nullptr )
+            m_ops->move( &m_storage, &other.m_storage );
+        other.m_ops = nullptr;
+    }
+
+    InplaceFunction& operator=( InplaceFunction&& other ) noexcept
+    {
+        if ( this != &other )
+        {
+            reset();
+            m_ops = other.m_ops;
+            if ( m_ops != nullptr )
+                m_ops->move( &m_storage, &other.m_storage );
+            other.m_ops = nullptr;
+        }
+        return *this;
+    }
+
+    ~InplaceFunction()
+    {
+        reset();
+    }
+
+    R operator()( Args... args ) const
+    {
+        if ( m_ops == nullptr )
+            throw std::bad_function_call();
+        return m_ops->invoke( &m_storage, std::forward<Args>( args )... );
+    }
+
+    explicit operator bool() const
+    {
+        return m_ops != nullptr;
+    }
+
+    InplaceFunction( const InplaceFunction& ) = delete;
+    InplaceFunction& operator=( const InplaceFunction& ) = delete;
+
+private:
+    template<typename F, typename G>
+    void store( G&& f, std::true_type )
+    {
+        new ( &m_storage ) F( std::forward<G>( f ) );
+        m_ops = &Inline<F>::ops;
+    }
+
+    template<typename F, typename G>
+    void store( G&& f, std::false_type )
+    {
+        new ( &m_storage ) F*( new F( std::forward<G>( f ) ) );
+        m_ops = &Heap<F>::ops;
+    }
+
+    void reset()
+    {
+        if ( m_ops != nullptr )
+            m_ops->destroy( &m_storage );
+        m_ops = nullptr;
+    }
+
+private:
+    mutable Storage m_storage;
+    const Ops*      m_ops;
+};
+
+template<typename R, typename... Args, size_t Capacity>
+template<typename F>
+const typename InplaceFunction<R(Args...), Capacity>::Ops
+InplaceFunction<R(Args...), Capacity>::Inline<F>::ops = { &Inline<F>::invoke,
+                                                          &Inline<F>::move,
+                                                          &Inline<F>::destroy };
+
+template<typename R, typename... Args, size_t Capacity>
+template<typename F>
+const typename InplaceFunction<R(Args...), Capacity>::Ops
+InplaceFunction<R(Args...), Capacity>::Heap<F>::ops = { &Heap<F>::invoke,
+                                                        &Heap<F>::move,
+                                                        &Heap<F>::destroy };
+}
+}
+
+#endif /* TREE_OF_WORK_FUNCTION */
@@ -0,0 +1,1487 @@
+/********************************************************************************
+ * MIT License
+ *
+ * Copyright (c) 2020 Christian Kranz
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ *******************************************************************************/
+#ifndef TREE_OF_WORK_GRAPH
+#define TREE_OF_WORK_GRAPH
+
+#include <algorithm>
+#include <cstdint>
+#include <new>
+#include <mutex>
+#include <condition_variable>
+#include <stdexcept>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+#include "tree_of_work.h"
+
+namespace TreeOfWork
+{
+namespace detail
+{
+/**************************
+ * fixed size array allocated from an arena
+ * whose first element starts on a cache line boundary
+ *************************/
+template<typename T>
+class CacheAlignedArray
+{
+public:
+    static const size_t CacheLine = 64;
+
+public:
+    CacheAlignedArray( size_t size, Arena& arena )
+        : m_data( static_cast<T*>( arena.allocate( size * sizeof(T), CacheLine ) ) )
+        , m_size( size )
+    {
+        for( size_t i = 0; i < m_size; ++i )
+            new ( m_data + i ) T();
+    }
+
+    ~CacheAlignedArray()
+    {
+        for( size_t i = 0; i < m_size; ++i )
+            m_data[i].~T();
+    }
+
+    T&       operator[]( size_t i )       { return m_data[i]; }
+    const T& operator[]( size_t i ) const { return m_data[i]; }
+    size_t   size() const                 { return m_size; }
+
+    CacheAlignedArray( const CacheAlignedArray& ) = delete;
+    CacheAlignedArray& operator=( const CacheAlignedArray& ) = delete;
+
+private:
+    T*     m_data;
+    size_t m_size;
+};
+}
+
+class GraphBuilder;
+class GraphRun;
+class GraphFile;
+
+/**************************
+ * Thrown by GraphBuilder::compile() for a topology which
+ * can not complete: a cycle, and with it all nodes which
+ * wait for a node on the cycle, would never run.
+ *
+ *************************/
+class GraphError : public std::invalid_argument
+{
+public:
+    GraphError( std::vector<std::uint32_t> cycle, std::vector<std::uint32_t> unreachable )
+        : std::invalid_argument( GraphError::describe( cycle, unreachable ) )
+        , m_cycle( std::move( cycle ) )
+        , m_unreachable( std::move( unreachable ) )
+    {}
+    /**************************
+     * the nodes of one cycle, each node is a parent of the next
+     * and the last one a parent of the first
+     *************************/
+    const std::vector<std::uint32_t>& cycle() const
+    {
+        return m_cycle;
+    }
+    /**************************
+     * all nodes which can never run (including the cycle),
+     * in ascending order
+     *************************/
+    const std::vector<std::uint32_t>& unreachable() const
+    {
+        return m_unreachable;
+    }
+
+private:
+    static std::string describe( const std::vector<std::uint32_t>& cycle, const std::vector<std::uint32_t>& unreachable )
+    {
+        // appended piece by piece, gcc 12 reports a false -Wrestrict
+        // for " " + std::to_string( ... )
+        std::string message = "TreeOfWork::GraphBuilder::compile: cycle";
+        for( const std::uint32_t node : cycle )
+        {
+            message += ' ';
+            message += std::to_string( node );
+            message += " ->";
+        }
+        message += ' ';
+        message += std::to_string( cycle.front() );
+        message += ", ";
+        message += std::to_string( unreachable.size() );
+        message += " nodes can never run";
+        return message;
+    }
+
+private:
+    std::vector<std::uint32_t> m_cycle;
+    std::vector<std::uint32_t> m_unreachable;
+};
+
+/**************************
+ * A Graph is the compiled, immutable form of a tree of work.
+ *
+ * Nodes are addressed by index. The topology is stored in
+ * flat arrays:
+ *   - one contiguous array of node descriptions
+ *   - the children of all nodes in CSR layout
+ *     (children of node i are m_children[m_child_offsets[i] .. m_child_offsets[i+1]])
+ *   - a topological order of the nodes, level by level
+ *     (level k are the nodes whose longest path from a root
+ *     has k edges)
+ *
+ * All arrays are allocated with their final size from the
+ * arena of the graph and released at once with it.
+ *
+ * The state of a run (counters, completion signal) lives in a
+ * GraphRun, so one graph can be run by any number of GraphRun
+ * contexts at the same time. Graph::run() and the other run
+ * functions of Graph use a built-in context.
+ *
+ * A Graph is created by GraphBuilder::compile().
+ *
+ *************************/
+class Graph
+{
+    friend class GraphBuilder;
+    friend class GraphRun;
+    friend class GraphFile;
+public:
+    using NodeId = std::uint32_t;
+
+    static const NodeId NoNode = ~NodeId( 0 );
+    /**************************
+     * completion callback of a run
+     * @see Graph::on_done
+     *************************/
+    using Callback = detail::InplaceFunction<void(void)>;
+
+public:
+    /**************************
+     * starts all nodes without parents
+     *
+     * a graph can be run any number of times; a new run waits
+     * for the previous one and restores the counters with
+     * reset() before it starts
+     * (concurrent runs need their own GraphRun)
+     *************************/
+    void run( std::shared_ptr<Executor> executor = Executor::default_executor() );
+    /**************************
+     * run() with a deadline for the whole run: once deadline
+     * is reached the nodes which have not been started yet are
+     * cancelled and the running ones fail (@see Work::set_timeout)
+     *************************/
+    void run_until( detail::TimerService::Clock::time_point deadline,
+                    std::shared_ptr<Executor> executor = Executor::default_executor() );
+    /**************************
+     * cancels all nodes of the current run which have not
+     * been started yet; running nodes are not interrupted
+     *************************/
+    void cancel();
+    /**************************
+     * blocks until all nodes of the current run are done
+     * (returns immediately if the graph was never run)
+     *************************/
+    void wait_for_done();
+    /**************************
+     * wait_for_done() which gives up after timeout or at
+     * deadline, returns true if the run is done
+     *************************/
+    template<typename Rep, typename Period>
+    bool wait_for_done( const std::chrono::duration<Rep, Period>& timeout );
+
+    template<typename Clock, typename Duration>
+    bool wait_until( const std::chrono::time_point<Clock, Duration>& deadline );
+    /**************************
+     * true if all nodes of the current run are done
+     * (or the graph was never run), never blocks
+     *************************/
+    bool try_is_done();
+    /**************************
+     * calls callback() once all nodes of the current run are done,
+     * or right away if no run is in progress
+     *
+     * the callback runs on the thread which settles the last node
+     * and is dropped after the call, so it has to be registered
+     * after run() for every run
+     *************************/
+    template<typename F>
+    void on_done( F&& callback );
+    /**************************
+     * restores the counters of all nodes in one linear pass
+     * must not be called while the graph is running
+     *************************/
+    void reset();
+    /**************************
+     * current state of a node in the current run
+     *************************/
+    Work::State get_state( const NodeId node ) const;
+    /**************************
+     * number of nodes
+     *************************/
+    size_t size() const
+    {
+        return m_nodes.size();
+    }
+    /**************************
+     * number of levels, the longest path through the
+     * graph in nodes
+     *************************/
+    size_t depth() const
+    {
+        return m_level_offsets.size() - 1;
+    }
+    /**************************
+     * the largest number of nodes on one level
+     *************************/
+    size_t width() const
+    {
+        return m_width;
+    }
+    /**************************
+     * the nodes of a level, level 0 are the roots
+     *************************/
+    const NodeId* level_begin( const size_t level ) const
+    {
+        return m_order.data() + m_level_offsets[level];
+    }
+    const NodeId* level_end( const size_t level ) const
+    {
+        return m_order.data() + m_level_offsets[level + 1];
+    }
+    /**************************
+     * read access to the topology
+     *************************/
+    const NodeId* children_begin( const NodeId node ) const
+    {
+        return m_children.data() + m_child_offsets[node];
+    }
+    const NodeId* children_end( const NodeId node ) const
+    {
+        return m_children.data() + m_child_offsets[node + 1];
+    }
+    NodeId parent_count( const NodeId node ) const
+    {
+        return m_parent_counts[node];
+    }
+    Work::Conditional trigger_condition( const NodeId node ) const
+    {
+        return m_nodes[node].trigger_condition;
+    }
+    int priority( const NodeId node ) const
+    {
+        return m_nodes[node].priority;
+    }
+    Affinity affinity( const NodeId node ) const
+    {
+        return m_nodes[node].affinity;
+    }
+
+    detail::TimerService::Clock::duration timeout( const NodeId node ) const
+    {
+        return m_nodes[node].timeout;
+    }
+    const ResourceClaim* claims_begin( const NodeId node ) const
+    {
+        return m_claims.data() + m_claim_offsets[node];
+    }
+    const ResourceClaim* claims_end( const NodeId node ) const
+    {
+        return m_claims.data() + m_claim_offsets[node + 1];
+    }
+    /**************************
+     * name of a node ("" if it has none)
+     * @see GraphBuilder::set_name
+     *************************/
+    const char* name( const NodeId node ) const
+    {
+        if ( m_name_ids.empty() || m_name_ids[node] == Graph::NoNode )
+            return "";
+        return m_name_chars.data() + m_name_offsets[m_name_ids[node]];
+    }
+#ifdef TREE_OF_WORK_COLLECT_METRICS
+    /**************************
+     * node metrics of all runs of the graph
+     *************************/
+    NodeMetrics& metrics() const
+    {
+        return m_metrics;
+    }
+#endif
+    /**************************
+     * waits for a run of the built-in context in progress
+     *************************/
+    ~Graph();
+
+    Graph( const Graph& ) = delete;
+    Graph& operator=( const Graph& ) = delete;
+
+private:
+    /**************************
+     * immutable part of a node
+     *************************/
+    struct Node
+    {
+        Work::Worker                          worker;
+        Work::Conditional                     trigger_condition;
+        int                                   priority;
+        Affinity                              affinity;
+        detail::TimerService::Clock::duration timeout;
+    };
+
+private:
+    /**************************
+     *
+     *************************/
+    explicit Graph( std::shared_ptr<Arena> arena );
+    /**************************
+     * creates the built-in run context once the topology is complete
+     *************************/
+    void create_run();
+
+private:
+    std::shared_ptr<Arena>             m_arena;
+    detail::ArenaVector<Graph::Node>   m_nodes;
+    detail::ArenaVector<NodeId>        m_parent_counts;
+    detail::ArenaVector<NodeId>        m_child_offsets;
+    detail::ArenaVector<NodeId>        m_children;
+    detail::ArenaVector<NodeId>        m_order;
+    detail::ArenaVector<NodeId>        m_level_offsets;
+    size_t                             m_width;
+    detail::ArenaVector<NodeId>        m_claim_offsets;
+    detail::ArenaVector<ResourceClaim> m_claims;
+    detail::ArenaVector<NodeId>        m_name_ids;
+    detail::ArenaVector<NodeId>        m_name_offsets;
+    detail::ArenaVector<char>          m_name_chars;
+    std::unique_ptr<GraphRun>          m_run;
+#ifdef TREE_OF_WORK_COLLECT_METRICS
+    mutable NodeMetrics                m_metrics;
+#endif
+};
+
+/**************************
+ * The state of one run of a Graph: one compact block with
+ * the counters of all nodes (in a cache aligned array), the
+ * number of unsettled nodes and the completion signal.
+ *
+ * Any number of GraphRun contexts can run the same graph at
+ * the same time, e.g. one per request; a context can be
+ * started again once its run is done. The worker functions
+ * are shared by all runs and called concurrently, per run
+ * data is reached with GraphRun::of( control ).data().
+ *
+ *************************/
+class GraphRun
+{
+    friend class Graph;
+public:
+    using NodeId      = Graph::NodeId;
+    using SettledFunc = void(*)( void* data, NodeId node, Work::State state );
+
+public:
+    /**************************
+     * a run context for graph, data is handed to the workers
+     * (@see GraphRun::data); the context keeps the graph alive
+     *************************/
+    explicit GraphRun( std::shared_ptr<const Graph> graph, void* data = nullptr )
+        : GraphRun( *graph, data )
+    {
+        m_keep_alive = std::move( graph );
+    }
+    /**************************
+     * waits for a run in progress
+     *************************/
+    ~GraphRun()
+    {
+        wait_for_done();
+    }
+    /**************************
+     * the run context a worker function was called by
+     *************************/
+    static GraphRun& of( const Work::Control& control )
+    {
+        return *static_cast<GraphRun*>( control.owner() );
+    }
+    /**************************
+     * runs graph as nested subgraph of the node of control on
+     * the executor of that node: the node is done only after
+     * the subgraph is done and fails if any node of it failed
+     * (the run context is created here and released at its end)
+     *************************/
+    static void spawn( const Work::Control& control, std::shared_ptr<const Graph> graph, void* data = nullptr )
+    {
+        GraphRun* run = new GraphRun( std::move( graph ), data );
+        control.retain();
+        run->start( control.executor() );
+        // a run which is done already calls the callback right away
+        run->on_done( [control, run]
+                      {
+                          Work::State state = Work::State::Completed;
+                          for( NodeId i = 0; i < run->m_counters.size(); ++i )
+                          {
+                              if ( run->get_state( i ) != Work::State::Completed )
+                                  state = Work::State::Failed;
+                          }
+                          delete run;
+                          control.release( state );
+                      } );
+    }
+    /**************************
+     * @see Graph::run
+     *************************/
+    void start( std::shared_ptr<Executor> executor = Executor::default_executor() )
+    {
+        start( std::move( executor ), GraphRun::no_deadline() );
+    }
+    /**************************
+     * @see Graph::run_until
+     *************************/
+    void start_until( detail::TimerService::Clock::time_point deadline,
+                      std::shared_ptr<Executor> executor = Executor::default_executor() )
+    {
+        start( std::move( executor ), deadline );
+    }
+    /**************************
+     * @see Graph::cancel
+     *************************/
+    void cancel()
+    {
+        m_cancel_requested = true;
+    }
+    /**************************
+     * @see Graph::wait_for_done
+     *************************/
+    void wait_for_done()
+    {
+        std::unique_lock<std::mutex> lock( m_done_mutex );
+        m_done_signal.wait( lock, [this]{ return m_finished; } );
+    }
+
+    template<typename Rep, typename Period>
+    bool wait_for_done( const std::chrono::duration<Rep, Period>& timeout )
+    {
+        std::unique_lock<std::mutex> lock( m_done_mutex );
+        return m_done_signal.wait_for( lock, timeout, [this]{ return m_finished; } );
+    }
+
+    template<typename Clock, typename Duration>
+    bool wait_until( const std::chrono::time_point<Clock, Duration>& deadline )
+    {
+        std::unique_lock<std::mutex> lock( m_done_mutex );
+        return m_done_signal.wait_until( lock, deadline, [this]{ return m_finished; } );
+    }
+    /**************************
+     * @see Graph::try_is_done
+     *************************/
+    bool try_is_done()
+    {
+        std::lock_guard<std::mutex> lock( m_done_mutex );
+        return m_finished;
+    }
+    /**************************
+     * @see Graph::on_done
+     *************************/
+    template<typename F>
+    void on_done( F&& callback )
+    {
+        {
+            std::lock_guard<std::mutex> lock( m_done_mutex );
+            if ( !m_finished )
+            {
+                m_callbacks.emplace_back( std::forward<F>( callback ) );
+                return;
+            }
+        }
+        callback();
+    }
+    /**************************
+     * @see Graph::reset
+     *************************/
+    void reset()
+    {
+        for( size_t i = 0; i < m_counters.size(); ++i )
+        {
+            m_counters[i].pending_parents.store( m_graph.m_parent_counts[i], std::memory_order_relaxed );
+            m_counters[i].failed_parents.store( 0, std::memory_order_relaxed );
+            m_counters[i].state.store( Work::State::Created, std::memory_order_relaxed );
+            m_counters[i].deadline = detail::TimerService::NoTimer;
+        }
+    }
+    /**************************
+     * @see Graph::get_state
+     *************************/
+    Work::State get_state( const NodeId node ) const
+    {
+        return m_counters[node].state.load();
+    }
+    /**************************
+     * the data given at construction
+     *************************/
+    void* data() const
+    {
+        return m_data;
+    }
+    /**************************
+     * f( data(), node, state ) is called once per node and run
+     * when its state is final, before its children are told;
+     * only to be set between runs
+     *************************/
+    void on_settled( SettledFunc f )
+    {
+        m_on_settled = f;
+    }
+    /**************************
+     * the graph which is run
+     *************************/
+    const Graph& graph() const
+    {
+        return m_graph;
+    }
+
+    GraphRun( const GraphRun& ) = delete;
+    GraphRun& operator=( const GraphRun& ) = delete;
+
+private:
+    /**************************
+     * what the caller of trigger has to do with the node
+     *   Launch - the node is Running and has to be started
+     *   Settle - the node got cancelled and has to be settled
+     *************************/
+    enum class Action
+    {
+        None,
+        Launch,
+        Settle
+    };
+    /**************************
+     * mutable part of a node
+     *************************/
+    struct Counter
+    {
+        std::atomic<NodeId>          pending_parents;
+        std::atomic<NodeId>          failed_parents;
+        std::atomic<Work::State>     state;
+        Work::Join                   join;
+        detail::TimerService::Handle deadline;
+    };
+
+private:
+    static detail::TimerService::Clock::time_point no_deadline()
+    {
+        return detail::TimerService::Clock::time_point::max();
+    }
+
+    void start( std::shared_ptr<Executor> executor, const detail::TimerService::Clock::time_point deadline )
+    {
+        wait_for_done();
+        reset();
+
+        const size_t node_count = m_graph.m_nodes.size();
+        m_executor = std::move( executor );
+        m_executor->reserve( m_graph.width() );
+        m_remaining = static_cast<NodeId>( node_count );
+        m_cancel_requested = false;
+        {
+            std::lock_guard<std::mutex> lock( m_done_mutex );
+            m_finished = node_count == 0;
+        }
+
+        if ( node_count == 0 )
+            return;
+
+        // cancelled by the end of the run (@see finish)
+        if ( deadline != GraphRun::no_deadline() )
+            m_run_deadline = detail::TimerService::instance().schedule( deadline, [this]{ expire_run(); } );
+
+        // the last root may finish the run and a waiter may destroy the
+        // graph and the run, which may hold the last reference to the
+        // executor: nothing of them is touched after it is handed off
+        const std::shared_ptr<Executor> keep_alive = m_executor;
+        const NodeId* const roots_end = m_graph.level_end( 0 );
+        for( const NodeId* root = m_graph.level_begin( 0 ); root != roots_end; ++root )
+        {
+            const NodeId i = *root;
+            switch( trigger( i, Work::State::Completed, Graph::NoNode ) )
+            {
+                default: break;
+                case GraphRun::Action::Launch:
+                    launch( i );
+                    break;
+                case GraphRun::Action::Settle:
+                    settle( i, Work::State::Cancelled );
+                    break;
+            }
+        }
+    }
+    /**************************
+     * the counters (and profile and metric stamps) are the only per node
+     * memory of a run, they are allocated in one block
+     *************************/
+    GraphRun( const Graph& graph, void* data )
+        : m_graph( graph )
+        , m_keep_alive()
+        , m_data( data )
+        , m_arena( GraphRun::block_size( graph.m_parent_counts.size() ) )
+        , m_counters( graph.m_parent_counts.size(), m_arena )
+#ifdef TREE_OF_WORK_PROFILING
+        , m_profile( graph.m_parent_counts.size(), m_arena )
+#endif
+#ifdef TREE_OF_WORK_COLLECT_METRICS
+        , m_metric_stamps( graph.m_parent_counts.size(), m_arena )
+#endif
+        , m_executor()
+        , m_remaining( 0 )
+        , m_done_mutex()
+        , m_done_signal()
+        , m_finished( true )
+        , m_callbacks()
+        , m_cancel_requested( false )
+        , m_run_deadline( detail::TimerService::NoTimer )
+        , m_on_settled( nullptr )
+    {}
+
+    static size_t block_size( const size_t node_count )
+    {
+        size_t size = 2 * detail::CacheAlignedArray<GraphRun::Counter>::CacheLine +
+                      node_count * sizeof(GraphRun::Counter);
+#ifdef TREE_OF_WORK_PROFILING
+        size += detail::CacheAlignedArray<detail::ProfileStamp>::CacheLine +
+                node_count * sizeof(detail::ProfileStamp);
+#endif
+#ifdef TREE_OF_WORK_COLLECT_METRICS
+        size += detail::CacheAlignedArray<detail::MetricStamp>::CacheLine +
+                node_count * sizeof(detail::MetricStamp);
+#endif
+        return size;
+    }
+    /**************************
+     * @see Work::trigger
+     *  parent is the node which calls trigger (NoNode for roots)
+     *************************/
+    GraphRun::Action trigger( const NodeId node, const Work::State parent_state, const NodeId parent )
+    {
+        static_cast<void>( parent );
+
+        const Graph::Node& description = m_graph.m_nodes[node];
+        const NodeId parent_count = m_graph.m_parent_counts[node];
+        GraphRun::Counter& counter = m_counters[node];
+        Work::State expected = Work::State::Created;
+
+        if ( parent_state != Work::State::Completed )
+        {
+            bool cancel_now = true;
+            if ( description.trigger_condition == Work::Conditional::OR && parent_count > 0 )
+                cancel_now = counter.failed_parents.fetch_add( 1, std::memory_order_acq_rel ) + 1 == parent_count;
+
+            if ( cancel_now &&
+                 counter.state.compare_exchange_strong( expected, Work::State::Cancelled,
+                                                        std::memory_order_acq_rel ) )
+            {
+                TREE_OF_WORK_METRIC( m_graph.m_metrics.cancelled(); )
+                return GraphRun::Action::Settle;
+            }
+            return GraphRun::Action::None;
+        }
+
+        bool run_now = false;
+        switch( description.trigger_condition )
+        {
+            default: break;
+            case Work::Conditional::OR:
+                run_now = true;
+                break;
+            case Work::Conditional::AND:
+                run_now = parent_count == 0 ||
+                          counter.pending_parents.fetch_sub( 1, std::memory_order_acq_rel ) == 1;
+                break;
+        }
+
+        if ( !run_now )
+            return GraphRun::Action::None;
+
+        if ( m_cancel_requested.load( std::memory_order_relaxed ) )
+        {
+            if ( counter.state.compare_exchange_strong( expected, Work::State::Cancelled,
+                                                        std::memory_order_acq_rel ) )
+            {
+                TREE_OF_WORK_METRIC( m_graph.m_metrics.cancelled(); )
+                return GraphRun::Action::Settle;
+            }
+            return GraphRun::Action::None;
+        }
+
+        if ( !counter.state.compare_exchange_strong( expected, Work::State::Running,
+                                                     std::memory_order_acq_rel ) )
+            return GraphRun::Action::None;
+
+        TREE_OF_WORK_PROFILE( m_profile[node].ready( parent == Graph::NoNode ? nullptr : this, parent ); )
+        TREE_OF_WORK_METRIC( m_metric_stamps[node].ready_ns = detail::metric_clock_ns(); )
+        return GraphRun::Action::Launch;
+    }
+    /**************************
+     * hands a Running node to the executor
+     *************************/
+    void launch( const NodeId node )
+    {
+        if ( m_graph.m_claim_offsets[node] == m_graph.m_claim_offsets[node + 1] )
+            submit( node );
+        else
+            admit( node, m_graph.m_claim_offsets[node] );
+    }
+
+    void submit( const NodeId node )
+    {
+        const Graph::Node& description = m_graph.m_nodes[node];
+        m_executor->submit( [this, node]{ execute( node ); }, description.priority, description.affinity );
+    }
+    /**************************
+     * @see Work::admit
+     *************************/
+    void admit( const NodeId node, NodeId next )
+    {
+        for( ; next < m_graph.m_claim_offsets[node + 1]; ++next )
+        {
+            const ResourceClaim& claim = m_graph.m_claims[next];
+            if ( !claim.pool->acquire( claim.count, [this, node, next]{ admit( node, next + 1 ); } ) )
+                return;
+        }
+        submit( node );
+    }
+    /**************************
+     * returns the tokens of a finished node
+     *************************/
+    void release( const NodeId node )
+    {
+        for( NodeId i = m_graph.m_claim_offsets[node]; i < m_graph.m_claim_offsets[node + 1]; ++i )
+            m_graph.m_claims[i].pool->release( m_graph.m_claims[i].count );
+    }
+    /**************************
+     * runs the worker unless the run was cancelled
+     * while the node was queued
+     *************************/
+    void execute( const NodeId node )
+    {
+        if ( m_cancel_requested.load( std::memory_order_relaxed ) )
+        {
+            release( node );
+            // the deadline of the run may have failed the queued node already
+            Work::State expected = Work::State::Running;
+            if ( !m_counters[node].state.compare_exchange_strong( expected, Work::State::Cancelled ) )
+            {
+                if ( m_remaining.fetch_sub( 1, std::memory_order_acq_rel ) == 1 )
+                    finish();
+                return;
+            }
+            TREE_OF_WORK_METRIC( m_graph.m_metrics.cancelled(); )
+            settle( node, Work::State::Cancelled );
+            return;
+        }
+        TREE_OF_WORK_PROFILE( m_profile[node].start(); )
+        TREE_OF_WORK_METRIC( m_metric_stamps[node].start_ns = detail::metric_clock_ns();
+                             m_graph.m_metrics.started( m_metric_stamps[node].start_ns - m_metric_stamps[node].ready_ns ); )
+        m_counters[node].join.reset();
+        if ( m_graph.m_nodes[node].timeout != detail::TimerService::Clock::duration::zero() )
+            m_counters[node].deadline = detail::TimerService::instance().schedule(
+                detail::TimerService::Clock::now() + m_graph.m_nodes[node].timeout, [this, node]{ expire( node ); } );
+        m_graph.m_nodes[node].worker( Work::Control( this, node, &GraphRun::notify, &m_executor,
+                                                     &m_counters[node].join ) );
+    }
+    /**************************
+     * timer callback, the deadline of a running node passed:
+     * it fails and its children are settled now, the run is
+     * done only once the worker returned (@see done)
+     *************************/
+    void expire( const NodeId node )
+    {
+        Work::State expected = Work::State::Running;
+        if ( !m_counters[node].state.compare_exchange_strong( expected, Work::State::Failed ) )
+            return;
+
+        m_remaining.fetch_add( 1, std::memory_order_relaxed );
+        settle( node, Work::State::Failed );
+    }
+    /**************************
+     * timer callback, the deadline of the run passed
+     *************************/
+    void expire_run()
+    {
+        // the run may not finish before the last node was visited,
+        // a run which is finishing already waits for this call (@see finish)
+        NodeId remaining = m_remaining.load();
+        do
+        {
+            if ( remaining == 0 )
+                return;
+        }
+        while( !m_remaining.compare_exchange_weak( remaining, remaining + 1 ) );
+
+        m_cancel_requested = true;
+        for( NodeId node = 0; node < m_counters.size(); ++node )
+        {
+            if ( m_counters[node].state.load( std::memory_order_relaxed ) == Work::State::Running )
+                expire( node );
+        }
+        if ( m_remaining.fetch_sub( 1, std::memory_order_acq_rel ) == 1 )
+            finish();
+    }
+    /**************************
+     * Control::NotifyFunc of all nodes
+     *************************/
+    static void notify( void* owner, std::uint32_t node, Work::State result )
+    {
+        static_cast<GraphRun*>( owner )->done( node, result );
+    }
+    /**************************
+     * @see Work::done
+     *************************/
+    void done( const NodeId node, const Work::State result )
+    {
+        GraphRun::Counter& counter = m_counters[node];
+        // waits for an expiry in progress
+        if ( counter.deadline != detail::TimerService::NoTimer )
+        {
+            detail::TimerService::instance().cancel( counter.deadline );
+            counter.deadline = detail::TimerService::NoTimer;
+        }
+
+        Work::State expected = Work::State::Running;
+        const bool in_time = counter.state.compare_exchange_strong( expected, result );
+
+        TREE_OF_WORK_PROFILE( m_profile[node].end( this, node ); )
+        TREE_OF_WORK_METRIC( m_graph.m_metrics.finished( in_time && result == Work::State::Completed,
+                                                         detail::metric_clock_ns() - m_metric_stamps[node].start_ns ); )
+        release( node );
+
+        // an expired node is settled already, it only held the run
+        if ( !in_time )
+        {
+            if ( m_remaining.fetch_sub( 1, std::memory_order_acq_rel ) == 1 )
+                finish();
+            return;
+        }
+        settle( node, result );
+    }
+    /**************************
+     * informs the children of a node about its result,
+     * children which got cancelled by it are settled in
+     * the same pass
+     *
+     * the child with the highest priority (the last one among
+     * equals) which became ready runs as continuation on this
+     * thread if the executor allows it
+     *************************/
+    void settle( NodeId node, Work::State result )
+    {
+        NodeId settled = 0;
+        NodeId continuation = Graph::NoNode;
+        std::vector<NodeId> cancelled;
+        for( ;; )
+        {
+            if ( m_on_settled != nullptr )
+                m_on_settled( m_data, node, result );
+
+            const NodeId begin = m_graph.m_child_offsets[node];
+            const NodeId end   = m_graph.m_child_offsets[node + 1];
+            for( NodeId i = begin; i < end; ++i )
+            {
+                const NodeId child = m_graph.m_children[i];
+                switch( trigger( child, result, node ) )
+                {
+                    default: break;
+                    case GraphRun::Action::Launch:
+                        if ( continuation == Graph::NoNode )
+                        {
+                            continuation = child;
+                        }
+                        else if ( m_graph.m_nodes[child].priority < m_graph.m_nodes[continuation].priority )
+                        {
+                            launch( child );
+                        }
+                        else
+                        {
+                            launch( continuation );
+                            continuation = child;
+                        }
+                        break;
+                    case GraphRun::Action::Settle:
+                        cancelled.push_back( child );
+                        break;
+                }
+            }
+            settled++;
+
+            if ( cancelled.empty() )
+                break;
+
+            node = cancelled.back();
+            result = Work::State::Cancelled;
+            cancelled.pop_back();
+        }
+
+        // the run can not finish while the continuation is pending
+        if ( m_remaining.fetch_sub( settled, std::memory_order_acq_rel ) == settled )
+        {
+            finish();
+            return;
+        }
+
+        if ( continuation != Graph::NoNode &&
+             ( m_graph.m_claim_offsets[continuation] != m_graph.m_claim_offsets[continuation + 1] ||
+               !m_executor->run_as_continuation( [this, continuation]{ execute( continuation ); } ) ) )
+            launch( continuation );
+    }
+
+    /**************************
+     * the last node settled
+     *************************/
+    void finish()
+    {
+        // waits for an expiry of the run in progress
+        if ( m_run_deadline != detail::TimerService::NoTimer )
+        {
+            detail::TimerService::instance().cancel( m_run_deadline );
+            m_run_deadline = detail::TimerService::NoTimer;
+        }
+
+        std::vector<Graph::Callback> callbacks;
+        {
+            std::lock_guard<std::mutex> lock( m_done_mutex );
+            m_finished = true;
+            callbacks.swap( m_callbacks );
+            m_done_signal.notify_all();
+        }
+        // the run may be destroyed by a callback, it is not touched anymore
+        for( Graph::Callback& callback : callbacks )
+            callback();
+    }
+
+private:
+    const Graph&                                    m_graph;
+    std::shared_ptr<const Graph>                    m_keep_alive;
+    void*                                           m_data;
+    Arena                                           m_arena;
+    detail::CacheAlignedArray<GraphRun::Counter>    m_counters;
+#ifdef TREE_OF_WORK_PROFILING
+    detail::CacheAlignedArray<detail::ProfileStamp> m_profile;
+#endif
+#ifdef TREE_OF_WORK_COLLECT_METRICS
+    detail::CacheAlignedArray<detail::MetricStamp>  m_metric_stamps;
+#endif
+    std::shared_ptr<Executor>                       m_executor;
+    std::atomic<NodeId>                             m_remaining;
+    std::mutex                                      m_done_mutex;
+    std::condition_variable                         m_done_signal;
+    bool                                            m_finished;
+    std::vector<Graph::Callback>                    m_callbacks;
+    std::atomic<bool>                               m_cancel_requested;
+    detail::TimerService::Handle                    m_run_deadline;
+    GraphRun::SettledFunc                           m_on_settled;
+};
+
+/**************************
+ * Graph members which forward to the built-in run context
+ *************************/
+inline Graph::Graph( std::shared_ptr<Arena> arena )
+    : m_arena( std::move( arena ) )
+    , m_nodes( ArenaAllocator<Graph::Node>( m_arena.get() ) )
+    , m_parent_counts( ArenaAllocator<NodeId>( m_arena.get() ) )
+    , m_child_offsets( ArenaAllocator<NodeId>( m_arena.get() ) )
+    , m_children( ArenaAllocator<NodeId>( m_arena.get() ) )
+    , m_order( ArenaAllocator<NodeId>( m_arena.get() ) )
+    , m_level_offsets( ArenaAllocator<NodeId>( m_arena.get() ) )
+    , m_width( 0 )
+    , m_claim_offsets( ArenaAllocator<NodeId>( m_arena.get() ) )
+    , m_claims( ArenaAllocator<ResourceClaim>( m_arena.get() ) )
+    , m_name_ids( ArenaAllocator<NodeId>( m_arena.get() ) )
+    , m_name_offsets( ArenaAllocator<NodeId>( m_arena.get() ) )
+    , m_name_chars( ArenaAllocator<char>( m_arena.get() ) )
+    , m_run()
+#ifdef TREE_OF_WORK_COLLECT_METRICS
+    , m_metrics()
+#endif
+{}
+
+inline Graph::~Graph()
+{}
+
+inline void Graph::create_run()
+{
+    m_run.reset( new GraphRun( *this, nullptr ) );
+}
+
+inline void Graph::run( std::shared_ptr<Executor> executor )
+{
+    m_run->start( std::move( executor ) );
+}
+
+inline void Graph::run_until( detail::TimerService::Clock::time_point deadline, std::shared_ptr<Executor> executor )
+{
+    m_run->start_until( deadline, std::move( executor ) );
+}
+
+inline void Graph::cancel()
+{
+    m_run->cancel();
+}
+
+inline void Graph::wait_for_done()
+{
+    m_run->wait_for_done();
+}
+
+template<typename Rep, typename Period>
+bool Graph::wait_for_done( const std::chrono::duration<Rep, Period>& timeout )
+{
+    return m_run->wait_for_done( timeout );
+}
+
+template<typename Clock, typename Duration>
+bool Graph::wait_until( const std::chrono::time_point<Clock, Duration>& deadline )
+{
+    return m_run->wait_until( deadline );
+}
+
+inline bool Graph::try_is_done()
+{
+    return m_run->try_is_done();
+}
+
+template<typename F>
+void Graph::on_done( F&& callback )
+{
+    m_run->on_done( std::forward<F>( callback ) );
+}
+
+inline void Graph::reset()
+{
+    m_run->reset();
+}
+
+inline Work::State Graph::get_state( const NodeId node ) const
+{
+    return m_run->get_state( node );
+}
+
+/**************************
+ * Collects nodes and their relationships with the same
+ * calls as Work and compiles them into a Graph.
+ *
+ *************************/
+class GraphBuilder
+{
+public:
+    using NodeId  = Graph::NodeId;
+    using NodeSet = std::vector<NodeId>;
+    /**************************
+     * how compile() assigns node priorities
+     *   Explicit     - the priorities given with set_priority (default 0)
+     *   CriticalPath - the length (in nodes) of the longest path from
+     *                  the node to a leaf, so nodes with the most
+     *                  work remaining behind them run first
+     *************************/
+    enum class Ranking
+    {
+        Explicit,
+        CriticalPath
+    };
+
+public:
+    /**************************
+     * the compiled graphs allocate from a new arena
+     *************************/
+    GraphBuilder()
+        : m_arena( std::make_shared<Arena>() )
+        , m_nodes()
+        , m_edges()
+    {}
+    /**************************
+     * the compiled graphs allocate from the given arena
+     *************************/
+    explicit GraphBuilder( std::shared_ptr<Arena> arena )
+        : m_arena( std::move( arena ) )
+        , m_nodes()
+        , m_edges()
+    {}
+#ifdef TREE_OF_WORK_HAS_PMR
+    /**************************
+     * the compiled graphs allocate from an arena on top
+     * of the given memory resource
+     *************************/
+    explicit GraphBuilder( std::pmr::memory_resource* upstream )
+        : m_arena( std::make_shared<Arena>( upstream ) )
+        , m_nodes()
+        , m_edges()
+    {}
+#endif
+    /**************************
+     * reserve space for the expected number of nodes and edges
+     *************************/
+    void reserve( size_t nodes, size_t edges )
+    {
+        m_nodes.reserve( nodes );
+        m_edges.reserve( edges );
+    }
+    /**************************
+     * add a node defined by its worker function
+     * (any callable void(const Work::Control&))
+     *************************/
+    template<typename F>
+    NodeId add( F&& f )
+    {
+        m_nodes.push_back( { Work::Worker( std::forward<F>( f ) ), Work::Conditional::OR, 0, Affinity(), {}, {},
+                             detail::TimerService::Clock::duration::zero() } );
+        return static_cast<NodeId>( m_nodes.size() - 1 );
+    }
+    /**************************
+     * adds an empty always true node
+     *************************/
+    NodeId add_empty_root()
+    {
+        return add( [](const Work::Control& control)
+                    {
+                        control.set_completed();
+                    } );
+    }
+    /**************************
+     * name of a node, used to bind its worker again when a
+     * saved graph is loaded (@see GraphFile)
+     *************************/
+    void set_name( const NodeId node, std::string name )
+    {
+        m_nodes[node].name = std::move( name );
+    }
+    /**************************
+     * scheduling priority of a node, @see Work::set_priority
+     *************************/
+    void set_priority( const NodeId node, int priority )
+    {
+        m_nodes[node].priority = priority;
+    }
+    /**************************
+     * placement hint of a node or of a set of nodes
+     * (e.g. a subtree), @see Affinity
+     *************************/
+    void set_affinity( const NodeId node, Affinity affinity )
+    {
+        m_nodes[node].affinity = affinity;
+    }
+    void set_affinity( const NodeSet& nodes, Affinity affinity )
+    {
+        for( const NodeId node : nodes )
+            m_nodes[node].affinity = affinity;
+    }
+    /**************************
+     * deadline of a node or of a set of nodes from the start
+     * of the worker, @see Work::set_timeout
+     *************************/
+    template<typename Rep, typename Period>
+    void set_timeout( const NodeId node, const std::chrono::duration<Rep, Period>& timeout )
+    {
+        m_nodes[node].timeout = std::chrono::duration_cast<detail::TimerService::Clock::duration>( timeout );
+    }
+    template<typename Rep, typename Period>
+    void set_timeout( const NodeSet& nodes, const std::chrono::duration<Rep, Period>& timeout )
+    {
+        for( const NodeId node : nodes )
+            set_timeout( node, timeout );
+    }
+    /**************************
+     * a node or a set of nodes needs count tokens of pool
+     * to run, @see Work::require
+     *************************/
+    void require( const NodeId node, std::shared_ptr<ResourcePool> pool, size_t count = 1 )
+    {
+        detail::add_claim( m_nodes[node].claims, std::move( pool ), count );
+    }
+    void require( const NodeSet& nodes, const std::shared_ptr<ResourcePool>& pool, size_t count = 1 )
+    {
+        for( const NodeId node : nodes )
+            detail::add_claim( m_nodes[node].claims, pool, count );
+    }
+    /**************************
+     * construct an AND relationship between given sets of nodes
+     *************************/
+    void execute_if_all_finished( const NodeSet& parents,
+                                  const NodeSet& children )
+    {
+        connect( parents, children, Work::Conditional::AND );
+    }
+    /**************************
+     * construct an OR relationship between given sets of nodes
+     *************************/
+    void execute_if_any_finished( const NodeSet& parents,
+                                  const NodeSet& children )
+    {
+        connect( parents, children, Work::Conditional::OR );
+    }
+    /**************************
+     * bulk edge construction: every child becomes a child of
+     * every parent with the trigger condition c
+     * (@see Work::connect)
+     *************************/
+    void connect( const NodeSet& parents,
+                  const NodeSet& children,
+                  const Work::Conditional c )
+    {
+        for( const NodeId child : children )
+            m_nodes[child].trigger_condition = c;
+
+        const size_t required = m_edges.size() + parents.size() * children.size();
+        if ( required > m_edges.capacity() )
+            m_edges.reserve( std::max( required, 2 * m_edges.capacity() ) );
+
+        for( const NodeId parent : parents )
+        {
+            for( const NodeId child : children )
+                m_edges.push_back( { parent, child } );
+        }
+    }
+    /**************************
+     * connects parents and children through an empty barrier node
+     * (@see Work::make_barrier)
+     *************************/
+    NodeId add_barrier( const NodeSet& parents,
+                        const NodeSet& children,
+                        const Work::Conditional c = Work::Conditional::AND )
+    {
+        const NodeId barrier = add_empty_root();
+        connect( parents, { barrier }, c );
+        connect( { barrier }, children, Work::Conditional::AND );
+        return barrier;
+    }
+    /**************************
+     * creates the flat graph representation
+     * the worker functions are moved into the graph,
+     * the builder is empty afterwards
+     *
+     * throws GraphError (and leaves the builder unchanged)
+     * if the relationships contain a cycle
+     * @see GraphBuilder::Ranking
+     *************************/
+    std::shared_ptr<Graph> compile( const GraphBuilder::Ranking ranking = GraphBuilder::Ranking::Explicit )
+    {
+        const size_t node_count = m_nodes.size();
+        std::shared_ptr<Graph> graph( new Graph( m_arena ) );
+        Graph* g = graph.get();
+
+        // counting sort of the edges by parent
+        g->m_parent_counts.assign( node_count, 0 );
+        g->m_child_offsets.assign( node_count + 1, 0 );
+        for( const Edge& e : m_edges )
+        {
+            g->m_child_offsets[e.parent + 1]++;
+            g->m_parent_counts[e.child]++;
+        }
+        for( size_t i = 0; i < node_count; ++i )
+            g->m_child_offsets[i + 1] += g->m_child_offsets[i];
+
+        g->m_children.resize( m_edges.size() );
+        std::vector<NodeId> fill( g->m_child_offsets.begin(), g->m_child_offsets.end() - 1 );
+        for( const Edge& e : m_edges )
+            g->m_children[fill[e.parent]++] = e.child;
+
+        sort_topologically( *g );
+
+        g->m_nodes.reserve( node_count );
+        for( NodeId i = 0; i < node_count; ++i )
+        {
+            g->m_nodes.push_back( { std::move( m_nodes[i].worker ),
+                                    m_nodes[i].trigger_condition,
+                                    m_nodes[i].priority,
+                                    m_nodes[i].affinity,
+                                    m_nodes[i].timeout } );
+        }
+
+        // claims in CSR layout like the children
+        g->m_claim_offsets.assign( node_count + 1, 0 );
+        for( NodeId i = 0; i < node_count; ++i )
+            g->m_claim_offsets[i + 1] = g->m_claim_offsets[i] + static_cast<NodeId>( m_nodes[i].claims.size() );
+        g->m_claims.reserve( g->m_claim_offsets[node_count] );
+        for( const GraphBuilder::Node& node : m_nodes )
+            g->m_claims.insert( g->m_claims.end(), node.claims.begin(), node.claims.end() );
+
+        GraphBuilder::compile_names( *g, m_nodes );
+
+        if ( ranking == GraphBuilder::Ranking::CriticalPath )
+            GraphBuilder::rank_by_critical_path( *g );
+
+        g->create_run();
+        g->reset();
+
+        m_nodes.clear();
+        m_edges.clear();
+
+        return graph;
+    }
+
+private:
+    struct Node
+    {
+        Work::Worker                          worker;
+        Work::Conditional                     trigger_condition;
+        int                                   priority;
+        Affinity                              affinity;
+        std::vector<ResourceClaim>            claims;
+        std::string                           name;
+        detail::TimerService::Clock::duration timeout;
+    };
+    struct Edge
+    {
+        NodeId parent;
+        NodeId child;
+    };
+
+private:
+    /**************************
+     * topological order (Kahn) of the CSR children, one level
+     * after the other; throws GraphError if nodes are left over
+     *************************/
+    void sort_topologically( Graph& g ) const
+    {
+        const size_t node_count = g.m_parent_counts.size();
+        std::vector<NodeId> pending( g.m_parent_counts.begin(), g.m_parent_counts.end() );
+
+        g.m_order.reserve( node_count );
+        g.m_level_offsets.reserve( node_count + 1 );
+        g.m_level_offsets.push_back( 0 );
+        for( NodeId i = 0; i < node_count; ++i )
+        {
+            if ( pending[i] == 0 )
+                g.m_order.push_back( i );
+        }
+        for( size_t begin = 0; begin < g.m_order.size(); )
+        {
+            const size_t end = g.m_order.size();
+            for( size_t k = begin; k < end; ++k )
+            {
+                const NodeId node = g.m_order[k];
+                for( NodeId i = g.m_child_offsets[node]; i < g.m_child_offsets[node + 1]; ++i )
+                {
+                    if ( --pending[g.m_children[i]] == 0 )
+                        g.m_order.push_back( g.m_children[i] );
+                }
+            }
+            g.m_level_offsets.push_back( static_cast<NodeId>( end ) );
+            g.m_width = std::max( g.m_width, end - begin );
+            begin = end;
+        }
+
+        if ( g.m_order.size() != node_count )
+            reject_cycle( pending );
+    }
+    /**************************
+     * every node left over by sort_topologically waits for a
+     * left over parent, following them backwards ends in a cycle
+     *************************/
+    [[noreturn]] void reject_cycle( const std::vector<NodeId>& pending ) const
+    {
+        std::vector<NodeId> unreachable;
+        std::vector<NodeId> blocking_parent( pending.size(), NodeId( Graph::NoNode ) );
+        for( NodeId i = 0; i < pending.size(); ++i )
+        {
+            if ( pending[i] != 0 )
+                unreachable.push_back( i );
+        }
+        for( const Edge& e : m_edges )
+        {
+            if ( pending[e.parent] != 0 && pending[e.child] != 0 )
+                blocking_parent[e.child] = e.parent;
+        }
+
+        std::vector<NodeId> step( pending.size(), NodeId( Graph::NoNode ) );
+        std::vector<NodeId> path;
+        NodeId node = unreachable.front();
+        while( step[node] == Graph::NoNode )
+        {
+            step[node] = static_cast<NodeId>( path.size() );
+            path.push_back( node );
+            node = blocking_parent[node];
+        }
+
+        // the path runs from child to parent, the cycle is reported parent first
+        std::vector<NodeId> cycle( path.rbegin(), path.rend() - step[node] );
+        throw GraphError( std::move( cycle ), std::move( unreachable ) );
+    }
+    /**************************
+     * node names as one table of distinct, NUL terminated names
+     * and a name index per node (nothing if no node is named)
+     *************************/
+    static void compile_names( Graph& g, const std::vector<GraphBuilder::Node>& nodes )
+    {
+        std::unordered_map<std::string, NodeId> ids;
+        std::vector<NodeId> name_ids;
+        std::vector<NodeId> offsets;
+        std::vector<char> chars;
+        name_ids.reserve( nodes.size() );
+        for( const GraphBuilder::Node& node : nodes )
+        {
+            if ( node.name.empty() )
+            {
+                name_ids.push_back( NodeId( Graph::NoNode ) );
+                continue;
+            }
+
+            auto id = ids.insert( std::make_pair( node.name, static_cast<NodeId>( ids.size() ) ) );
+            if ( id.second )
+            {
+                offsets.push_back( static_cast<NodeId>( chars.size() ) );
+                chars.insert( chars.end(), node.name.begin(), node.name.end() );
+                chars.push_back( '\0' );
+            }
+            name_ids.push_back( id.first->second );
+        }
+
+        if ( ids.empty() )
+            return;
+
+        offsets.push_back( static_cast<NodeId>( chars.size() ) );
+        g.m_name_ids.assign( name_ids.begin(), name_ids.end() );
+        g.m_name_offsets.assign( offsets.begin(), offsets.end() );
+        g.m_name_chars.assign( chars.begin(), chars.end() );
+    }
+    /**************************
+     * priority = longest path (in nodes) to a leaf, computed
+     * in reverse topological order on the CSR children
+     *************************/
+    static void rank_by_critical_path( Graph& g )
+    {
+        const detail::ArenaVector<NodeId>& order = g.m_order;
+        for( size_t k = order.size(); k-- > 0; )
+        {
+            const NodeId node = order[k];
+            int rank = 0;
+            for( NodeId i = g.m_child_offsets[node]; i < g.m_child_offsets[node + 1]; ++i )
+                rank = std::max( rank, g.m_nodes[g.m_children[i]].priority );
+            g.m_nodes[node].priority = rank + 1;
+        }
+    }
+
+private:
+    std::shared_ptr<Arena>          m_arena;
+    std::vector<GraphBuilder::Node> m_nodes;
+    std::vector<GraphBuilder::Edge> m_edges;
+};
+
+}
+
+#endif /* TREE_OF_WORK_GRAPH */
@@ -0,0 +1,361 @@
+/********************************************************************************
+ * MIT License
+ *
+ * Copyright (c) 2020 Christian Kranz
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ * 
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ * 
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ *******************************************************************************/
+#ifndef TREE_OF_WORK_METRICS
+#define TREE_OF_WORK_METRICS
+
+/**************************
+ * Runtime metrics are only collected if TREE_OF_WORK_COLLECT_METRICS
+ * is defined (e.g. -DTREE_OF_WORK_COLLECT_METRICS), otherwise
+ * TREE_OF_WORK_METRIC( ... ) expands to nothing and nodes and
+ * executors carry no metric state at all.
+ *************************/
+#ifdef TREE_OF_WORK_COLLECT_METRICS
+#define TREE_OF_WORK_METRIC( ... ) __VA_ARGS__
+#else
+#define TREE_OF_WORK_METRIC( ... )
+#endif
+
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <ostream>
+#include <string>
+#include <vector>
+
+namespace TreeOfWork
+{
+/**************************
+ * Histogram of durations in nanoseconds with power of two
+ * buckets: bucket i counts the values below 2^i ns (and at
+ * least 2^(i-1) ns), the last bucket everything above.
+ * All counters are relaxed atomics.
+ *************************/
+class Histogram
+{
+public:
+    static const size_t Buckets = 40;
+
+    struct Snapshot
+    {
+        std::vector<std::uint64_t> buckets;
+        std::uint64_t              count;
+        std::int64_t               sum_ns;
+    };
+
+public:
+    Histogram()
+        : m_buckets()
+        , m_sum_ns( 0 )
+    {
+        for( std::atomic<std::uint64_t>& bucket : m_buckets )
+            bucket.store( 0, std::memory_order_relaxed );
+    }
+    /**************************
+     *
+     *************************/
+    void record( std::int64_t ns )
+    {
+        if ( ns < 0 )
+            ns = 0;
+
+        size_t bucket = 0;
+        for( std::uint64_t v = static_cast<std::uint64_t>( ns ); v != 0 && bucket + 1 < Histogram::Buckets; v >>= 1 )
+            ++bucket;
+
+        m_buckets[bucket].fetch_add( 1, std::memory_order_relaxed );
+        m_sum_ns.fetch_add( ns, std::memory_order_relaxed );
+    }
+    /**************************
+     * upper bound of bucket i in nanoseconds
+     *************************/
+    static std::int64_t upper_bound_ns( size_t i )
+    {
+        return std::int64_t( 1 ) << i;
+    }
+    /**************************
+     * a consistent copy is only guaranteed while nothing is recorded
+     *************************/
+    Histogram::Snapshot snapshot() const
+    {
+        Histogram::Snapshot s = { std::vector<std::uint64_t>( Histogram::Buckets ), 0,
+                                  m_sum_ns.load( std::memory_order_relaxed ) };
+        for( size_t i = 0; i < Histogram::Buckets; ++i )
+        {
+            s.buckets[i] = m_buckets[i].load( std::memory_order_relaxed );
+            s.count += s.buckets[i];
+        }
+        return s;
+    }
+
+    Histogram( const Histogram& ) = delete;
+    Histogram& operator=( const Histogram& ) = delete;
+
+private:
+    std::atomic<std::uint64_t> m_buckets[Histogram::Buckets];
+    std::atomic<std::int64_t>  m_sum_ns;
+};
+
+namespace detail
+{
+inline std::int64_t metric_clock_ns()
+{
+    return std::chrono::duration_cast<std::chrono::nanoseconds>(
+               std::chrono::steady_clock::now().time_since_epoch() ).count();
+}
+}
+
+/**************************
+ * Node metrics of a graph (@see Graph::metrics) or of all
+ * Work nodes (@see NodeMetrics::global):
+ *   started, completed, failed, cancelled - node counts
+ *   wait     - time from ready (last parent done) to start
+ *   duration - time from start to done
+ *************************/
+class NodeMetrics
+{
+public:
+    struct Snapshot
+    {
+        std::uint64_t       started;
+        std::uint64_t       completed;
+        std::uint64_t       failed;
+        std::uint64_t       cancelled;
+        Histogram::Snapshot wait;
+        Histogram::Snapshot duration;
+    };
+
+public:
+    NodeMetrics()
+        : m_started( 0 )
+        , m_completed( 0 )
+        , m_failed( 0 )
+        , m_cancelled( 0 )
+        , m_wait()
+        , m_duration()
+    {}
+    /**************************
+     * metrics of all Work nodes
+     *************************/
+    static NodeMetrics& global()
+    {
+        static NodeMetrics metrics;
+        return metrics;
+    }
+
+    void started( std::int64_t wait_ns )
+    {
+        m_started.fetch_add( 1, std::memory_order_relaxed );
+        m_wait.record( wait_ns );
+    }
+
+    void finished( bool completed, std::int64_t duration_ns )
+    {
+        ( completed ? m_completed : m_failed ).fetch_add( 1, std::memory_order_relaxed );
+        m_duration.record( duration_ns );
+    }
+
+    void cancelled()
+    {
+        m_cancelled.fetch_add( 1, std::memory_order_relaxed );
+    }
+
+    NodeMetrics::Snapshot snapshot() const
+    {
+        return { m_started.load( std::memory_order_relaxed ),
+                 m_completed.load( std::memory_order_relaxed ),
+                 m_failed.load( std::memory_order_relaxed ),
+                 m_cancelled.load( std::memory_order_relaxed ),
+                 m_wait.snapshot(),
+                 m_duration.snapshot() };
+    }
+
+    NodeMetrics( const NodeMetrics& ) = delete;
+    NodeMetrics& operator=( const NodeMetrics& ) = delete;
+
+private:
+    std::atomic<std::uint64_t> m_started;
+    std::atomic<std::uint64_t> m_completed;
+    std::atomic<std::uint64_t> m_failed;
+    std::atomic<std::uint64_t> m_cancelled;
+    Histogram                  m_wait;
+    Histogram                  m_duration;
+};
+
+/**************************
+ * Executor metrics (@see Executor::metrics):
+ *   submitted, executed - task counts
+ *   stolen              - tasks taken from another worker
+ *   queue_depth         - submitted tasks not started yet
+ *   utilization         - busy time / ( threads * lifetime )
+ *************************/
+class ExecutorMetrics
+{
+public:
+    struct Snapshot
+    {
+        std::uint64_t submitted;
+        std::uint64_t executed;
+        std::uint64_t stolen;
+        std::uint64_t queue_depth;
+        size_t        threads;
+        std::int64_t  busy_ns;
+        std::int64_t  elapsed_ns;
+        double        utilization;
+    };
+
+public:
+    ExecutorMetrics()
+        : m_submitted( 0 )
+        , m_started( 0 )
+        , m_executed( 0 )
+        , m_stolen( 0 )
+        , m_busy_ns( 0 )
+        , m_threads( 0 )
+        , m_epoch_ns( detail::metric_clock_ns() )
+    {}
+    /**************************
+     * number of threads the executor runs tasks on
+     * (0 for executors without a fixed number)
+     *************************/
+    void set_threads( size_t threads )
+    {
+        m_threads.store( threads, std::memory_order_relaxed );
+    }
+
+    void submitted()
+    {
+        m_submitted.fetch_add( 1, std::memory_order_relaxed );
+    }
+
+    void stolen()
+    {
+        m_stolen.fetch_add( 1, std::memory_order_relaxed );
+    }
+
+    void started()
+    {
+        m_started.fetch_add( 1, std::memory_order_relaxed );
+    }
+
+    void executed( std::int64_t busy_ns )
+    {
+        m_executed.fetch_add( 1, std::memory_order_relaxed );
+        m_busy_ns.fetch_add( busy_ns, std::memory_order_relaxed );
+    }
+
+    ExecutorMetrics::Snapshot snapshot() const
+    {
+        ExecutorMetrics::Snapshot s;
+        const std::uint64_t started = m_started.load( std::memory_order_relaxed );
+        s.submitted   = m_submitted.load( std::memory_order_relaxed );
+        s.executed    = m_executed.load( std::memory_order_relaxed );
+        s.stolen      = m_stolen.load( std::memory_order_relaxed );
+        s.queue_depth = s.submitted > started ? s.submitted - started : 0;
+        s.threads     = m_threads.load( std::memory_order_relaxed );
+        s.busy_ns     = m_busy_ns.load( std::memory_order_relaxed );
+        s.elapsed_ns  = detail::metric_clock_ns() - m_epoch_ns;
+        s.utilization = s.threads > 0 && s.elapsed_ns > 0 ?
+                        double( s.busy_ns ) / ( double( s.threads ) * double( s.elapsed_ns ) ) : 0.0;
+        return s;
+    }
+
+    ExecutorMetrics( const ExecutorMetrics& ) = delete;
+    ExecutorMetrics& operator=( const ExecutorMetrics& ) = delete;
+
+private:
+    std::atomic<std::uint64_t> m_submitted;
+    std::atomic<std::uint64_t> m_started;
+    std::atomic<std::uint64_t> m_executed;
+    std::atomic<std::uint64_t> m_stolen;
+    std::atomic<std::int64_t>  m_busy_ns;
+    std::atomic<size_t>        m_threads;
+    const std::int64_t         m_epoch_ns;
+};
+
+namespace detail
+{
+/**************************
+ * per node timestamps of the metrics
+ *************************/
+struct MetricStamp
+{
+    std::int64_t ready_ns;
+    std::int64_t start_ns;
+};
+
+inline void write_prometheus_value( std::ostream& os, const char* name, const char* type,
+                                    const std::string& labels, double value )
+{
+    os << "# TYPE " << name << " " << type << "\n"
+       << name << "{" << labels << "} " << value << "\n";
+}
+
+inline void write_prometheus_histogram( std::ostream& os, const char* name,
+                                        const std::string& labels, const Histogram::Snapshot& h )
+{
+    const std::string separator = labels.empty() ? "" : ",";
+    os << "# TYPE " << name << " histogram\n";
+
+    std::uint64_t cumulative = 0;
+    for( size_t i = 0; i < h.buckets.size(); ++i )
+    {
+        cumulative += h.buckets[i];
+        if ( i + 1 < h.buckets.size() )
+            os << name << "_bucket{" << labels << separator << "le=\""
+               << double( Histogram::upper_bound_ns( i ) ) / 1e9 << "\"} " << cumulative << "\n";
+    }
+    os << name << "_bucket{" << labels << separator << "le=\"+Inf\"} " << h.count << "\n"
+       << name << "_sum{" << labels << "} " << double( h.sum_ns ) / 1e9 << "\n"
+       << name << "_count{" << labels << "} " << h.count << "\n";
+}
+}
+
+/**************************
+ * writes a snapshot in the Prometheus text exposition format,
+ * labels are added to every sample, e.g. graph="ingest"
+ *************************/
+inline void write_prometheus( std::ostream& os, const NodeMetrics::Snapshot& s, const std::string& labels = "" )
+{
+    detail::write_prometheus_value( os, "tree_of_work_nodes_started_total", "counter", labels, double( s.started ) );
+    detail::write_prometheus_value( os, "tree_of_work_nodes_completed_total", "counter", labels, double( s.completed ) );
+    detail::write_prometheus_value( os, "tree_of_work_nodes_failed_total", "counter", labels, double( s.failed ) );
+    detail::write_prometheus_value( os, "tree_of_work_nodes_cancelled_total", "counter", labels, double( s.cancelled ) );
+    detail::write_prometheus_histogram( os, "tree_of_work_node_wait_seconds", labels, s.wait );
+    detail::write_prometheus_histogram( os, "tree_of_work_node_duration_seconds", labels, s.duration );
+}
+
+inline void write_prometheus( std::ostream& os, const ExecutorMetrics::Snapshot& s, const std::string& labels = "" )
+{
+    detail::write_prometheus_value( os, "tree_of_work_tasks_submitted_total", "counter", labels, double( s.submitted ) );
+    detail::write_prometheus_value( os, "tree_of_work_tasks_executed_total", "counter", labels, double( s.executed ) );
+    detail::write_prometheus_value( os, "tree_of_work_tasks_stolen_total", "counter", labels, double( s.stolen ) );
+    detail::write_prometheus_value( os, "tree_of_work_queue_depth", "gauge", labels, double( s.queue_depth ) );
+    detail::write_prometheus_value( os, "tree_of_work_threads", "gauge", labels, double( s.threads ) );
+    detail::write_prometheus_value( os, "tree_of_work_busy_seconds_total", "counter", labels, double( s.busy_ns ) / 1e9 );
+    detail::write_prometheus_value( os, "tree_of_work_utilization", "gauge", labels, s.utilization );
+}
+
+}
+
+#endif /* TREE_OF_WORK_METRICS */
@@ -0,0 +1,260 @@
+/********************************************************************************
+ * MIT License
+ *
+ * Copyright (c) 2020 Christian Kranz
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ * 
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ * 
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ *******************************************************************************/
+#ifndef TREE_OF_WORK_PARALLEL
+#define TREE_OF_WORK_PARALLEL
+
+#include <algorithm>
+#include <atomic>
+#include <memory>
+#include <thread>
+#include <type_traits>
+#include <utility>
+
+#include "tree_of_work.h"
+
+namespace TreeOfWork
+{
+namespace detail
+{
+/**************************
+ * true if Body can be called as body( Index begin, Index end )
+ *************************/
+template<typename Body, typename Index>
+struct IsRangeBody
+{
+    template<typename B>
+    static auto test( int ) -> decltype( std::declval<B&>()( std::declval<Index>(), std::declval<Index>() ),
+                                         std::true_type() );
+    template<typename B>
+    static std::false_type test( ... );
+
+    static const bool value = decltype( test<Body>( 0 ) )::value;
+};
+/**************************
+ * turns a body( Index i ) into a body( Index begin, Index end )
+ *************************/
+template<typename Index, typename Body>
+struct EachIndex
+{
+    Body body;
+
+    void operator()( Index begin, Index end )
+    {
+        for( Index i = begin; i < end; ++i )
+            body( i );
+    }
+};
+
+template<typename Index, typename Body, bool Range = IsRangeBody<Body, Index>::value>
+struct RangeBody
+{
+    using type = Body;
+
+    static type make( Body body )
+    {
+        return body;
+    }
+};
+
+template<typename Index, typename Body>
+struct RangeBody<Index, Body, false>
+{
+    using type = EachIndex<Index, Body>;
+
+    static type make( Body body )
+    {
+        return type{ std::move( body ) };
+    }
+};
+
+/**************************
+ * Worker function of a parallel for node (@see parallel_for).
+ *
+ * The range is split lazily: every chunk halves its range and
+ * submits the upper half while its split depth allows, then
+ * runs the lower half itself. A chunk which got stolen, i.e.
+ * runs on another thread than the one which split it off, is
+ * allowed to split further, so the range is only cut finely
+ * where threads actually ran out of work.
+ *
+ * The node is completed when the last index has been run,
+ * or failed if any chunk threw; chunks which start after a
+ * failure skip their body.
+ *
+ *************************/
+template<typename Index, typename Body>
+class ParallelFor
+{
+    /**************************
+     * state of one run of the node, owned by its chunks:
+     * the chunk which runs the last index releases it
+     *************************/
+    struct Loop
+    {
+        Work::Control             control;
+        Body*                     body;
+        Executor*                 executor;
+        Index                     grain;
+        std::atomic<size_t>       remaining;
+        std::atomic<bool>         failed;
+    };
+
+public:
+    ParallelFor( Index begin, Index end, Body body, Index grain, std::shared_ptr<Executor> executor )
+        : m_begin( begin )
+        , m_end( end )
+        , m_grain( std::max<Index>( grain, Index( 1 ) ) )
+        , m_body( std::move( body ) )
+        , m_executor( std::move( executor ) )
+    {}
+
+    void operator()( const Work::Control& control )
+    {
+        if ( !( m_begin < m_end ) )
+        {
+            control.set_completed();
+            return;
+        }
+
+        Loop* loop = new Loop{ control, &m_body, m_executor.get(), m_grain,
+                               { static_cast<size_t>( m_end - m_begin ) }, { false } };
+        ParallelFor::run( loop, m_begin, m_end, ParallelFor::initial_depth(), std::this_thread::get_id() );
+    }
+
+private:
+    /**************************
+     * enough splits for a few chunks per hardware thread,
+     * every steal allows ParallelFor::StolenDepth more
+     *************************/
+    static const unsigned StolenDepth = 2;
+
+    static unsigned initial_depth()
+    {
+        const unsigned threads = std::max( 1u, std::thread::hardware_concurrency() );
+        unsigned depth = 2;
+        while( ( 1u << ( depth - 2 ) ) < threads )
+            ++depth;
+        return depth;
+    }
+    /**************************
+     *
+     *************************/
+    static void run( Loop* loop, Index begin, Index end, unsigned depth, std::thread::id splitter )
+    {
+        const std::thread::id self = std::this_thread::get_id();
+        if ( self != splitter )
+            depth += ParallelFor::StolenDepth;
+
+        while( depth > 0 && end - begin > loop->grain )
+        {
+            const Index middle = begin + ( end - begin ) / 2;
+            --depth;
+            loop->executor->submit( [loop, middle, end, depth, self]
+                                    {
+                                        ParallelFor::run( loop, middle, end, depth, self );
+                                    } );
+            end = middle;
+        }
+
+        if ( !loop->failed.load( std::memory_order_relaxed ) )
+        {
+            try
+            {
+                (*loop->body)( begin, end );
+            }
+            catch( ... )
+            {
+                loop->failed = true;
+            }
+        }
+
+        ParallelFor::finish( loop, static_cast<size_t>( end - begin ) );
+    }
+    /**************************
+     * the body of the node must not be touched after
+     * the node is signalled
+     *************************/
+    static void finish( Loop* loop, size_t count )
+    {
+        if ( loop->remaining.fetch_sub( count, std::memory_order_acq_rel ) != count )
+            return;
+
+        const Work::Control control = loop->control;
+        const bool failed = loop->failed.load();
+        delete loop;
+
+        if ( failed )
+            control.set_failed();
+        else
+            control.set_completed();
+    }
+
+private:
+    Index                     m_begin;
+    Index                     m_end;
+    Index                     m_grain;
+    Body                      m_body;
+    std::shared_ptr<Executor> m_executor;
+};
+}
+
+/**************************
+ * worker function for Work or GraphBuilder::add which runs
+ * body for all indices of [begin, end) in parallel on executor:
+ *
+ *   body( Index i )                 - called once per index
+ *   body( Index first, Index last ) - called once per chunk [first, last)
+ *
+ * chunks are never smaller than grain (except the remainder),
+ * their size adapts to the load (@see detail::ParallelFor);
+ * the node counts as completed only when all chunks are done,
+ * so AND/OR relations of its children see the whole loop
+ *************************/
+template<typename Index, typename Body>
+detail::ParallelFor<Index, typename detail::RangeBody<Index, typename std::decay<Body>::type>::type>
+parallel_for( Index begin, Index end, Body&& body,
+              std::shared_ptr<Executor> executor = Executor::default_executor(),
+              Index grain = 1 )
+{
+    static_assert( std::is_integral<Index>::value, "parallel_for requires an integral index" );
+    using Adapter = detail::RangeBody<Index, typename std::decay<Body>::type>;
+
+    return detail::ParallelFor<Index, typename Adapter::type>( begin, end, Adapter::make( std::forward<Body>( body ) ),
+                                                              grain, std::move( executor ) );
+}
+/**************************
+ * creates a node which runs body for all indices of
+ * [begin, end) in parallel on executor (@see parallel_for)
+ *************************/
+template<typename Index, typename Body>
+std::shared_ptr<Work> make_parallel_for_work( Index begin, Index end, Body&& body,
+                                              std::shared_ptr<Executor> executor = Executor::default_executor(),
+                                              Index grain = 1 )
+{
+    return Work::make_work( parallel_for( begin, end, std::forward<Body>( body ), executor, grain ), executor );
+}
+
+}
+
+#endif /* TREE_OF_WORK_PARALLEL */
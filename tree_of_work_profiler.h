@@ -0,0 +1,372 @@
+/********************************************************************************
+ * MIT License
+ *
+ * Copyright (c) 2020 Christian Kranz
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ *******************************************************************************/
+#ifndef TREE_OF_WORK_PROFILER
+#define TREE_OF_WORK_PROFILER
+
+/**************************
+ * Node instrumentation is compiled in only if
+ * TREE_OF_WORK_PROFILING is defined (e.g. -DTREE_OF_WORK_PROFILING),
+ * otherwise TREE_OF_WORK_PROFILE( ... ) expands to nothing.
+ *************************/
+#ifdef TREE_OF_WORK_PROFILING
+#define TREE_OF_WORK_PROFILE( ... ) __VA_ARGS__
+#else
+#define TREE_OF_WORK_PROFILE( ... )
+#endif
+
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <map>
+#include <memory>
+#include <ostream>
+#include <string>
+#include <thread>
+#include <utility>
+#include <vector>
+
+namespace TreeOfWork
+{
+/**************************
+ * Collects ready, start and end timestamps and the executing
+ * thread of every node which ran while the profiler was active
+ * (@see Profiler::activate).
+ *
+ * A node is identified by its owner (the Work object or the
+ * Graph) and its index within the owner. Each record also
+ * stores the parent whose completion made the node ready;
+ * following these parents backwards from the last node gives
+ * the critical path of the run.
+ *
+ * Recording is lock free; records beyond the capacity given
+ * at construction are dropped (@see Profiler::dropped).
+ *
+ *************************/
+class Profiler
+{
+public:
+    using Clock = std::chrono::steady_clock;
+
+    struct Record
+    {
+        const void*   owner;
+        std::uint32_t index;
+        const void*   parent_owner;
+        std::uint32_t parent_index;
+        std::int64_t  ready_ns;
+        std::int64_t  start_ns;
+        std::int64_t  end_ns;
+        std::size_t   thread;
+    };
+    /**************************
+     * result of Profiler::summarize
+     *   makespan    - first ready to last end
+     *   work        - sum of all node durations
+     *   span        - sum of the node durations on the critical path
+     *   parallelism - work / span, the available parallelism
+     *   utilization - work / makespan, the achieved parallelism
+     *   critical_path - indices into records(), first node first
+     *************************/
+    struct Summary
+    {
+        std::int64_t             makespan_ns;
+        std::int64_t             work_ns;
+        std::int64_t             span_ns;
+        double                   parallelism;
+        double                   utilization;
+        std::vector<std::size_t> critical_path;
+    };
+
+public:
+    explicit Profiler( std::size_t capacity = 1 << 16 )
+        : m_epoch( Clock::now() )
+        , m_records( new Profiler::Record[capacity] )
+        , m_capacity( capacity )
+        , m_size( 0 )
+        , m_names()
+    {}
+    /**************************
+     * make profiler the target of all node records
+     * (nullptr stops recording)
+     *************************/
+    static void activate( Profiler* profiler )
+    {
+        Profiler::active_slot().store( profiler, std::memory_order_release );
+    }
+    /**************************
+     * the profiler nodes record into, may be nullptr
+     *************************/
+    static Profiler* active()
+    {
+        return Profiler::active_slot().load( std::memory_order_acquire );
+    }
+    /**************************
+     * nanoseconds since the construction of the profiler
+     *************************/
+    std::int64_t now() const
+    {
+        return std::chrono::duration_cast<std::chrono::nanoseconds>( Clock::now() - m_epoch ).count();
+    }
+    /**************************
+     * timestamp for the currently active profiler (0 if none)
+     *************************/
+    static std::int64_t timestamp()
+    {
+        const Profiler* profiler = Profiler::active();
+        return profiler != nullptr ? profiler->now() : 0;
+    }
+    /**************************
+     * store the record of a finished node
+     *************************/
+    void record( const Profiler::Record& r )
+    {
+        const std::size_t index = m_size.fetch_add( 1, std::memory_order_relaxed );
+        if ( index < m_capacity )
+            m_records[index] = r;
+    }
+    /**************************
+     * name a node for the trace export
+     *************************/
+    void set_name( const void* owner, std::uint32_t index, const std::string& name )
+    {
+        m_names[std::make_pair( owner, index )] = name;
+    }
+    /**************************
+     * recorded nodes; only to be called while no node runs
+     *************************/
+    std::vector<Profiler::Record> records() const
+    {
+        return std::vector<Profiler::Record>( m_records.get(), m_records.get() + recorded() );
+    }
+    /**************************
+     * number of records which did not fit into the profiler
+     *************************/
+    std::size_t dropped() const
+    {
+        const std::size_t size = m_size.load();
+        return size > m_capacity ? size - m_capacity : 0;
+    }
+    /**************************
+     * forget all records
+     *************************/
+    void clear()
+    {
+        m_size = 0;
+    }
+    /**************************
+     * computes critical path and parallelism of all records
+     *************************/
+    Profiler::Summary summarize() const
+    {
+        Profiler::Summary summary = { 0, 0, 0, 0.0, 0.0, {} };
+        const std::size_t count = recorded();
+        if ( count == 0 )
+            return summary;
+
+        std::map<std::pair<const void*, std::uint32_t>, std::size_t> by_node;
+        std::int64_t first_ready = m_records[0].ready_ns;
+        std::int64_t last_end = m_records[0].end_ns;
+        std::size_t last = 0;
+        for( std::size_t i = 0; i < count; ++i )
+        {
+            const Profiler::Record& r = m_records[i];
+            by_node[std::make_pair( r.owner, r.index )] = i;
+            summary.work_ns += r.end_ns - r.start_ns;
+
+            if ( r.ready_ns < first_ready )
+                first_ready = r.ready_ns;
+            if ( r.end_ns >= last_end )
+            {
+                last_end = r.end_ns;
+                last = i;
+            }
+        }
+        summary.makespan_ns = last_end - first_ready;
+
+        // walk the enabling parents back from the last node
+        std::vector<std::size_t> path;
+        for( std::size_t i = last; path.size() < count; )
+        {
+            path.push_back( i );
+            const Profiler::Record& r = m_records[i];
+            if ( r.parent_owner == nullptr )
+                break;
+
+            auto parent = by_node.find( std::make_pair( r.parent_owner, r.parent_index ) );
+            if ( parent == by_node.end() )
+                break;
+            i = parent->second;
+        }
+        summary.critical_path.assign( path.rbegin(), path.rend() );
+
+        for( const std::size_t i : summary.critical_path )
+            summary.span_ns += m_records[i].end_ns - m_records[i].start_ns;
+
+        if ( summary.span_ns > 0 )
+            summary.parallelism = double( summary.work_ns ) / double( summary.span_ns );
+        if ( summary.makespan_ns > 0 )
+            summary.utilization = double( summary.work_ns ) / double( summary.makespan_ns );
+
+        return summary;
+    }
+    /**************************
+     * writes all records in the Chrome trace event format
+     * (chrome://tracing, https://ui.perfetto.dev)
+     *
+     * one complete event per node, the time between ready
+     * and start is exported as argument "wait_us"
+     *************************/
+    void write_chrome_trace( std::ostream& os ) const
+    {
+        const std::size_t count = recorded();
+        const Profiler::Summary summary = summarize();
+        std::vector<bool> critical( count, false );
+        for( const std::size_t i : summary.critical_path )
+            critical[i] = true;
+
+        std::map<std::size_t, std::size_t> thread_ids;
+
+        os << "{\"traceEvents\":[";
+        for( std::size_t i = 0; i < count; ++i )
+        {
+            const Profiler::Record& r = m_records[i];
+            const std::size_t tid = thread_ids.insert( std::make_pair( r.thread, thread_ids.size() + 1 ) ).first->second;
+
+            os << ( i == 0 ? "" : "," ) << "\n"
+               << "{\"name\":\"" << Profiler::escape( name_of( r ) ) << "\""
+               << ",\"cat\":\"" << ( critical[i] ? "critical" : "node" ) << "\""
+               << ",\"ph\":\"X\",\"pid\":1,\"tid\":" << tid
+               << ",\"ts\":" << double( r.start_ns ) / 1000.0
+               << ",\"dur\":" << double( r.end_ns - r.start_ns ) / 1000.0
+               << ",\"args\":{\"wait_us\":" << double( r.start_ns - r.ready_ns ) / 1000.0 << "}}";
+        }
+        os << "\n],\"displayTimeUnit\":\"ns\""
+           << ",\"otherData\":{\"parallelism\":" << summary.parallelism
+           << ",\"utilization\":" << summary.utilization << "}}\n";
+    }
+
+    Profiler( const Profiler& ) = delete;
+    Profiler& operator=( const Profiler& ) = delete;
+
+private:
+    static std::atomic<Profiler*>& active_slot()
+    {
+        static std::atomic<Profiler*> profiler( nullptr );
+        return profiler;
+    }
+
+    std::size_t recorded() const
+    {
+        const std::size_t size = m_size.load();
+        return size < m_capacity ? size : m_capacity;
+    }
+
+    /**************************
+     * name as content of a JSON string: quotes and backslashes
+     * are escaped, control characters written as \u00XX
+     *************************/
+    static std::string escape( const std::string& name )
+    {
+        static const char hex[] = "0123456789abcdef";
+        std::string escaped;
+        escaped.reserve( name.size() );
+        for( const char c : name )
+        {
+            const unsigned char u = static_cast<unsigned char>( c );
+            if ( c == '"' || c == '\\' )
+            {
+                escaped += '\\';
+                escaped += c;
+            }
+            else if ( u < 0x20 )
+            {
+                escaped += "\\u00";
+                escaped += hex[u >> 4];
+                escaped += hex[u & 0xf];
+            }
+            else
+            {
+                escaped += c;
+            }
+        }
+        return escaped;
+    }
+
+    std::string name_of( const Profiler::Record& r ) const
+    {
+        auto name = m_names.find( std::make_pair( r.owner, r.index ) );
+        if ( name != m_names.end() )
+            return name->second;
+        return "node " + std::to_string( r.index ) + " @" +
+               std::to_string( reinterpret_cast<std::uintptr_t>( r.owner ) );
+    }
+
+private:
+    const Clock::time_point                                      m_epoch;
+    std::unique_ptr<Profiler::Record[]>                          m_records;
+    const std::size_t                                            m_capacity;
+    std::atomic<std::size_t>                                     m_size;
+    std::map<std::pair<const void*, std::uint32_t>, std::string> m_names;
+};
+
+namespace detail
+{
+/**************************
+ * per node state of the instrumentation
+ *************************/
+struct ProfileStamp
+{
+    const void*   parent_owner;
+    std::uint32_t parent_index;
+    std::int64_t  ready_ns;
+    std::int64_t  start_ns;
+
+    void ready( const void* owner, std::uint32_t index )
+    {
+        parent_owner = owner;
+        parent_index = index;
+        ready_ns = Profiler::timestamp();
+    }
+
+    void start()
+    {
+        start_ns = Profiler::timestamp();
+    }
+
+    void end( const void* owner, std::uint32_t index ) const
+    {
+        Profiler* profiler = Profiler::active();
+        if ( profiler == nullptr )
+            return;
+
+        profiler->record( { owner, index, parent_owner, parent_index,
+                            ready_ns, start_ns, profiler->now(),
+                            std::hash<std::thread::id>()( std::this_thread::get_id() ) } );
+    }
+};
+}
+
+}
+
+#endif /* TREE_OF_WORK_PROFILER */
@@ -0,0 +1,187 @@
+/********************************************************************************
+ * MIT License
+ *
+ * Copyright (c) 2020 Christian Kranz
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ * 
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ * 
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ *******************************************************************************/
+#ifndef TREE_OF_WORK_RESOURCE
+#define TREE_OF_WORK_RESOURCE
+
+#include <algorithm>
+#include <deque>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <utility>
+#include <vector>
+
+#include "tree_of_work_function.h"
+
+namespace TreeOfWork
+{
+/**************************
+ * A named pool of tokens, e.g. "db" with 8 slots or "gpu"
+ * with 1, which limits how many nodes using the resource
+ * run at the same time.
+ *
+ * A node claims tokens of one or more pools (@see
+ * Work::require, GraphBuilder::require); once it is ready it
+ * is only handed to its executor after it got all tokens, and
+ * it returns them when it is done. Nodes waiting for tokens do
+ * not occupy a thread. Waiters are admitted in FIFO order, so
+ * a large claim is not starved by smaller ones behind it.
+ *
+ *************************/
+class ResourcePool
+{
+public:
+    using Resume = detail::InplaceFunction<void(void)>;
+
+public:
+    ResourcePool( std::string name, size_t tokens )
+        : m_name( std::move( name ) )
+        , m_capacity( std::max<size_t>( tokens, 1 ) )
+        , m_mutex()
+        , m_available( m_capacity )
+        , m_waiters()
+    {}
+    /**************************
+     *
+     *************************/
+    static std::shared_ptr<ResourcePool> make( std::string name, size_t tokens )
+    {
+        return std::make_shared<ResourcePool>( std::move( name ), tokens );
+    }
+
+    const std::string& name() const
+    {
+        return m_name;
+    }
+
+    size_t capacity() const
+    {
+        return m_capacity;
+    }
+    /**************************
+     * tokens not taken at the moment
+     *************************/
+    size_t available()
+    {
+        std::lock_guard<std::mutex> lock( m_mutex );
+        return m_available;
+    }
+    /**************************
+     * takes count tokens and returns true if they are available
+     * and nobody waits, otherwise queues resume, which is called
+     * by the release() which makes the tokens available
+     * (the tokens are taken then) and returns false
+     *************************/
+    bool acquire( size_t count, ResourcePool::Resume resume )
+    {
+        std::lock_guard<std::mutex> lock( m_mutex );
+        if ( m_waiters.empty() && count <= m_available )
+        {
+            m_available -= count;
+            return true;
+        }
+        m_waiters.push_back( { count, std::move( resume ) } );
+        return false;
+    }
+    /**************************
+     * returns count tokens and resumes the waiters they admit
+     *************************/
+    void release( size_t count )
+    {
+        std::vector<ResourcePool::Resume> admitted;
+        {
+            std::lock_guard<std::mutex> lock( m_mutex );
+            m_available += count;
+            while( !m_waiters.empty() && m_waiters.front().count <= m_available )
+            {
+                m_available -= m_waiters.front().count;
+                admitted.push_back( std::move( m_waiters.front().resume ) );
+                m_waiters.pop_front();
+            }
+        }
+        for( ResourcePool::Resume& resume : admitted )
+            resume();
+    }
+
+    ResourcePool( const ResourcePool& ) = delete;
+    ResourcePool& operator=( const ResourcePool& ) = delete;
+
+private:
+    struct Waiter
+    {
+        size_t               count;
+        ResourcePool::Resume resume;
+    };
+
+private:
+    const std::string                 m_name;
+    const size_t                      m_capacity;
+    std::mutex                        m_mutex;
+    size_t                            m_available;
+    std::deque<ResourcePool::Waiter>  m_waiters;
+};
+
+/**************************
+ * tokens of one pool a node claims
+ *************************/
+struct ResourceClaim
+{
+    std::shared_ptr<ResourcePool> pool;
+    size_t                        count;
+};
+
+namespace detail
+{
+/**************************
+ * adds a claim to the claims of a node; claims are kept
+ * ordered by pool, so all nodes take their tokens in the same
+ * order and two nodes can not wait for each other's tokens.
+ * A claim larger than the pool takes the whole pool.
+ *************************/
+template<typename Claims>
+void add_claim( Claims& claims, std::shared_ptr<ResourcePool> pool, size_t count )
+{
+    for( ResourceClaim& claim : claims )
+    {
+        if ( claim.pool == pool )
+        {
+            claim.count = std::min( claim.count + count, pool->capacity() );
+            return;
+        }
+    }
+
+    const size_t tokens = std::min( count, pool->capacity() );
+    auto position = std::find_if( claims.begin(), claims.end(),
+                                  [&pool](const ResourceClaim& claim)
+                                  {
+                                      return std::less<ResourcePool*>()( pool.get(), claim.pool.get() );
+                                  } );
+    claims.insert( position, ResourceClaim{ std::move( pool ), tokens } );
+}
+}
+
+}
+
+#endif /* TREE_OF_WORK_RESOURCE */
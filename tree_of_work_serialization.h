@@ -0,0 +1,560 @@
+/********************************************************************************
+ * MIT License
+ *
+ * Copyright (c) 2020 Christian Kranz
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ * 
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ * 
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ *******************************************************************************/
+#ifndef TREE_OF_WORK_SERIALIZATION
+#define TREE_OF_WORK_SERIALIZATION
+
+#include <algorithm>
+#include <chrono>
+#include <cstdint>
+#include <cstring>
+#include <fstream>
+#include <functional>
+#include <iterator>
+#include <memory>
+#include <ostream>
+#include <stdexcept>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+#include "tree_of_work_graph.h"
+
+#if defined(__has_include) && !defined(_WIN32)
+#if __has_include(<sys/mman.h>) && __has_include(<sys/stat.h>) && __has_include(<fcntl.h>)
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#define TREE_OF_WORK_HAS_MMAP 1
+#endif
+#endif
+
+namespace TreeOfWork
+{
+/**************************
+ * Thrown by GraphFile for files which can not be written,
+ * read or bound (unknown worker or pool names)
+ *************************/
+class GraphFormatError : public std::runtime_error
+{
+public:
+    explicit GraphFormatError( const std::string& message )
+        : std::runtime_error( "TreeOfWork::GraphFile: " + message )
+    {}
+};
+
+/**************************
+ * Worker functions and resource pools by name, used to
+ * bind the nodes of a loaded graph (@see GraphFile::load)
+ *
+ *************************/
+class WorkerRegistry
+{
+public:
+    WorkerRegistry()
+        : m_workers()
+        , m_pools()
+    {}
+    /**************************
+     * f (any copyable callable void(const Work::Control&))
+     * is copied into every node named name
+     *************************/
+    template<typename F>
+    void add( std::string name, F f )
+    {
+        m_workers[std::move( name )] = [f]{ return Work::Worker( f ); };
+    }
+    /**************************
+     * true if a worker is registered for name
+     *************************/
+    bool contains( const std::string& name ) const
+    {
+        return m_workers.find( name ) != m_workers.end();
+    }
+    /**************************
+     * a copy of the worker registered for name,
+     * throws std::out_of_range if there is none
+     *************************/
+    Work::Worker make( const std::string& name ) const
+    {
+        return m_workers.at( name )();
+    }
+    /**************************
+     * claims on a pool named pool->name() are bound to pool
+     *************************/
+    void add_pool( std::shared_ptr<ResourcePool> pool )
+    {
+        const std::string name = pool->name();
+        m_pools[name] = std::move( pool );
+    }
+
+private:
+    friend class GraphFile;
+    using Binder = std::function<Work::Worker()>;
+
+private:
+    std::unordered_map<std::string, WorkerRegistry::Binder>        m_workers;
+    std::unordered_map<std::string, std::shared_ptr<ResourcePool>> m_pools;
+};
+
+/**************************
+ * Saves the topology of a compiled graph (trigger conditions,
+ * priorities, affinities, timeouts in whole milliseconds,
+ * edges, levels and resource claims)
+ * in a compact binary image and loads it again.
+ *
+ * The image is a header followed by fixed size node records
+ * and the CSR arrays of the graph exactly as the Graph holds
+ * them, plus one table of the node and pool names. Loading
+ * maps the file and copies each array into the arena of the
+ * new graph in one piece; nothing is parsed or sorted again,
+ * the arrays are only checked to be within bounds. Workers
+ * and pools are looked up once per distinct name in the
+ * WorkerRegistry.
+ *
+ * The image uses the byte order of the machine which saved
+ * it and is rejected by machines with another byte order.
+ *
+ *************************/
+class GraphFile
+{
+public:
+    using NodeId = Graph::NodeId;
+
+    static const std::uint32_t Version = 2;
+
+public:
+    /**************************
+     * every node needs a name (@see GraphBuilder::set_name),
+     * load binds the workers by these names
+     *************************/
+    static void save( const Graph& graph, std::ostream& os )
+    {
+        GraphFile::check_names( graph );
+        const size_t node_count = graph.m_nodes.size();
+
+        // node names keep their ids, pool names are appended
+        std::vector<NodeId> string_offsets( graph.m_name_offsets.begin(), graph.m_name_offsets.end() );
+        std::vector<char> strings( graph.m_name_chars.begin(), graph.m_name_chars.end() );
+        if ( string_offsets.empty() )
+            string_offsets.push_back( 0 );
+
+        std::vector<GraphFile::ClaimRecord> claims;
+        if ( !graph.m_claims.empty() )
+        {
+            std::unordered_map<std::string, NodeId> ids;
+            for( NodeId i = 0; i + 1 < string_offsets.size(); ++i )
+                ids[std::string( strings.data() + string_offsets[i] )] = i;
+
+            claims.reserve( graph.m_claims.size() );
+            for( const ResourceClaim& claim : graph.m_claims )
+            {
+                auto id = ids.insert( std::make_pair( claim.pool->name(), static_cast<NodeId>( string_offsets.size() - 1 ) ) );
+                if ( id.second )
+                {
+                    strings.insert( strings.end(), claim.pool->name().begin(), claim.pool->name().end() );
+                    strings.push_back( '\0' );
+                    string_offsets.push_back( static_cast<NodeId>( strings.size() ) );
+                }
+                claims.push_back( { id.first->second, static_cast<std::uint32_t>( claim.count ) } );
+            }
+        }
+
+        std::vector<GraphFile::NodeRecord> nodes( node_count );
+        for( NodeId i = 0; i < node_count; ++i )
+        {
+            const Graph::Node& node = graph.m_nodes[i];
+            nodes[i].name           = graph.m_name_ids.empty() ? NodeId( Graph::NoNode ) : graph.m_name_ids[i];
+            nodes[i].condition      = static_cast<std::uint8_t>( node.trigger_condition );
+            nodes[i].affinity_kind  = static_cast<std::uint8_t>( node.affinity.kind() );
+            nodes[i].reserved       = 0;
+            nodes[i].priority       = node.priority;
+            nodes[i].affinity_value = node.affinity.value();
+            nodes[i].timeout_ms     = GraphFile::milliseconds( node.timeout );
+        }
+
+        GraphFile::Header header;
+        std::memcpy( header.magic, GraphFile::magic(), sizeof(header.magic) );
+        header.version      = GraphFile::Version;
+        header.byte_order   = GraphFile::ByteOrder;
+        header.node_count   = static_cast<std::uint32_t>( node_count );
+        header.edge_count   = static_cast<std::uint32_t>( graph.m_children.size() );
+        header.level_count  = static_cast<std::uint32_t>( graph.depth() );
+        header.width        = static_cast<std::uint32_t>( graph.width() );
+        header.claim_count  = static_cast<std::uint32_t>( claims.size() );
+        header.string_count = static_cast<std::uint32_t>( string_offsets.size() - 1 );
+        header.string_bytes = static_cast<std::uint32_t>( strings.size() );
+        header.reserved     = 0;
+
+        GraphFile::write( os, &header, 1 );
+        GraphFile::write( os, nodes.data(), nodes.size() );
+        GraphFile::write( os, graph.m_parent_counts.data(), graph.m_parent_counts.size() );
+        GraphFile::write( os, graph.m_child_offsets.data(), graph.m_child_offsets.size() );
+        GraphFile::write( os, graph.m_children.data(), graph.m_children.size() );
+        GraphFile::write( os, graph.m_order.data(), graph.m_order.size() );
+        GraphFile::write( os, graph.m_level_offsets.data(), graph.m_level_offsets.size() );
+        GraphFile::write( os, graph.m_claim_offsets.data(), graph.m_claim_offsets.size() );
+        GraphFile::write( os, claims.data(), claims.size() );
+        GraphFile::write( os, string_offsets.data(), string_offsets.size() );
+        GraphFile::write( os, strings.data(), strings.size() );
+
+        if ( !os )
+            throw GraphFormatError( "writing the graph failed" );
+    }
+
+    static void save( const Graph& graph, const std::string& path )
+    {
+        // before the file is truncated
+        GraphFile::check_names( graph );
+        std::ofstream os( path, std::ios::binary | std::ios::trunc );
+        if ( !os )
+            throw GraphFormatError( "can not open " + path );
+        GraphFile::save( graph, os );
+    }
+    /**************************
+     * a graph from an image in memory, the workers and pools
+     * are bound by name from registry; the image is not
+     * referenced after the call
+     *************************/
+    static std::shared_ptr<Graph> load( const void* data, size_t size, const WorkerRegistry& registry,
+                                        std::shared_ptr<Arena> arena = std::make_shared<Arena>() )
+    {
+        GraphFile::Reader reader{ static_cast<const char*>( data ), static_cast<const char*>( data ) + size };
+
+        GraphFile::Header header;
+        std::memcpy( &header, reader.take( sizeof(header) ), sizeof(header) );
+        if ( std::memcmp( header.magic, GraphFile::magic(), sizeof(header.magic) ) != 0 )
+            throw GraphFormatError( "not a graph image" );
+        if ( header.version != GraphFile::Version )
+            throw GraphFormatError( "unsupported version " + std::to_string( header.version ) );
+        if ( header.byte_order != GraphFile::ByteOrder )
+            throw GraphFormatError( "image was saved with another byte order" );
+
+        const NodeId node_count = header.node_count;
+        std::shared_ptr<Graph> graph( new Graph( std::move( arena ) ) );
+        Graph* g = graph.get();
+
+        const char* nodes = reader.take( size_t( node_count ) * sizeof(GraphFile::NodeRecord) );
+        reader.copy( g->m_parent_counts, node_count );
+        reader.copy( g->m_child_offsets, size_t( node_count ) + 1 );
+        reader.copy( g->m_children, header.edge_count );
+        reader.copy( g->m_order, node_count );
+        reader.copy( g->m_level_offsets, size_t( header.level_count ) + 1 );
+        reader.copy( g->m_claim_offsets, size_t( node_count ) + 1 );
+        const char* claims = reader.take( size_t( header.claim_count ) * sizeof(GraphFile::ClaimRecord) );
+        reader.copy( g->m_name_offsets, size_t( header.string_count ) + 1 );
+        reader.copy( g->m_name_chars, header.string_bytes );
+        if ( reader.position != reader.end )
+            throw GraphFormatError( "trailing data after the graph" );
+
+        GraphFile::check_topology( *g, header );
+        g->m_width = header.width;
+
+        // workers and pools, resolved once per name
+        std::vector<const WorkerRegistry::Binder*> binders( header.string_count, nullptr );
+        g->m_nodes.reserve( node_count );
+        g->m_name_ids.resize( node_count );
+        for( NodeId i = 0; i < node_count; ++i )
+        {
+            GraphFile::NodeRecord record;
+            std::memcpy( &record, nodes + size_t( i ) * sizeof(record), sizeof(record) );
+            if ( record.name >= header.string_count )
+                throw GraphFormatError( "node " + std::to_string( i ) + " has no name to bind a worker to" );
+            if ( record.condition > static_cast<std::uint8_t>( Work::Conditional::AND ) ||
+                 record.affinity_kind > static_cast<std::uint8_t>( Affinity::Kind::Parent ) )
+                throw GraphFormatError( "invalid node " + std::to_string( i ) );
+
+            if ( binders[record.name] == nullptr )
+            {
+                const std::string name( g->m_name_chars.data() + g->m_name_offsets[record.name] );
+                auto worker = registry.m_workers.find( name );
+                if ( worker == registry.m_workers.end() )
+                    throw GraphFormatError( "no worker registered for '" + name + "'" );
+                binders[record.name] = &worker->second;
+            }
+
+            g->m_name_ids[i] = record.name;
+            g->m_nodes.push_back( { ( *binders[record.name] )(),
+                                    static_cast<Work::Conditional>( record.condition ),
+                                    record.priority,
+                                    GraphFile::affinity( record.affinity_kind, record.affinity_value ),
+                                    std::chrono::milliseconds( record.timeout_ms ) } );
+        }
+
+        std::vector<std::shared_ptr<ResourcePool>> pools( header.string_count );
+        g->m_claims.reserve( header.claim_count );
+        for( NodeId i = 0; i < header.claim_count; ++i )
+        {
+            GraphFile::ClaimRecord record;
+            std::memcpy( &record, claims + size_t( i ) * sizeof(record), sizeof(record) );
+            if ( record.pool >= header.string_count )
+                throw GraphFormatError( "invalid resource claim" );
+
+            if ( !pools[record.pool] )
+            {
+                const std::string name( g->m_name_chars.data() + g->m_name_offsets[record.pool] );
+                auto pool = registry.m_pools.find( name );
+                if ( pool == registry.m_pools.end() )
+                    throw GraphFormatError( "no resource pool registered for '" + name + "'" );
+                pools[record.pool] = pool->second;
+            }
+            ResourceClaim claim = { pools[record.pool], record.count };
+            claim.count = std::min( claim.count, claim.pool->capacity() );
+            g->m_claims.push_back( std::move( claim ) );
+        }
+
+        g->create_run();
+        g->reset();
+        return graph;
+    }
+    /**************************
+     * a graph from an image file, the file is memory mapped
+     * where the platform supports it
+     *************************/
+    static std::shared_ptr<Graph> load( const std::string& path, const WorkerRegistry& registry,
+                                        std::shared_ptr<Arena> arena = std::make_shared<Arena>() )
+    {
+#ifdef TREE_OF_WORK_HAS_MMAP
+        const int fd = ::open( path.c_str(), O_RDONLY );
+        if ( fd < 0 )
+            throw GraphFormatError( "can not open " + path );
+
+        struct stat status;
+        if ( ::fstat( fd, &status ) != 0 || status.st_size <= 0 )
+        {
+            ::close( fd );
+            throw GraphFormatError( "can not read " + path );
+        }
+
+        const size_t size = static_cast<size_t>( status.st_size );
+        void* image = ::mmap( nullptr, size, PROT_READ, MAP_PRIVATE, fd, 0 );
+        ::close( fd );
+        if ( image == MAP_FAILED )
+            throw GraphFormatError( "can not map " + path );
+
+        struct Unmap
+        {
+            void*  image;
+            size_t size;
+            ~Unmap() { ::munmap( image, size ); }
+        } unmap = { image, size };
+
+        return GraphFile::load( unmap.image, unmap.size, registry, std::move( arena ) );
+#else
+        std::ifstream is( path, std::ios::binary );
+        if ( !is )
+            throw GraphFormatError( "can not open " + path );
+        const std::vector<char> image( ( std::istreambuf_iterator<char>( is ) ), std::istreambuf_iterator<char>() );
+        return GraphFile::load( image.data(), image.size(), registry, std::move( arena ) );
+#endif
+    }
+
+private:
+    static const std::uint32_t ByteOrder = 0x01020304;
+
+    struct Header
+    {
+        char          magic[8];
+        std::uint32_t version;
+        std::uint32_t byte_order;
+        std::uint32_t node_count;
+        std::uint32_t edge_count;
+        std::uint32_t level_count;
+        std::uint32_t width;
+        std::uint32_t claim_count;
+        std::uint32_t string_count;
+        std::uint32_t string_bytes;
+        std::uint32_t reserved;
+    };
+    struct NodeRecord
+    {
+        std::uint32_t name;
+        std::uint8_t  condition;
+        std::uint8_t  affinity_kind;
+        std::uint16_t reserved;
+        std::int32_t  priority;
+        std::uint32_t affinity_value;
+        std::uint32_t timeout_ms;
+    };
+    struct ClaimRecord
+    {
+        std::uint32_t pool;
+        std::uint32_t count;
+    };
+    /**************************
+     * bounds checked cursor over an image
+     *************************/
+    struct Reader
+    {
+        const char* position;
+        const char* end;
+
+        const char* take( const size_t bytes )
+        {
+            if ( size_t( end - position ) < bytes )
+                throw GraphFormatError( "image is truncated" );
+            const char* data = position;
+            position += bytes;
+            return data;
+        }
+
+        template<typename T>
+        void copy( detail::ArenaVector<T>& target, const size_t count )
+        {
+            const char* data = take( count * sizeof(T) );
+            target.resize( count );
+            if ( count > 0 )
+                std::memcpy( target.data(), data, count * sizeof(T) );
+        }
+    };
+
+private:
+    static const char* magic()
+    {
+        return "TOWGRAPH";
+    }
+
+    template<typename T>
+    static void write( std::ostream& os, const T* data, const size_t count )
+    {
+        if ( count > 0 )
+            os.write( reinterpret_cast<const char*>( data ), static_cast<std::streamsize>( count * sizeof(T) ) );
+    }
+
+    static Affinity affinity( const std::uint8_t kind, const std::uint32_t value )
+    {
+        switch( static_cast<Affinity::Kind>( kind ) )
+        {
+            default: break;
+            case Affinity::Kind::Worker:   return Affinity::worker( value );
+            case Affinity::Kind::NumaNode: return Affinity::numa_node( value );
+            case Affinity::Kind::Parent:   return Affinity::same_as_parent();
+        }
+        return Affinity::any();
+    }
+    /**************************
+     * a timeout rounded up to whole milliseconds
+     *************************/
+    static std::uint32_t milliseconds( const detail::TimerService::Clock::duration timeout )
+    {
+        const std::chrono::milliseconds ms = std::chrono::duration_cast<std::chrono::milliseconds>( timeout );
+        const std::int64_t count = ms.count() + ( ms < timeout ? 1 : 0 );
+        return static_cast<std::uint32_t>( std::min<std::int64_t>( count, ~std::uint32_t( 0 ) ) );
+    }
+
+    /**************************
+     * a graph with an unnamed node could be saved but not loaded
+     *************************/
+    static void check_names( const Graph& graph )
+    {
+        for( NodeId i = 0; i < graph.m_nodes.size(); ++i )
+        {
+            if ( graph.m_name_ids.empty() || graph.m_name_ids[i] == Graph::NoNode )
+                throw GraphFormatError( "node " + std::to_string( i ) + " has no name to bind a worker to" );
+        }
+    }
+
+    static bool is_offset_table( const detail::ArenaVector<NodeId>& offsets, const size_t total )
+    {
+        if ( offsets.front() != 0 || offsets.back() != total )
+            return false;
+        for( size_t i = 1; i < offsets.size(); ++i )
+        {
+            if ( offsets[i] < offsets[i - 1] )
+                return false;
+        }
+        return true;
+    }
+    /**************************
+     * one linear pass which makes sure a corrupt image can not
+     * make a run read out of bounds or wait forever
+     *************************/
+    static void check_topology( const Graph& g, const GraphFile::Header& header )
+    {
+        const size_t node_count = header.node_count;
+        if ( !GraphFile::is_offset_table( g.m_child_offsets, header.edge_count ) ||
+             !GraphFile::is_offset_table( g.m_claim_offsets, header.claim_count ) ||
+             !GraphFile::is_offset_table( g.m_level_offsets, node_count ) ||
+             !GraphFile::is_offset_table( g.m_name_offsets, header.string_bytes ) ||
+             header.width > node_count )
+            throw GraphFormatError( "invalid offset table" );
+
+        for( NodeId i = 0; i < header.string_count; ++i )
+        {
+            if ( g.m_name_offsets[i + 1] == g.m_name_offsets[i] ||
+                 g.m_name_chars[g.m_name_offsets[i + 1] - 1] != '\0' )
+                throw GraphFormatError( "invalid name table" );
+        }
+
+        std::vector<NodeId> parents( node_count, 0 );
+        for( const NodeId child : g.m_children )
+        {
+            if ( child >= node_count )
+                throw GraphFormatError( "invalid edge" );
+            parents[child]++;
+        }
+
+        // the order has to be a permutation in which every edge points forward
+        const NodeId unseen = Graph::NoNode;
+        std::vector<NodeId> position( node_count, unseen );
+        for( NodeId k = 0; k < node_count; ++k )
+        {
+            const NodeId node = g.m_order[k];
+            if ( node >= node_count || position[node] != unseen )
+                throw GraphFormatError( "invalid topological order" );
+            position[node] = k;
+        }
+
+        size_t roots = 0;
+        for( NodeId i = 0; i < node_count; ++i )
+        {
+            if ( parents[i] != g.m_parent_counts[i] )
+                throw GraphFormatError( "parent counts do not match the edges" );
+            if ( parents[i] == 0 )
+                roots++;
+
+            for( NodeId c = g.m_child_offsets[i]; c < g.m_child_offsets[i + 1]; ++c )
+            {
+                if ( position[g.m_children[c]] <= position[i] )
+                    throw GraphFormatError( "invalid topological order" );
+            }
+        }
+
+        // a run starts the first level, which has to hold all roots
+        if ( node_count > 0 )
+        {
+            for( const NodeId* root = g.level_begin( 0 ); root != g.level_end( 0 ); ++root )
+            {
+                if ( g.m_parent_counts[*root] != 0 )
+                    throw GraphFormatError( "invalid levels" );
+            }
+            if ( size_t( g.level_end( 0 ) - g.level_begin( 0 ) ) != roots )
+                throw GraphFormatError( "invalid levels" );
+        }
+    }
+};
+
+}
+
+#endif /* TREE_OF_WORK_SERIALIZATION */
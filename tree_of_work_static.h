@@ -0,0 +1,544 @@
+/********************************************************************************
+ * MIT License
+ *
+ * Copyright (c) 2020 Christian Kranz
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ * 
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ * 
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ *******************************************************************************/
+#ifndef TREE_OF_WORK_STATIC
+#define TREE_OF_WORK_STATIC
+
+#include <array>
+#include <atomic>
+#include <condition_variable>
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <mutex>
+#include <tuple>
+#include <type_traits>
+#include <utility>
+
+#include "tree_of_work.h"
+
+namespace TreeOfWork
+{
+/**************************
+ * trigger conditions of a node in a StaticTopology:
+ * the node runs once all (AllOf) or any (AnyOf) of the
+ * nodes with the given indices completed
+ *************************/
+template<std::size_t... Parents>
+struct AllOf
+{};
+
+template<std::size_t... Parents>
+struct AnyOf
+{};
+/**************************
+ * node without parents
+ *************************/
+using Root = AllOf<>;
+/**************************
+ * a graph shape as type, one trigger condition per node,
+ * the node index is the position in the list, e.g. the diamond
+ *   StaticTopology<Root, AllOf<0>, AllOf<0>, AllOf<1, 2>>
+ * parents have to be listed before their children
+ * (which makes a static topology acyclic by construction)
+ * and at most once per node
+ *************************/
+template<typename... Nodes>
+struct StaticTopology
+{};
+
+namespace detail
+{
+template<std::size_t I, typename... Ts>
+struct NthType;
+
+template<typename T, typename... Ts>
+struct NthType<0, T, Ts...>
+{
+    using type = T;
+};
+
+template<std::size_t I, typename T, typename... Ts>
+struct NthType<I, T, Ts...> : NthType<I - 1, Ts...>
+{};
+
+template<std::size_t I, std::size_t... Indices>
+struct HasIndex : std::false_type
+{};
+
+template<std::size_t I, std::size_t Index, std::size_t... Indices>
+struct HasIndex<I, Index, Indices...>
+    : std::integral_constant<bool, I == Index || HasIndex<I, Indices...>::value>
+{};
+
+template<std::size_t Bound, std::size_t... Indices>
+struct AllBelow : std::true_type
+{};
+
+template<std::size_t Bound, std::size_t Index, std::size_t... Indices>
+struct AllBelow<Bound, Index, Indices...>
+    : std::integral_constant<bool, ( Index < Bound ) && AllBelow<Bound, Indices...>::value>
+{};
+
+template<std::size_t... Indices>
+struct AllUnique : std::true_type
+{};
+
+template<std::size_t Index, std::size_t... Indices>
+struct AllUnique<Index, Indices...>
+    : std::integral_constant<bool, !HasIndex<Index, Indices...>::value && AllUnique<Indices...>::value>
+{};
+/**************************
+ * compile time view on AllOf / AnyOf
+ *************************/
+template<typename Trigger>
+struct StaticTrigger;
+
+template<std::size_t... Parents>
+struct StaticTrigger<AllOf<Parents...>>
+{
+    static const Work::Conditional condition = Work::Conditional::AND;
+    static const std::uint32_t     parent_count = sizeof...(Parents);
+
+    template<std::size_t I>
+    using has_parent = HasIndex<I, Parents...>;
+
+    template<std::size_t Node>
+    using parents_before = AllBelow<Node, Parents...>;
+
+    using unique_parents = AllUnique<Parents...>;
+};
+
+template<std::size_t... Parents>
+struct StaticTrigger<AnyOf<Parents...>>
+{
+    static const Work::Conditional condition = Work::Conditional::OR;
+    static const std::uint32_t     parent_count = sizeof...(Parents);
+
+    template<std::size_t I>
+    using has_parent = HasIndex<I, Parents...>;
+
+    template<std::size_t Node>
+    using parents_before = AllBelow<Node, Parents...>;
+
+    using unique_parents = AllUnique<Parents...>;
+};
+
+template<std::size_t I, typename... Nodes>
+struct ParentsListedFirst : std::true_type
+{};
+
+template<std::size_t I, typename Node, typename... Nodes>
+struct ParentsListedFirst<I, Node, Nodes...>
+    : std::integral_constant<bool, StaticTrigger<Node>::template parents_before<I>::value &&
+                                   ParentsListedFirst<I + 1, Nodes...>::value>
+{};
+/**************************
+ * a parent listed twice would be counted twice, an AllOf
+ * node would never become ready
+ *************************/
+template<typename... Nodes>
+struct ParentsUnique : std::true_type
+{};
+
+template<typename Node, typename... Nodes>
+struct ParentsUnique<Node, Nodes...>
+    : std::integral_constant<bool, StaticTrigger<Node>::unique_parents::value &&
+                                   ParentsUnique<Nodes...>::value>
+{};
+}
+
+template<typename Topology, typename... Workers>
+class StaticGraph;
+
+/**************************
+ * A graph whose shape is known at compile time.
+ *
+ * The topology is a type (@see StaticTopology), the worker
+ * functions are stored by value in the graph object and the
+ * counters of all nodes in a fixed array inside it, so neither
+ * building nor running the graph allocates. A finishing node
+ * triggers its children with direct calls generated for its
+ * place in the topology: no child lists are walked and the
+ * workers are called without type erasure. Only the hand off
+ * to the executor goes through Executor::submit.
+ *
+ * Workers have the usual signature void(const Work::Control&)
+ * and may spawn work like those of a Graph. Failure, cancel()
+ * and continuation mode behave as for a Graph; priorities,
+ * affinity, resource claims and the instrumentation are
+ * not available for static graphs.
+ *
+ * The graph can be run repeatedly, it may only be moved
+ * while it is not running
+ * (@see make_static_graph)
+ *
+ *************************/
+template<typename... Nodes, typename... Workers>
+class StaticGraph<StaticTopology<Nodes...>, Workers...>
+{
+    static_assert( sizeof...(Nodes) > 0, "a static graph needs at least one node" );
+    static_assert( sizeof...(Workers) == sizeof...(Nodes), "a static graph needs one worker per node" );
+    static_assert( detail::ParentsListedFirst<0, Nodes...>::value,
+                   "the parents of a node have to be listed before the node" );
+    static_assert( detail::ParentsUnique<Nodes...>::value,
+                   "a node must not list the same parent twice" );
+public:
+    static const std::size_t Size = sizeof...(Nodes);
+
+public:
+    explicit StaticGraph( Workers... workers )
+        : m_workers( std::move( workers )... )
+        , m_counters()
+        , m_executor()
+        , m_remaining( 0 )
+        , m_done_mutex()
+        , m_done_signal()
+        , m_finished( true )
+        , m_cancel_requested( false )
+    {}
+    /**************************
+     * only valid while other is not running
+     *************************/
+    StaticGraph( StaticGraph&& other )
+        : m_workers( std::move( other.m_workers ) )
+        , m_counters()
+        , m_executor()
+        , m_remaining( 0 )
+        , m_done_mutex()
+        , m_done_signal()
+        , m_finished( true )
+        , m_cancel_requested( false )
+    {}
+    /**************************
+     * waits for a run in progress
+     *************************/
+    ~StaticGraph()
+    {
+        wait_for_done();
+    }
+    /**************************
+     * @see Graph::run
+     *************************/
+    void run( std::shared_ptr<Executor> executor = Executor::default_executor() )
+    {
+        wait_for_done();
+        reset();
+
+        m_executor = std::move( executor );
+        m_remaining.store( static_cast<std::uint32_t>( Size ), std::memory_order_relaxed );
+        m_cancel_requested = false;
+        {
+            std::lock_guard<std::mutex> lock( m_done_mutex );
+            m_finished = false;
+        }
+        start( std::integral_constant<std::size_t, 0>() );
+    }
+    /**************************
+     * @see Graph::cancel
+     *************************/
+    void cancel()
+    {
+        m_cancel_requested = true;
+    }
+    /**************************
+     * @see Graph::wait_for_done
+     *************************/
+    void wait_for_done()
+    {
+        std::unique_lock<std::mutex> lock( m_done_mutex );
+        m_done_signal.wait( lock, [this]{ return m_finished; } );
+    }
+    /**************************
+     * @see Graph::try_is_done
+     *************************/
+    bool try_is_done()
+    {
+        std::lock_guard<std::mutex> lock( m_done_mutex );
+        return m_finished;
+    }
+    /**************************
+     * state of a node in the current run
+     *************************/
+    Work::State get_state( const std::size_t node ) const
+    {
+        return m_counters[node].state.load();
+    }
+    /**************************
+     * number of nodes
+     *************************/
+    static std::size_t size()
+    {
+        return Size;
+    }
+
+    StaticGraph( const StaticGraph& ) = delete;
+    StaticGraph& operator=( const StaticGraph& ) = delete;
+
+private:
+    template<std::size_t I>
+    using TriggerOf = detail::StaticTrigger<typename detail::NthType<I, Nodes...>::type>;
+    /**************************
+     * @see GraphRun::Action
+     *************************/
+    enum class Action
+    {
+        None,
+        Launch,
+        Settle
+    };
+    /**************************
+     * @see GraphRun::Counter
+     *************************/
+    struct Counter
+    {
+        std::atomic<std::uint32_t> pending_parents;
+        std::atomic<std::uint32_t> failed_parents;
+        std::atomic<Work::State>   state;
+        Work::Join                 join;
+    };
+    /**************************
+     * a ready child which runs on the thread of its parent
+     *************************/
+    using Continuation = void (StaticGraph::*)();
+
+private:
+    static std::uint32_t parent_count( const std::size_t node )
+    {
+        static const std::uint32_t counts[] = { detail::StaticTrigger<Nodes>::parent_count... };
+        return counts[node];
+    }
+
+    void reset()
+    {
+        for( std::size_t i = 0; i < Size; ++i )
+        {
+            m_counters[i].pending_parents.store( StaticGraph::parent_count( i ), std::memory_order_relaxed );
+            m_counters[i].failed_parents.store( 0, std::memory_order_relaxed );
+            m_counters[i].state.store( Work::State::Created, std::memory_order_relaxed );
+        }
+    }
+    /**************************
+     * triggers the roots
+     *************************/
+    void start( std::integral_constant<std::size_t, Size> )
+    {}
+
+    template<std::size_t I>
+    void start( std::integral_constant<std::size_t, I> )
+    {
+        if ( StaticGraph::TriggerOf<I>::parent_count == 0 )
+        {
+            switch( trigger<I>( Work::State::Completed ) )
+            {
+                default: break;
+                case StaticGraph::Action::Launch:
+                    submit<I>();
+                    break;
+                case StaticGraph::Action::Settle:
+                    conclude<I>( Work::State::Cancelled );
+                    break;
+            }
+        }
+        start( std::integral_constant<std::size_t, I + 1>() );
+    }
+    /**************************
+     * @see GraphRun::trigger, the trigger condition and the
+     * parent count are compile time constants here
+     *************************/
+    template<std::size_t I>
+    StaticGraph::Action trigger( const Work::State parent_state )
+    {
+        using Trigger = StaticGraph::TriggerOf<I>;
+        StaticGraph::Counter& counter = m_counters[I];
+        Work::State expected = Work::State::Created;
+
+        if ( parent_state != Work::State::Completed )
+        {
+            bool cancel_now = true;
+            if ( Trigger::condition == Work::Conditional::OR && Trigger::parent_count > 0 )
+                cancel_now = counter.failed_parents.fetch_add( 1, std::memory_order_acq_rel ) + 1 == Trigger::parent_count;
+
+            if ( cancel_now &&
+                 counter.state.compare_exchange_strong( expected, Work::State::Cancelled,
+                                                        std::memory_order_acq_rel ) )
+                return StaticGraph::Action::Settle;
+            return StaticGraph::Action::None;
+        }
+
+        const bool run_now = Trigger::condition == Work::Conditional::OR ||
+                             Trigger::parent_count == 0 ||
+                             counter.pending_parents.fetch_sub( 1, std::memory_order_acq_rel ) == 1;
+        if ( !run_now )
+            return StaticGraph::Action::None;
+
+        if ( m_cancel_requested.load( std::memory_order_relaxed ) )
+        {
+            if ( counter.state.compare_exchange_strong( expected, Work::State::Cancelled,
+                                                        std::memory_order_acq_rel ) )
+                return StaticGraph::Action::Settle;
+            return StaticGraph::Action::None;
+        }
+
+        if ( !counter.state.compare_exchange_strong( expected, Work::State::Running,
+                                                     std::memory_order_acq_rel ) )
+            return StaticGraph::Action::None;
+        return StaticGraph::Action::Launch;
+    }
+
+    template<std::size_t I>
+    void submit()
+    {
+        m_executor->submit( [this]{ execute<I>(); } );
+    }
+    /**************************
+     * runs the worker unless the run was cancelled
+     * while the node was queued
+     *************************/
+    template<std::size_t I>
+    void execute()
+    {
+        if ( m_cancel_requested.load( std::memory_order_relaxed ) )
+        {
+            m_counters[I].state = Work::State::Cancelled;
+            conclude<I>( Work::State::Cancelled );
+            return;
+        }
+        m_counters[I].join.reset();
+        std::get<I>( m_workers )( Work::Control( this, static_cast<std::uint32_t>( I ), &StaticGraph::notify<I>,
+                                                 &m_executor, &m_counters[I].join ) );
+    }
+    /**************************
+     * Control::NotifyFunc of node I
+     *************************/
+    template<std::size_t I>
+    static void notify( void* owner, std::uint32_t, Work::State result )
+    {
+        StaticGraph* graph = static_cast<StaticGraph*>( owner );
+        graph->m_counters[I].state = result;
+        graph->template conclude<I>( result );
+    }
+    /**************************
+     * settles node I and everything it cancels, ends the run
+     * or starts the continuation
+     *************************/
+    template<std::size_t I>
+    void conclude( const Work::State result )
+    {
+        StaticGraph::Continuation continuation = nullptr;
+        const std::uint32_t settled = settle<I>( result, continuation );
+
+        // the run can not finish while the continuation is pending
+        if ( m_remaining.fetch_sub( settled, std::memory_order_acq_rel ) == settled )
+        {
+            std::lock_guard<std::mutex> lock( m_done_mutex );
+            m_finished = true;
+            m_done_signal.notify_all();
+            return;
+        }
+
+        if ( continuation != nullptr &&
+             !m_executor->run_as_continuation( [this, continuation]{ ( this->*continuation )(); } ) )
+            m_executor->submit( [this, continuation]{ ( this->*continuation )(); } );
+    }
+    /**************************
+     * informs the children of node I about its result,
+     * returns the number of nodes settled (I and the
+     * children it cancelled)
+     *************************/
+    template<std::size_t I>
+    std::uint32_t settle( const Work::State result, StaticGraph::Continuation& continuation )
+    {
+        return 1 + settle_children<I>( result, continuation, std::integral_constant<std::size_t, I + 1>() );
+    }
+
+    template<std::size_t I>
+    std::uint32_t settle_children( const Work::State, StaticGraph::Continuation&,
+                                   std::integral_constant<std::size_t, Size> )
+    {
+        return 0;
+    }
+
+    template<std::size_t I, std::size_t J>
+    std::uint32_t settle_children( const Work::State result, StaticGraph::Continuation& continuation,
+                                   std::integral_constant<std::size_t, J> )
+    {
+        const std::uint32_t settled = settle_child<J>( result, continuation,
+                                                       typename StaticGraph::TriggerOf<J>::template has_parent<I>() );
+        return settled + settle_children<I>( result, continuation, std::integral_constant<std::size_t, J + 1>() );
+    }
+
+    template<std::size_t J>
+    std::uint32_t settle_child( const Work::State, StaticGraph::Continuation&, std::false_type )
+    {
+        return 0;
+    }
+    /**************************
+     * the first child which became ready is the continuation
+     *************************/
+    template<std::size_t J>
+    std::uint32_t settle_child( const Work::State result, StaticGraph::Continuation& continuation, std::true_type )
+    {
+        switch( trigger<J>( result ) )
+        {
+            default: break;
+            case StaticGraph::Action::Launch:
+                if ( continuation == nullptr )
+                    continuation = &StaticGraph::template execute<J>;
+                else
+                    submit<J>();
+                break;
+            case StaticGraph::Action::Settle:
+                return settle<J>( Work::State::Cancelled, continuation );
+        }
+        return 0;
+    }
+
+private:
+    std::tuple<Workers...>                    m_workers;
+    std::array<StaticGraph::Counter, Size>    m_counters;
+    std::shared_ptr<Executor>                 m_executor;
+    std::atomic<std::uint32_t>                m_remaining;
+    std::mutex                                m_done_mutex;
+    std::condition_variable                   m_done_signal;
+    bool                                      m_finished;
+    std::atomic<bool>                         m_cancel_requested;
+};
+
+/**************************
+ * creates a StaticGraph of the topology with the given
+ * workers, one per node in the order of the topology
+ *
+ *   auto graph = make_static_graph<StaticTopology<Root, AllOf<0>, AllOf<0>, AllOf<1, 2>>>( w0, w1, w2, w3 );
+ *   graph.run( executor );
+ *   graph.wait_for_done();
+ *************************/
+template<typename Topology, typename... Workers>
+StaticGraph<Topology, typename std::decay<Workers>::type...> make_static_graph( Workers&&... workers )
+{
+    return StaticGraph<Topology, typename std::decay<Workers>::type...>( std::forward<Workers>( workers )... );
+}
+
+}
+
+#endif /* TREE_OF_WORK_STATIC */
@@ -0,0 +1,1015 @@
+/********************************************************************************
+ * MIT License
+ *
+ * Copyright (c) 2020 Christian Kranz
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ * 
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ * 
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ *******************************************************************************/
+#ifndef TREE_OF_WORK_STREAM
+#define TREE_OF_WORK_STREAM
+
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <mutex>
+#include <new>
+#include <stdexcept>
+#include <thread>
+#include <type_traits>
+#include <utility>
+#include <vector>
+
+#include "tree_of_work.h"
+#include "tree_of_work_dataflow.h"
+
+namespace TreeOfWork
+{
+namespace detail
+{
+/**************************
+ * keeps a member which is written by one side of a queue
+ * off the cache line of the members written by the other
+ *************************/
+template<typename T>
+struct CachePadded
+{
+    static const size_t CacheLine = 64;
+
+    T    value;
+    char padding[CacheLine - sizeof(T) % CacheLine];
+};
+
+inline size_t ring_size( size_t capacity )
+{
+    size_t size = 2;
+    while( size < capacity )
+        size *= 2;
+    return size;
+}
+
+/**************************
+ * Bounded lock free queue for exactly one producer and one
+ * consumer thread at a time.
+ *
+ * Both sides keep a copy of the position of the other side
+ * and only reload it when the ring looks full (or empty), so
+ * a push or pop usually touches no cache line the other side
+ * writes to.
+ *
+ *************************/
+template<typename T>
+class SpscQueue
+{
+    using Cell = typename std::aligned_storage<sizeof(T), alignof(T)>::type;
+public:
+    explicit SpscQueue( size_t capacity )
+        : m_cells( new Cell[ring_size( capacity )] )
+        , m_mask( ring_size( capacity ) - 1 )
+        , m_head()
+        , m_tail()
+        , m_cached_head()
+        , m_cached_tail()
+    {
+        m_head.value.store( 0, std::memory_order_relaxed );
+        m_tail.value.store( 0, std::memory_order_relaxed );
+        m_cached_head.value = 0;
+        m_cached_tail.value = 0;
+    }
+
+    ~SpscQueue()
+    {
+        Slot<T> value;
+        while( try_pop( value ) )
+            value.reset();
+    }
+    /**************************
+     * producer side, false if the ring is full
+     *************************/
+    template<typename U>
+    bool try_push( U&& value )
+    {
+        const size_t tail = m_tail.value.load( std::memory_order_relaxed );
+        if ( tail - m_cached_head.value > m_mask )
+        {
+            m_cached_head.value = m_head.value.load( std::memory_order_acquire );
+            if ( tail - m_cached_head.value > m_mask )
+                return false;
+        }
+
+        new ( &m_cells[tail & m_mask] ) T( std::forward<U>( value ) );
+        m_tail.value.store( tail + 1, std::memory_order_release );
+        return true;
+    }
+    /**************************
+     * consumer side, false if the ring is empty
+     *************************/
+    bool try_pop( Slot<T>& value )
+    {
+        const size_t head = m_head.value.load( std::memory_order_relaxed );
+        if ( head == m_cached_tail.value )
+        {
+            m_cached_tail.value = m_tail.value.load( std::memory_order_acquire );
+            if ( head == m_cached_tail.value )
+                return false;
+        }
+
+        T* item = reinterpret_cast<T*>( &m_cells[head & m_mask] );
+        value.emplace( std::move( *item ) );
+        item->~T();
+        m_head.value.store( head + 1, std::memory_order_release );
+        return true;
+    }
+    /**************************
+     * number of queued items, exact only while nobody pushes
+     *************************/
+    size_t size() const
+    {
+        const size_t head = m_head.value.load();
+        return m_tail.value.load() - head;
+    }
+
+    SpscQueue( const SpscQueue& ) = delete;
+    SpscQueue& operator=( const SpscQueue& ) = delete;
+
+private:
+    std::unique_ptr<Cell[]>          m_cells;
+    const size_t                     m_mask;
+    CachePadded<std::atomic<size_t>> m_head;
+    CachePadded<std::atomic<size_t>> m_tail;
+    CachePadded<size_t>              m_cached_head;
+    CachePadded<size_t>              m_cached_tail;
+};
+
+/**************************
+ * Bounded lock free queue for any number of producers and
+ * consumers: every cell carries a sequence number which tells
+ * whether it is free for the push or filled for the pop of a
+ * position, so both sides only have to claim their position
+ * with one compare and swap.
+ *
+ *************************/
+template<typename T>
+class MpmcQueue
+{
+    struct Cell
+    {
+        std::atomic<size_t>                                        sequence;
+        typename std::aligned_storage<sizeof(T), alignof(T)>::type storage;
+    };
+public:
+    explicit MpmcQueue( size_t capacity )
+        : m_cells( new MpmcQueue::Cell[ring_size( capacity )] )
+        , m_mask( ring_size( capacity ) - 1 )
+        , m_enqueue()
+        , m_dequeue()
+    {
+        for( size_t i = 0; i <= m_mask; ++i )
+            m_cells[i].sequence.store( i, std::memory_order_relaxed );
+        m_enqueue.value.store( 0, std::memory_order_relaxed );
+        m_dequeue.value.store( 0, std::memory_order_relaxed );
+    }
+
+    ~MpmcQueue()
+    {
+        Slot<T> value;
+        while( try_pop( value ) )
+            value.reset();
+    }
+    /**************************
+     * false if the ring is full
+     *************************/
+    template<typename U>
+    bool try_push( U&& value )
+    {
+        MpmcQueue::Cell* cell = nullptr;
+        size_t position = m_enqueue.value.load( std::memory_order_relaxed );
+        for( ;; )
+        {
+            cell = &m_cells[position & m_mask];
+            const size_t sequence = cell->sequence.load( std::memory_order_acquire );
+            const std::intptr_t distance = std::intptr_t( sequence ) - std::intptr_t( position );
+            if ( distance == 0 )
+            {
+                if ( m_enqueue.value.compare_exchange_weak( position, position + 1, std::memory_order_relaxed ) )
+                    break;
+            }
+            else if ( distance < 0 )
+                return false;
+            else
+                position = m_enqueue.value.load( std::memory_order_relaxed );
+        }
+
+        new ( &cell->storage ) T( std::forward<U>( value ) );
+        cell->sequence.store( position + 1, std::memory_order_release );
+        return true;
+    }
+    /**************************
+     * false if the ring is empty
+     *************************/
+    bool try_pop( Slot<T>& value )
+    {
+        MpmcQueue::Cell* cell = nullptr;
+        size_t position = m_dequeue.value.load( std::memory_order_relaxed );
+        for( ;; )
+        {
+            cell = &m_cells[position & m_mask];
+            const size_t sequence = cell->sequence.load( std::memory_order_acquire );
+            const std::intptr_t distance = std::intptr_t( sequence ) - std::intptr_t( position + 1 );
+            if ( distance == 0 )
+            {
+                if ( m_dequeue.value.compare_exchange_weak( position, position + 1, std::memory_order_relaxed ) )
+                    break;
+            }
+            else if ( distance < 0 )
+                return false;
+            else
+                position = m_dequeue.value.load( std::memory_order_relaxed );
+        }
+
+        T* item = reinterpret_cast<T*>( &cell->storage );
+        value.emplace( std::move( *item ) );
+        item->~T();
+        cell->sequence.store( position + m_mask + 1, std::memory_order_release );
+        return true;
+    }
+    /**************************
+     * number of queued items, exact only while nobody pushes
+     *************************/
+    size_t size() const
+    {
+        const size_t dequeue = m_dequeue.value.load();
+        const size_t enqueue = m_enqueue.value.load();
+        return enqueue > dequeue ? enqueue - dequeue : 0;
+    }
+
+    MpmcQueue( const MpmcQueue& ) = delete;
+    MpmcQueue& operator=( const MpmcQueue& ) = delete;
+
+private:
+    std::unique_ptr<MpmcQueue::Cell[]> m_cells;
+    const size_t                       m_mask;
+    CachePadded<std::atomic<size_t>>   m_enqueue;
+    CachePadded<std::atomic<size_t>>   m_dequeue;
+};
+
+/**************************
+ * input queue of a stream stage, a SpscQueue if the stage
+ * has one serial producer and is serial itself, a MpmcQueue
+ * otherwise
+ *************************/
+template<typename T>
+class StreamQueue
+{
+public:
+    StreamQueue( size_t capacity, bool single_producer, bool single_consumer )
+        : m_spsc( single_producer && single_consumer ? new SpscQueue<T>( capacity ) : nullptr )
+        , m_mpmc( m_spsc ? nullptr : new MpmcQueue<T>( capacity ) )
+    {}
+    /**************************
+     * the caller holds room for the item (@see StreamStage::claim),
+     * the ring may only be full for as long as a consumer is
+     * still moving an item out of the cell
+     *************************/
+    template<typename U>
+    void push( U&& value )
+    {
+        if ( m_spsc )
+        {
+            while( !m_spsc->try_push( std::forward<U>( value ) ) )
+                std::this_thread::yield();
+            return;
+        }
+        // try_push only moves from value if it succeeds
+        while( !m_mpmc->try_push( std::forward<U>( value ) ) )
+            std::this_thread::yield();
+    }
+
+    bool try_pop( Slot<T>& value )
+    {
+        return m_spsc ? m_spsc->try_pop( value ) : m_mpmc->try_pop( value );
+    }
+
+    size_t size() const
+    {
+        return m_spsc ? m_spsc->size() : m_mpmc->size();
+    }
+
+private:
+    std::unique_ptr<SpscQueue<T>> m_spsc;
+    std::unique_ptr<MpmcQueue<T>> m_mpmc;
+};
+
+/**************************
+ * the part of a stream stage its parents and children see
+ *
+ * room in the input queue is handed out as credits: a parent
+ * claims room for a batch before it takes the items of the
+ * batch from its own input, so the push of a result never
+ * has to wait for the child (@see StreamWork)
+ *************************/
+class StreamStage
+{
+public:
+    virtual ~StreamStage()
+    {}
+    /**************************
+     * claims room for up to count items, returns the number
+     * claimed; a producer which got nothing is woken
+     * (@see wake) once room is released
+     *************************/
+    virtual size_t claim( size_t count ) = 0;
+    /**************************
+     * returns room which was claimed but not used
+     *************************/
+    virtual void release( size_t count ) = 0;
+    /**************************
+     * true if claim would hand out room, otherwise the
+     * producer is woken once room is released
+     *************************/
+    virtual bool has_room() = 0;
+    /**************************
+     * input or room for results became available,
+     * or a parent is done
+     *************************/
+    virtual void wake() = 0;
+    /**************************
+     * a parent is done, it will not push anymore
+     *************************/
+    virtual void parent_done() = 0;
+    /**************************
+     * number of activations which may run at the same time
+     * (@see StreamWork::set_concurrency)
+     *************************/
+    virtual size_t concurrency() const = 0;
+    /**************************
+     * rebuilds the input queue after the parents changed
+     *************************/
+    virtual void configure() = 0;
+
+    virtual void add_parent( const std::shared_ptr<StreamStage>& parent ) = 0;
+    virtual void cancel() = 0;
+    virtual void reset( bool deep ) = 0;
+};
+
+/**************************
+ * a stream stage consuming items of type T
+ *************************/
+template<typename T>
+class StreamInput : public StreamStage
+{
+public:
+    /**************************
+     * queues an item into room claimed before
+     *************************/
+    virtual void put( T&& item ) = 0;
+};
+
+/**************************
+ * hands the result of a stage to its children: the last
+ * child receives it by move, all others by copy
+ *************************/
+template<typename T, bool Copyable = std::is_copy_constructible<T>::value>
+struct StreamOutput
+{
+    using Child = StreamInput<T>;
+
+    static void deliver( const std::vector<std::shared_ptr<Child>>& children, Slot<T>& out )
+    {
+        if ( children.empty() )
+            return;
+        for( size_t i = 0; i + 1 < children.size(); ++i )
+            children[i]->put( T( out.get() ) );
+        children.back()->put( std::move( out.get() ) );
+    }
+};
+/**************************
+ * a result which can not be copied feeds only one child
+ *************************/
+template<typename T>
+struct StreamOutput<T, false>
+{
+    using Child = StreamInput<T>;
+
+    static void deliver( const std::vector<std::shared_ptr<Child>>& children, Slot<T>& out )
+    {
+        if ( !children.empty() )
+            children.front()->put( std::move( out.get() ) );
+    }
+};
+
+template<>
+struct StreamOutput<void, false>
+{
+    using Child = StreamStage;
+
+    static void deliver( const std::vector<std::shared_ptr<Child>>&, Slot<void>& )
+    {}
+};
+}
+
+/**************************
+ * A stage of a streaming pipeline.
+ *
+ * StreamWork<Out(In)> calls its function Out(In) for every item
+ * of a stream instead of once per run, so a sequence of records
+ * flows through the same stages without resetting and
+ * re-triggering a tree per record. Stages are connected like
+ * typed nodes (@see StreamWork::connect); the results of a stage
+ * are queued into its children (the last child receives them by
+ * move, all others by copy) while the stage already works on the
+ * next item, so all stages of a pipeline run at the same time.
+ *
+ * Every stage has a bounded lock free input queue
+ * (@see set_capacity): an SpscQueue if the stage is fed by one
+ * serial parent and is serial itself, an MpmcQueue otherwise.
+ * A stage only takes a batch from its input once it claimed room
+ * for the results in all of its children, so a slow stage makes
+ * its parents stop and, at the root, push() wait: memory stays
+ * bounded by the capacities.
+ *
+ * A stage does not occupy a thread while it waits: it submits an
+ * activation to its executor whenever items and room for the
+ * results are available. An activation takes up to
+ * set_batch( n ) items per hand-off and wakes the children once
+ * per batch. With set_concurrency( n ) up to n activations run at
+ * the same time (the function has to be safe to call
+ * concurrently then) and results may leave out of order.
+ *
+ * Roots are fed by push()/try_push() and close(). A stage is done
+ * when all its parents are done (or it is closed) and its input
+ * queue is drained; it completes unless its function threw (the
+ * stage failed) or it was cancelled. A failed or cancelled stage
+ * discards the rest of its input, so its parents are not blocked,
+ * and cancels its descendants.
+ *
+ * Stages have to be owned by a std::shared_ptr
+ * (std::make_shared<StreamWork<Out(In)>>( f, executor )), the
+ * configuration (connect, set_*) must not change while items
+ * are flowing. The last activation holds its stage (and so the
+ * executor) until it returned, which may be just after the stage
+ * is done: dropping all references then is fine, the stage and
+ * its executor are destroyed by that activation
+ * (@see Executor::join_threads).
+ *
+ *************************/
+template<typename Signature>
+class StreamWork;
+
+template<typename Out, typename In>
+class StreamWork<Out(In)> : public detail::StreamInput<typename std::decay<In>::type>
+                          , public std::enable_shared_from_this<StreamWork<Out(In)>>
+{
+    using Item   = typename std::decay<In>::type;
+    using Output = detail::StreamOutput<Out>;
+    using Child  = typename Output::Child;
+public:
+    static const size_t DefaultCapacity = 1024;
+    static const size_t DefaultBatch    = 16;
+
+public:
+    /**************************
+     * a stage is defined by its function
+     * (any callable Out(In), stored inline)
+     * and the executor its activations run on
+     *************************/
+    template<typename F,
+             typename = typename std::enable_if<
+                 !std::is_same<typename std::decay<F>::type, StreamWork>::value>::type>
+    StreamWork( F&& f,
+                std::shared_ptr<Executor> executor = Executor::default_executor() )
+        : m_function( std::forward<F>( f ) )
+        , m_executor( std::move( executor ) )
+        , m_queue()
+        , m_children()
+        , m_parents()
+        , m_capacity( StreamWork::DefaultCapacity )
+        , m_batch( StreamWork::DefaultBatch )
+        , m_concurrency( 1 )
+        , m_credits( 0 )
+        , m_starved( false )
+        , m_active( 0 )
+        , m_open( 1 )
+        , m_accepting( true )
+        , m_finishing( false )
+        , m_state( Work::State::Running )
+        , m_mutex()
+        , m_room()
+        , m_done_signal()
+        , m_finished( false )
+        , m_callbacks()
+    {
+        configure();
+    }
+    /**************************
+     * queues the results of this stage into the input of child
+     *************************/
+    template<typename COut, typename CIn>
+    void connect( const std::shared_ptr<StreamWork<COut(CIn)>>& child )
+    {
+        static_assert( !std::is_void<Out>::value, "a stage without result can not feed a child" );
+        static_assert( std::is_same<typename std::decay<CIn>::type, Out>::value,
+                       "the child has to consume the result type of the stage" );
+
+        if ( !std::is_copy_constructible<Out>::value && !m_children.empty() )
+            throw std::invalid_argument( "TreeOfWork::StreamWork: a result which can not be copied feeds only one child" );
+
+        m_children.push_back( child );
+        static_cast<detail::StreamStage&>( *child ).add_parent( this->shared_from_this() );
+    }
+    /**************************
+     * bound of the input queue in items (default 1024)
+     *************************/
+    void set_capacity( size_t items )
+    {
+        m_capacity = items == 0 ? 1 : items;
+        configure();
+    }
+    /**************************
+     * most items an activation takes per hand-off (default 16):
+     * larger batches claim room, release room and wake the
+     * children less often, smaller ones hand results on sooner
+     *************************/
+    void set_batch( size_t items )
+    {
+        m_batch = items == 0 ? 1 : items;
+    }
+    /**************************
+     * most activations running at the same time (default 1,
+     * which keeps the order of the items)
+     *************************/
+    void set_concurrency( size_t activations )
+    {
+        m_concurrency = activations == 0 ? 1 : activations;
+        configure();
+        for( const std::shared_ptr<Child>& child : m_children )
+            child->configure();
+    }
+    /**************************
+     * queues an item into a root, waits while its input is full
+     *
+     * false if the stage does not accept items (anymore): it has
+     * parents, was closed, failed or was cancelled. Blocks the
+     * calling thread, use try_push() from within a worker.
+     *************************/
+    template<typename U>
+    bool push( U&& item )
+    {
+        for( ;; )
+        {
+            if ( !accepting() )
+                return false;
+            if ( claim( 1 ) == 1 )
+                break;
+
+            // flagged under the lock before every check: a release()
+            // which misses the check sees the flag and notifies once
+            // this thread waits (@see wake_parents)
+            std::unique_lock<std::mutex> lock( m_mutex );
+            m_room.wait( lock, [this]
+                               {
+                                   m_starved = true;
+                                   return m_credits.load() > 0 || !accepting();
+                               } );
+        }
+
+        m_queue->push( std::forward<U>( item ) );
+        wake();
+        return true;
+    }
+    /**************************
+     * like push(), but false instead of waiting if the input is full
+     *************************/
+    template<typename U>
+    bool try_push( U&& item )
+    {
+        if ( !accepting() || claim( 1 ) == 0 )
+            return false;
+
+        m_queue->push( std::forward<U>( item ) );
+        wake();
+        return true;
+    }
+    /**************************
+     * ends the stream of a root: it is done once the items
+     * pushed so far went through
+     *************************/
+    void close()
+    {
+        if ( m_accepting.exchange( false ) )
+            parent_done();
+    }
+    /**************************
+     * stops the stage and its descendants, the rest of the
+     * stream is discarded; also closes a root
+     *************************/
+    void cancel() override
+    {
+        Work::State expected = Work::State::Running;
+        if ( m_state.compare_exchange_strong( expected, Work::State::Cancelled ) )
+            stop();
+    }
+    /**************************
+     * prepares a stage which is done for another stream
+     * (deep: its descendants as well)
+     *************************/
+    void reset( bool deep = false ) override
+    {
+        m_state = Work::State::Running;
+        m_open = m_parents.empty() ? 1 : m_parents.size();
+        m_accepting = m_parents.empty();
+        m_finishing = false;
+        {
+            std::lock_guard<std::mutex> lock( m_mutex );
+            m_finished = false;
+            m_callbacks.clear();
+        }
+
+        if ( !deep )
+            return;
+        for( const std::shared_ptr<Child>& child : m_children )
+            child->reset( true );
+    }
+    /**************************
+     * Running until the stage is done
+     *************************/
+    Work::State get_state() const
+    {
+        return m_state.load();
+    }
+    /**************************
+     * items waiting in the input queue
+     *************************/
+    size_t size() const
+    {
+        return m_queue->size();
+    }
+    /**************************
+     * @see Work::wait_for_done
+     *************************/
+    void wait_for_done()
+    {
+        std::unique_lock<std::mutex> lock( m_mutex );
+        m_done_signal.wait( lock, [this]{ return m_finished; } );
+    }
+
+    template<typename Rep, typename Period>
+    bool wait_for_done( const std::chrono::duration<Rep, Period>& timeout )
+    {
+        std::unique_lock<std::mutex> lock( m_mutex );
+        return m_done_signal.wait_for( lock, timeout, [this]{ return m_finished; } );
+    }
+
+    template<typename Clock, typename Duration>
+    bool wait_until( const std::chrono::time_point<Clock, Duration>& deadline )
+    {
+        std::unique_lock<std::mutex> lock( m_mutex );
+        return m_done_signal.wait_until( lock, deadline, [this]{ return m_finished; } );
+    }
+    /**************************
+     * @see Work::try_is_done
+     *************************/
+    bool try_is_done()
+    {
+        std::lock_guard<std::mutex> lock( m_mutex );
+        return m_finished;
+    }
+    /**************************
+     * calls callback( state ) once the stage is done,
+     * or right away if it is done already (@see Work::on_done)
+     *************************/
+    template<typename F>
+    void on_done( F&& callback )
+    {
+        {
+            std::lock_guard<std::mutex> lock( m_mutex );
+            if ( !m_finished )
+            {
+                m_callbacks.emplace_back( std::forward<F>( callback ) );
+                return;
+            }
+        }
+        callback( m_state.load() );
+    }
+
+    StreamWork( const StreamWork& ) = delete;
+    StreamWork& operator=( const StreamWork& ) = delete;
+
+private:
+    /**************************
+     * @see detail::StreamStage
+     *************************/
+    size_t claim( size_t count ) override
+    {
+        size_t credits = m_credits.load();
+        for( ;; )
+        {
+            if ( credits == 0 )
+            {
+                // release() sees the flag or this reload sees its credits
+                m_starved = true;
+                credits = m_credits.load();
+                if ( credits == 0 )
+                    return 0;
+                continue;
+            }
+
+            const size_t claimed = credits < count ? credits : count;
+            if ( m_credits.compare_exchange_weak( credits, credits - claimed ) )
+                return claimed;
+        }
+    }
+
+    void release( size_t count ) override
+    {
+        m_credits.fetch_add( count );
+        if ( m_starved.load() && m_starved.exchange( false ) )
+            wake_parents();
+    }
+
+    bool has_room() override
+    {
+        if ( m_credits.load() > 0 )
+            return true;
+        m_starved = true;
+        return m_credits.load() > 0;
+    }
+
+    void put( Item&& item ) override
+    {
+        m_queue->push( std::move( item ) );
+    }
+
+    void wake() override
+    {
+        schedule();
+        check_done();
+    }
+
+    void parent_done() override
+    {
+        m_open--;
+        wake();
+    }
+
+    size_t concurrency() const override
+    {
+        return m_concurrency;
+    }
+
+    void configure() override
+    {
+        bool single_producer = false;
+        if ( m_parents.size() == 1 )
+        {
+            const std::shared_ptr<detail::StreamStage> parent = m_parents.front().lock();
+            single_producer = parent && parent->concurrency() == 1;
+        }
+
+        m_queue.reset( new detail::StreamQueue<Item>( m_capacity, single_producer, m_concurrency == 1 ) );
+        m_credits = m_capacity;
+    }
+
+    void add_parent( const std::shared_ptr<detail::StreamStage>& parent ) override
+    {
+        m_parents.push_back( parent );
+        m_open = m_parents.size();
+        m_accepting = false;
+        configure();
+    }
+
+private:
+    bool accepting() const
+    {
+        return m_accepting.load() && m_state.load() == Work::State::Running;
+    }
+    /**************************
+     * a failed or cancelled stage: wake whoever waits for room,
+     * cancel the descendants and drain the input
+     *************************/
+    void stop()
+    {
+        // before close(), which may finish the stage and its children
+        for( const std::shared_ptr<Child>& child : m_children )
+            child->cancel();
+        {
+            std::lock_guard<std::mutex> lock( m_mutex );
+            m_room.notify_all();
+        }
+        close();
+        wake();
+    }
+
+    void wake_parents()
+    {
+        for( const std::weak_ptr<detail::StreamStage>& p : m_parents )
+        {
+            if ( std::shared_ptr<detail::StreamStage> parent = p.lock() )
+                parent->wake();
+        }
+        if ( m_parents.empty() )
+        {
+            std::lock_guard<std::mutex> lock( m_mutex );
+            m_room.notify_all();
+        }
+    }
+    /**************************
+     * true if the children can take results, a stage which
+     * does not run anymore only discards its input
+     *************************/
+    bool has_output_room()
+    {
+        if ( m_state.load() != Work::State::Running )
+            return true;
+        for( const std::shared_ptr<Child>& child : m_children )
+        {
+            if ( !child->has_room() )
+                return false;
+        }
+        return true;
+    }
+    /**************************
+     * starts another activation if there is a batch for it
+     * and room for its results
+     *************************/
+    void schedule()
+    {
+        size_t active = m_active.load();
+        while( active < m_concurrency && m_queue->size() > active * m_batch && has_output_room() )
+        {
+            if ( m_active.compare_exchange_weak( active, active + 1 ) )
+            {
+                std::shared_ptr<StreamWork> self = this->shared_from_this();
+                m_executor->submit( [self]{ self->activate(); } );
+                return;
+            }
+        }
+    }
+    /**************************
+     * claims room for count results in all children,
+     * returns the room claimed in each of them
+     *************************/
+    size_t claim_output( size_t count )
+    {
+        for( size_t i = 0; i < m_children.size() && count > 0; ++i )
+        {
+            const size_t claimed = m_children[i]->claim( count );
+            if ( claimed < count )
+            {
+                for( size_t k = 0; k < i; ++k )
+                    m_children[k]->release( count - claimed );
+            }
+            count = claimed;
+        }
+        return count;
+    }
+
+    void release_output( size_t count )
+    {
+        if ( count == 0 )
+            return;
+        for( const std::shared_ptr<Child>& child : m_children )
+            child->release( count );
+    }
+    /**************************
+     * runs batches until the input is empty or the children
+     * are full
+     *************************/
+    void activate()
+    {
+        detail::Slot<Item> item;
+        for( ;; )
+        {
+            const bool discard = m_state.load() != Work::State::Running;
+            const size_t claimed = discard ? m_batch : claim_output( m_batch );
+
+            size_t taken = 0;
+            size_t delivered = 0;
+            while( taken < claimed && m_queue->try_pop( item ) )
+            {
+                ++taken;
+                if ( !discard && process( item ) )
+                    ++delivered;
+                item.reset();
+            }
+
+            if ( !discard )
+                release_output( claimed - delivered );
+            if ( taken > 0 )
+                release( taken );
+            if ( delivered > 0 )
+            {
+                for( const std::shared_ptr<Child>& child : m_children )
+                    child->wake();
+            }
+            if ( claimed == 0 || taken < claimed )
+                break;
+        }
+
+        m_active--;
+        // items or room which arrived while this activation
+        // was still counted did not start another one
+        wake();
+    }
+    /**************************
+     * calls the function for one item and delivers the result,
+     * false if nothing was delivered
+     *************************/
+    bool process( detail::Slot<Item>& item )
+    {
+        if ( m_state.load( std::memory_order_relaxed ) != Work::State::Running )
+            return false;
+
+        detail::Slot<Out> result;
+        try
+        {
+            detail::Invoker<Out>::invoke( result, m_function, std::move( item.get() ) );
+        }
+        catch( ... )
+        {
+            Work::State expected = Work::State::Running;
+            if ( m_state.compare_exchange_strong( expected, Work::State::Failed ) )
+                stop();
+            return false;
+        }
+
+        Output::deliver( m_children, result );
+        return true;
+    }
+    /**************************
+     * the stage is done once no parent is open, the input is
+     * drained and no activation is running (in this order, so
+     * no item can be taken unseen in between)
+     *************************/
+    void check_done()
+    {
+        if ( m_open.load() != 0 || m_queue->size() != 0 || m_active.load() != 0 )
+            return;
+        if ( m_finishing.exchange( true ) )
+            return;
+
+        Work::State expected = Work::State::Running;
+        m_state.compare_exchange_strong( expected, Work::State::Completed );
+        const Work::State state = m_state.load();
+
+        std::vector<Work::Callback> callbacks;
+        {
+            std::lock_guard<std::mutex> lock( m_mutex );
+            m_finished = true;
+            callbacks.swap( m_callbacks );
+            m_done_signal.notify_all();
+            m_room.notify_all();
+        }
+        // signalled first: once the last stage is done, no stage
+        // of the stream is touched anymore and all can be reset
+        for( const std::shared_ptr<Child>& child : m_children )
+            child->parent_done();
+
+        for( Work::Callback& callback : callbacks )
+            callback( state );
+    }
+
+private:
+    detail::InplaceFunction<Out(In)>                m_function;
+    std::shared_ptr<Executor>                       m_executor;
+    std::unique_ptr<detail::StreamQueue<Item>>      m_queue;
+    std::vector<std::shared_ptr<Child>>             m_children;
+    std::vector<std::weak_ptr<detail::StreamStage>> m_parents;
+    size_t                                          m_capacity;
+    size_t                                          m_batch;
+    size_t                                          m_concurrency;
+    std::atomic<size_t>                             m_credits;
+    std::atomic<bool>                               m_starved;
+    std::atomic<size_t>                             m_active;
+    std::atomic<size_t>                             m_open;
+    std::atomic<bool>                               m_accepting;
+    std::atomic<bool>                               m_finishing;
+    std::atomic<Work::State>                        m_state;
+    std::mutex                                      m_mutex;
+    std::condition_variable                         m_room;
+    std::condition_variable                         m_done_signal;
+    bool                                            m_finished;
+    std::vector<Work::Callback>                     m_callbacks;
+};
+
+}
+
+#endif /* TREE_OF_WORK_STREAM */
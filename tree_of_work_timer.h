@@ -0,0 +1,372 @@
+/********************************************************************************
+ * MIT License
+ *
+ * Copyright (c) 2020 Christian Kranz
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ * 
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ * 
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ *******************************************************************************/
+#ifndef TREE_OF_WORK_TIMER
+#define TREE_OF_WORK_TIMER
+
+#include <algorithm>
+#include <chrono>
+#include <condition_variable>
+#include <cstdint>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+#include "tree_of_work_function.h"
+
+namespace TreeOfWork
+{
+namespace detail
+{
+/**************************
+ * One shared thread which calls callbacks at given points in
+ * time, so waiting nodes do not occupy an executor thread and
+ * deadlines need no watchdog thread.
+ *
+ * The timers are kept in a hashed timing wheel: a ring of
+ * Slots lists, one per tick, each timer sits in the list of
+ * the tick it is due in and counts the turns of the wheel it
+ * still has to wait. Scheduling and cancelling a timer are
+ * O(1), most deadlines are cancelled long before they expire.
+ * A timer fires at the first tick at or after its time point;
+ * the thread only wakes up for ticks with timers (at least
+ * once per turn while long timers are pending).
+ *
+ * Callbacks run on the timer thread and have to be short,
+ * e.g. submit the actual work to an executor.
+ * Timers which are still pending when the service is
+ * destroyed are dropped without being called.
+ *
+ *************************/
+class TimerService
+{
+public:
+    using Clock    = std::chrono::steady_clock;
+    using Callback = detail::InplaceFunction<void(void)>;
+    /**************************
+     * identifies a scheduled timer, @see cancel
+     *************************/
+    using Handle = std::uint64_t;
+
+    static const Handle NoTimer = 0;
+
+public:
+    TimerService()
+        : m_mutex()
+        , m_wakeup()
+        , m_fired()
+        , m_epoch( Clock::now() )
+        , m_entries()
+        , m_free( TimerService::End )
+        , m_heads( TimerService::Slots, std::uint32_t( TimerService::End ) )
+        , m_tails( TimerService::Slots, std::uint32_t( TimerService::End ) )
+        , m_pending( 0 )
+        , m_tick( 0 )
+        , m_stop( false )
+        , m_thread()
+    {
+        m_thread = std::thread( &TimerService::run, this );
+    }
+    /**************************
+     *
+     *************************/
+    ~TimerService()
+    {
+        {
+            std::lock_guard<std::mutex> lock( m_mutex );
+            m_stop = true;
+        }
+        m_wakeup.notify_one();
+
+        if ( m_thread.joinable() )
+            m_thread.join();
+    }
+    /**************************
+     * the service shared by all nodes
+     *************************/
+    static TimerService& instance()
+    {
+        static TimerService service;
+        return service;
+    }
+    /**************************
+     * calls callback on the timer thread once at is reached
+     * (timers due in the same tick fire in the order they
+     * were scheduled)
+     *************************/
+    TimerService::Handle schedule( Clock::time_point at, TimerService::Callback callback )
+    {
+        bool earliest = false;
+        TimerService::Handle handle = TimerService::NoTimer;
+        {
+            std::lock_guard<std::mutex> lock( m_mutex );
+            // an idle wheel catches up at once instead of tick by tick
+            if ( m_pending == 0 )
+                m_tick = std::max( m_tick, tick_of( Clock::now() ) );
+
+            const std::uint64_t tick = std::max( m_tick, tick_of( at ) );
+            const std::uint32_t index = allocate();
+            TimerService::Entry& entry = m_entries[index];
+            entry.callback = std::move( callback );
+            entry.rounds = ( tick - m_tick ) / TimerService::Slots;
+            entry.slot = static_cast<std::uint32_t>( tick % TimerService::Slots );
+            entry.due = false;
+            entry.firing = false;
+            link( index );
+
+            // later timers are counted down by the catch up of the thread
+            earliest = m_pending++ == 0 || entry.rounds == 0;
+            handle = ( TimerService::Handle( entry.generation ) << 32 ) | index;
+        }
+        if ( earliest )
+            m_wakeup.notify_one();
+        return handle;
+    }
+    /**************************
+     * drops a pending timer, returns false if it fired already;
+     * once cancel returned the callback is not running anymore
+     * (unless cancel is called by the callback itself)
+     *************************/
+    bool cancel( const TimerService::Handle handle )
+    {
+        const std::uint32_t index = static_cast<std::uint32_t>( handle );
+        const std::uint32_t generation = static_cast<std::uint32_t>( handle >> 32 );
+
+        std::unique_lock<std::mutex> lock( m_mutex );
+        if ( handle == TimerService::NoTimer || index >= m_entries.size() ||
+             m_entries[index].generation != generation )
+            return false;
+
+        if ( m_entries[index].firing )
+        {
+            if ( std::this_thread::get_id() != m_thread.get_id() )
+                m_fired.wait( lock, [this, index, generation]{ return m_entries[index].generation != generation; } );
+            return false;
+        }
+
+        // the callback is destroyed outside the lock
+        TimerService::Callback dropped = std::move( m_entries[index].callback );
+        if ( !m_entries[index].due )
+            unlink( index );
+        release( index );
+        m_pending--;
+        lock.unlock();
+        return true;
+    }
+
+    TimerService( const TimerService& ) = delete;
+    TimerService& operator=( const TimerService& ) = delete;
+
+private:
+    static const std::uint32_t Slots = 512;
+    static const std::uint32_t End   = ~std::uint32_t( 0 );
+
+    using Tick = std::chrono::milliseconds;
+
+    struct Entry
+    {
+        TimerService::Callback callback;
+        std::uint64_t          rounds;
+        std::uint32_t          slot;
+        std::uint32_t          previous;
+        std::uint32_t          next;
+        std::uint32_t          generation;
+        bool                   due;
+        bool                   firing;
+    };
+    struct Due
+    {
+        std::uint32_t index;
+        std::uint32_t generation;
+    };
+
+private:
+    /**************************
+     * first tick at or after at
+     *************************/
+    std::uint64_t tick_of( const Clock::time_point at ) const
+    {
+        if ( at <= m_epoch )
+            return 0;
+        const Clock::duration since = at - m_epoch;
+        const std::uint64_t ticks = static_cast<std::uint64_t>( std::chrono::duration_cast<TimerService::Tick>( since ).count() );
+        return Clock::duration( TimerService::Tick( ticks ) ) < since ? ticks + 1 : ticks;
+    }
+
+    Clock::time_point time_of( const std::uint64_t tick ) const
+    {
+        return m_epoch + TimerService::Tick( tick );
+    }
+    /**************************
+     * entries are recycled, a new generation tells a stale
+     * handle from the timer which reuses its entry
+     *************************/
+    std::uint32_t allocate()
+    {
+        if ( m_free == TimerService::End )
+        {
+            m_entries.push_back( TimerService::Entry{ TimerService::Callback(), 0, 0, TimerService::End,
+                                                      TimerService::End, 1, false, false } );
+            return static_cast<std::uint32_t>( m_entries.size() - 1 );
+        }
+        const std::uint32_t index = m_free;
+        m_free = m_entries[index].next;
+        return index;
+    }
+
+    void release( const std::uint32_t index )
+    {
+        TimerService::Entry& entry = m_entries[index];
+        entry.callback = TimerService::Callback();
+        entry.due = false;
+        entry.firing = false;
+        entry.generation = entry.generation + 1 != 0 ? entry.generation + 1 : 1;
+        entry.next = m_free;
+        m_free = index;
+    }
+
+    void link( const std::uint32_t index )
+    {
+        TimerService::Entry& entry = m_entries[index];
+        entry.previous = m_tails[entry.slot];
+        entry.next = TimerService::End;
+        if ( entry.previous != TimerService::End )
+            m_entries[entry.previous].next = index;
+        else
+            m_heads[entry.slot] = index;
+        m_tails[entry.slot] = index;
+    }
+
+    void unlink( const std::uint32_t index )
+    {
+        const TimerService::Entry& entry = m_entries[index];
+        if ( entry.previous != TimerService::End )
+            m_entries[entry.previous].next = entry.next;
+        else
+            m_heads[entry.slot] = entry.next;
+        if ( entry.next != TimerService::End )
+            m_entries[entry.next].previous = entry.previous;
+        else
+            m_tails[entry.slot] = entry.previous;
+    }
+    /**************************
+     * the next tick whose slot holds timers
+     *************************/
+    std::uint64_t next_tick() const
+    {
+        for( std::uint64_t tick = m_tick; tick < m_tick + TimerService::Slots; ++tick )
+        {
+            if ( m_heads[tick % TimerService::Slots] != TimerService::End )
+                return tick;
+        }
+        return m_tick + TimerService::Slots;
+    }
+    /**************************
+     * timer thread
+     *************************/
+    void run()
+    {
+        std::vector<TimerService::Due> due;
+        std::unique_lock<std::mutex> lock( m_mutex );
+        while( !m_stop )
+        {
+            if ( m_pending == 0 )
+            {
+                m_wakeup.wait( lock );
+                continue;
+            }
+
+            const Clock::time_point at = time_of( next_tick() );
+            const Clock::time_point now = Clock::now();
+            if ( now < at )
+            {
+                m_wakeup.wait_until( lock, at );
+                continue;
+            }
+
+            // all ticks up to now, slots of skipped ticks are empty
+            const std::uint64_t last = static_cast<std::uint64_t>(
+                std::chrono::duration_cast<TimerService::Tick>( now - m_epoch ).count() );
+            for( ; m_tick <= last && m_pending > due.size(); ++m_tick )
+            {
+                const std::uint32_t slot = static_cast<std::uint32_t>( m_tick % TimerService::Slots );
+                for( std::uint32_t index = m_heads[slot]; index != TimerService::End; )
+                {
+                    TimerService::Entry& entry = m_entries[index];
+                    const std::uint32_t next = entry.next;
+                    if ( entry.rounds == 0 )
+                    {
+                        unlink( index );
+                        entry.due = true;
+                        due.push_back( TimerService::Due{ index, entry.generation } );
+                    }
+                    else
+                    {
+                        entry.rounds--;
+                    }
+                    index = next;
+                }
+            }
+            if ( m_pending == due.size() )
+                m_tick = std::max( m_tick, last + 1 );
+
+            // due timers can still be cancelled until they fire
+            for( const TimerService::Due& timer : due )
+            {
+                const std::uint32_t index = timer.index;
+                if ( m_entries[index].generation != timer.generation )
+                    continue;
+
+                m_entries[index].firing = true;
+                m_pending--;
+                {
+                    TimerService::Callback callback = std::move( m_entries[index].callback );
+                    lock.unlock();
+                    callback();
+                }
+                lock.lock();
+                release( index );
+                m_fired.notify_all();
+            }
+            due.clear();
+        }
+    }
+
+private:
+    std::mutex                       m_mutex;
+    std::condition_variable          m_wakeup;
+    std::condition_variable          m_fired;
+    const Clock::time_point          m_epoch;
+    std::vector<TimerService::Entry> m_entries;
+    std::uint32_t                    m_free;
+    std::vector<std::uint32_t>       m_heads;
+    std::vector<std::uint32_t>       m_tails;
+    size_t                           m_pending;
+    std::uint64_t                    m_tick;
+    bool                             m_stop;
+    std::thread                      m_thread;
+};
+}
+}
+
+#endif /* TREE_OF_WORK_TIMER */